@@ -0,0 +1,369 @@
+#pragma once
+
+// Asynchronous logger shared by server, price and t4btofix. A thread that
+// logs copies its arguments in binary form into its own single-producer ring
+// and goes on; one background thread formats the records, prefixes the time
+// they were logged and writes them out, flushing once per pass instead of
+// once per line. Debug and info lines go to stdout, warnings and errors to
+// stderr, as before.
+//
+//     LOG_INFO("Logon: ", sessionID);
+//     LOG_DEBUG("Received raw message: ", message.toString());
+//
+// Arguments are concatenated as operator<< would print them. Numbers and
+// strings are stored as they are and only turned into text by the logging
+// thread; anything else is streamed into a string by the caller. Below
+// log_level() a LOG_* statement evaluates none of its arguments, so
+// message.toString() above costs nothing unless LogLevel=debug.
+//
+// Logging never blocks. When a thread's ring is full its records are
+// dropped and counted, and the logging thread reports how many. Records left
+// at exit are written by an atexit handler; a process killed by a signal may
+// lose the last millisecond of them.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+enum LogLevel : uint8_t {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR,
+};
+
+constexpr size_t LOG_RING_BYTES = size_t(1) << 20;     // per logging thread
+constexpr size_t LOG_MAX_RECORD = LOG_RING_BYTES / 4;
+constexpr int LOG_IDLE_SLEEP_US = 1000;                 // logging thread poll interval when idle
+
+// Lines below this level are skipped before their arguments are evaluated
+inline std::atomic<uint8_t>& log_level_storage() {
+    static std::atomic<uint8_t> level{LOG_LEVEL_INFO};
+    return level;
+}
+inline LogLevel log_level() {
+    return static_cast<LogLevel>(log_level_storage().load(std::memory_order_relaxed));
+}
+inline void set_log_level(LogLevel level) {
+    log_level_storage().store(level, std::memory_order_relaxed);
+}
+
+// debug, info, warning or error (the LogLevel setting); false if unknown
+inline bool parse_log_level(const std::string& text, LogLevel& level) {
+    static const char* const names[] = {"debug", "info", "warning", "error"};
+    for (int i = 0; i < 4; ++i) {
+        if (text == names[i]) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// --- Record encoding ---
+//
+// A record is a LogRecordHeader followed by its arguments back to back:
+// arithmetic values as their bytes, text as a uint32_t length and the
+// characters. decode is instantiated for the argument types of the call
+// site, so the logging thread knows how to read them back.
+
+struct LogText {
+    const char* data;
+    uint32_t size;
+};
+
+using LogDecodeFn = void (*)(const char* args, std::ostream& out);
+
+struct LogRecordHeader {
+    LogDecodeFn decode;     // nullptr marks padding up to the end of the ring
+    uint64_t time_ns;
+    uint32_t size;          // whole record, a multiple of 8
+    uint8_t level;
+};
+
+// What each argument is stored as: arithmetic values and text as they are,
+// everything else as the text operator<< makes of it
+template <typename T, typename Enable = void>
+struct LogArg {
+    static std::string convert(const T& value) {
+        std::ostringstream text;
+        text << value;
+        return text.str();
+    }
+};
+template <typename T>
+struct LogArg<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+    static T convert(T value) { return value; }
+};
+template <>
+struct LogArg<std::string> {
+    static LogText convert(const std::string& value) { return LogText{value.data(), static_cast<uint32_t>(value.size())}; }
+};
+template <typename T>
+struct LogArg<T, typename std::enable_if<std::is_convertible<const T&, const char*>::value>::type> {
+    static LogText convert(const char* value) { return LogText{value, static_cast<uint32_t>(std::strlen(value))}; }
+};
+
+template <typename T>
+inline size_t log_arg_size(const T&) { return sizeof(T); }
+inline size_t log_arg_size(const LogText& text) { return sizeof(uint32_t) + text.size; }
+inline size_t log_arg_size(const std::string& text) { return sizeof(uint32_t) + text.size(); }
+
+template <typename T>
+inline char* log_put(char* p, const T& value) {
+    std::memcpy(p, &value, sizeof(T));
+    return p + sizeof(T);
+}
+inline char* log_put(char* p, const LogText& text) {
+    std::memcpy(p, &text.size, sizeof(uint32_t));
+    std::memcpy(p + sizeof(uint32_t), text.data, text.size);
+    return p + sizeof(uint32_t) + text.size;
+}
+inline char* log_put(char* p, const std::string& text) {
+    return log_put(p, LogText{text.data(), static_cast<uint32_t>(text.size())});
+}
+
+// Read back one argument stored as T and print it
+template <typename T>
+struct LogGet {
+    static const char* print(const char* p, std::ostream& out) {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        out << value;
+        return p + sizeof(T);
+    }
+};
+template <>
+struct LogGet<LogText> {
+    static const char* print(const char* p, std::ostream& out) {
+        uint32_t size;
+        std::memcpy(&size, p, sizeof(size));
+        out.write(p + sizeof(size), size);
+        return p + sizeof(size) + size;
+    }
+};
+
+// std::string arguments (from LogArg's fallback) are stored as LogText
+template <typename T>
+struct LogStored {
+    using type = T;
+};
+template <>
+struct LogStored<std::string> {
+    using type = LogText;
+};
+
+template <typename... Stored>
+void log_decode(const char* p, std::ostream& out) {
+    int expand[] = {0, (p = LogGet<Stored>::print(p, out), 0)...};
+    (void)expand;
+}
+
+// --- Per-thread rings ---
+
+// Bytes one thread has logged and the logging thread has not written yet.
+// Positions only grow; a record never wraps, the tail of the ring is padded
+// instead. The two positions sit on separate cache lines.
+struct LogRing {
+    std::atomic<uint64_t> write_pos{0};
+    char write_pad[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> read_pos{0};
+    char read_pad[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> closed{false};     // its thread has exited
+    char data[LOG_RING_BYTES];
+
+    // Space for a record of size bytes, or nullptr if the ring is full
+    char* reserve(size_t size) {
+        uint64_t head = write_pos.load(std::memory_order_relaxed);
+        size_t offset = static_cast<size_t>(head % LOG_RING_BYTES);
+        size_t padding = LOG_RING_BYTES - offset < size ? LOG_RING_BYTES - offset : 0;
+        if (head + padding + size - read_pos.load(std::memory_order_acquire) > LOG_RING_BYTES) return nullptr;
+        if (padding) {
+            if (padding >= sizeof(LogRecordHeader)) {
+                LogRecordHeader pad{nullptr, 0, static_cast<uint32_t>(padding), 0};
+                std::memcpy(data + offset, &pad, sizeof(pad));
+            }
+            write_pos.store(head + padding, std::memory_order_release);
+            offset = 0;
+        }
+        return data + offset;
+    }
+
+    void commit(size_t size) {
+        write_pos.store(write_pos.load(std::memory_order_relaxed) + size, std::memory_order_release);
+    }
+};
+
+class AsyncLogger {
+public:
+    // Never destroyed, so threads may log while static objects are torn down
+    static AsyncLogger& instance() {
+        static AsyncLogger* logger = new AsyncLogger();
+        return *logger;
+    }
+
+    template <typename... Args>
+    void log(LogLevel level, const Args&... args) {
+        write(level, LogArg<Args>::convert(args)...);
+    }
+
+    // Write everything logged so far; used at exit
+    void flush() {
+        std::lock_guard<std::mutex> lock(drain_mutex);
+        drain();
+    }
+
+private:
+    AsyncLogger() {
+        std::atexit([] { AsyncLogger::instance().flush(); });
+        std::thread([this] { run(); }).detach();
+    }
+
+    // Owns the calling thread's ring and hands it back when the thread exits
+    struct RingHandle {
+        LogRing* ring = nullptr;
+        ~RingHandle() {
+            if (ring) ring->closed.store(true, std::memory_order_release);
+            ring = nullptr;
+        }
+    };
+
+    LogRing* thread_ring() {
+        static thread_local RingHandle handle;
+        if (!handle.ring) {
+            handle.ring = new LogRing();
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            rings.push_back(handle.ring);
+        }
+        return handle.ring;
+    }
+
+    template <typename... Stored>
+    void write(LogLevel level, const Stored&... args) {
+        size_t size = sizeof(LogRecordHeader);
+        int expand[] = {0, (size += log_arg_size(args), 0)...};
+        (void)expand;
+        size = (size + 7) & ~size_t(7);
+
+        LogRing* ring = thread_ring();
+        char* record = size <= LOG_MAX_RECORD ? ring->reserve(size) : nullptr;
+        if (!record) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        LogRecordHeader header{&log_decode<typename LogStored<Stored>::type...>, log_now_ns(),
+                               static_cast<uint32_t>(size), level};
+        std::memcpy(record, &header, sizeof(header));
+        char* p = record + sizeof(header);
+        int put[] = {0, (p = log_put(p, args), 0)...};
+        (void)put;
+        ring->commit(size);
+    }
+
+    static uint64_t log_now_ns() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    void run() {
+        while (true) {
+            bool wrote;
+            {
+                std::lock_guard<std::mutex> lock(drain_mutex);
+                wrote = drain();
+            }
+            if (!wrote) std::this_thread::sleep_for(std::chrono::microseconds(LOG_IDLE_SLEEP_US));
+        }
+    }
+
+    // Format and write every pending record, oldest ring first. Rings of
+    // threads that exited are freed once empty. True if anything was written.
+    bool drain() {
+        std::vector<LogRing*> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            snapshot = rings;
+        }
+
+        bool to_stdout = false, to_stderr = false;
+        for (LogRing* ring : snapshot) {
+            bool closed = ring->closed.load(std::memory_order_acquire);
+            uint64_t tail = ring->read_pos.load(std::memory_order_relaxed);
+            uint64_t head = ring->write_pos.load(std::memory_order_acquire);
+            while (tail != head) {
+                size_t offset = static_cast<size_t>(tail % LOG_RING_BYTES);
+                if (LOG_RING_BYTES - offset < sizeof(LogRecordHeader)) {
+                    tail += LOG_RING_BYTES - offset;
+                    continue;
+                }
+                LogRecordHeader header;
+                std::memcpy(&header, ring->data + offset, sizeof(header));
+                if (header.decode) {
+                    line.str(std::string());
+                    append_time(header.time_ns);
+                    header.decode(ring->data + offset + sizeof(header), line);
+                    line << '\n';
+                    bool error = header.level >= LOG_LEVEL_WARNING;
+                    const std::string& text = line.str();
+                    std::fwrite(text.data(), 1, text.size(), error ? stderr : stdout);
+                    (error ? to_stderr : to_stdout) = true;
+                }
+                tail += header.size;
+                ring->read_pos.store(tail, std::memory_order_release);
+            }
+
+            uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped) {
+                std::fprintf(stderr, "Warning: %llu log records dropped, the logging thread fell behind\n",
+                             static_cast<unsigned long long>(dropped));
+                to_stderr = true;
+            }
+            if (closed && tail == ring->write_pos.load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lock(rings_mutex);
+                rings.erase(std::find(rings.begin(), rings.end(), ring));
+                delete ring;
+            }
+        }
+        if (to_stdout) std::fflush(stdout);
+        if (to_stderr) std::fflush(stderr);
+        return to_stdout || to_stderr;
+    }
+
+    // UTC HH:MM:SS.uuuuuu and a space
+    void append_time(uint64_t time_ns) {
+        time_t seconds = static_cast<time_t>(time_ns / 1000000000ull);
+        struct tm utc;
+        gmtime_r(&seconds, &utc);
+        char text[24];
+        std::snprintf(text, sizeof(text), "%02d:%02d:%02d.%06u ", utc.tm_hour, utc.tm_min, utc.tm_sec,
+                      static_cast<unsigned>(time_ns % 1000000000ull / 1000));
+        line << text;
+    }
+
+    std::mutex rings_mutex;     // guards rings; taken when a thread first logs
+    std::vector<LogRing*> rings;
+    std::mutex drain_mutex;     // one drain at a time: the logging thread or flush
+    std::ostringstream line;    // reused by drain
+};
+
+#define LOG_AT(level, ...) \
+    do { \
+        if ((level) >= log_level()) AsyncLogger::instance().log((level), __VA_ARGS__); \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
@@ -0,0 +1,147 @@
+// Checks that a steady-state broadcaster cycle does not allocate: every
+// operator new in the process is counted while broadcast_cycle() runs over
+// updates to inputs of loaded formulas, after warm-up cycles have sized the
+// pooled batches and buffers. Then checks that a reload renaming every
+// synthetic reuses their feed ids, that adopting it does not allocate and
+// that each is announced again under its new name.
+//
+// Build and run:
+//   g++ -std=c++17 -O2 -pthread bench/alloc_test.cpp -o alloc_test -lrt
+//   ./alloc_test
+// Exits non-zero, printing the count, if any cycle allocated.
+//
+// Runs against a private segment, never /market_prices; the generated
+// formula file goes under /tmp/alloc_test_formulas.cfg.
+
+#include <cstdlib>
+#include <new>
+#include <random>
+
+// The broadcaster's code and globals, without its main()
+#define main server_main
+#include "../server.cpp"
+#undef main
+
+namespace {
+
+std::atomic<bool> counting{false};
+std::atomic<size_t> allocations{0};
+
+void* counted_allocation(size_t size) {
+    if (counting.load(std::memory_order_relaxed)) allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+}  // namespace
+
+void* operator new(size_t size) { return counted_allocation(size); }
+void* operator new[](size_t size) { return counted_allocation(size); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+
+namespace {
+
+const int SYMBOLS = 5000;
+const int SYNTHETICS = 1000;
+const int WARMUP_CYCLES = 100;
+const int CHECKED_CYCLES = 1000;
+const int UPDATES_PER_CYCLE = 100;
+
+// SYM0..SYM<symbols-1> in a private segment
+SharedMemory* make_segment(uint32_t symbols) {
+    size_t size = SharedMemory::size_for(symbols);
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    SharedMemory* segment = static_cast<SharedMemory*>(memory);
+    init_shared_memory(segment, symbols);
+    for (uint32_t i = 0; i < symbols; ++i) {
+        std::string name = "SYM" + std::to_string(i);
+        segment->add(name.c_str(), 100.0 + i, 100.5 + i);
+    }
+    return segment;
+}
+
+// formulas.cfg with synthetics named prefix<n> over random pairs of the
+// segment's symbols
+std::string write_formulas(const char* prefix = "F") {
+    std::string path = "/tmp/alloc_test_formulas.cfg";
+    std::ofstream file(path);
+    std::mt19937 random(11);
+    std::uniform_int_distribution<int> pick(0, SYMBOLS - 1);
+    for (int i = 0; i < SYNTHETICS; ++i) {
+        for (const char* side : {"bid", "ask"}) {
+            file << prefix << i << "_" << side << " = 0.5 * SYM" << pick(random) << "." << side << " + 0.5 * SYM"
+                 << pick(random) << "." << side << ", digits=4\n";
+        }
+    }
+    return path;
+}
+
+}  // namespace
+
+int main() {
+    SharedMemory* segment = make_segment(SYMBOLS);
+    if (!segment) {
+        perror("mmap");
+        return 1;
+    }
+    shm = shm_control = segment;
+    FormulaSet* set = compile_formulas(write_formulas());
+    if (!set) {
+        std::cerr << "Could not compile the generated formulas" << std::endl;
+        return 1;
+    }
+    const uint32_t last_feed_id = *std::max_element(set->feed_ids.begin(), set->feed_ids.end());
+    publish_formulas(set);
+
+    // A reactor holding a batch keeps it out of the pool; here nothing
+    // does, so the cycles below reuse what the warm-up allocated
+    int next = 0;
+    double price = 100;
+    auto cycle = [&]() {
+        price += 0.25;
+        for (int i = 0; i < UPDATES_PER_CYCLE; ++i) {
+            segment->update(next, price, price + 0.5);
+            next = (next + 1) % SYMBOLS;
+        }
+        return broadcast_cycle()->entries.size();
+    };
+    broadcast_cycle();  // first sight of every symbol
+    for (int i = 0; i < WARMUP_CYCLES; ++i) cycle();
+
+    size_t lines = 0;
+    counting.store(true);
+    for (int i = 0; i < CHECKED_CYCLES; ++i) lines += cycle();
+    counting.store(false);
+
+    size_t counted = allocations.load();
+    std::cout << CHECKED_CYCLES << " cycles, " << lines << " lines, " << counted << " allocations" << std::endl;
+    if (lines == 0) {
+        std::cerr << "No lines were broadcast; the check exercised nothing" << std::endl;
+        return 1;
+    }
+
+    // Every synthetic renamed: the new names take the old names' feed ids
+    FormulaSet* renamed = compile_formulas(write_formulas("G"));
+    if (!renamed || *std::max_element(renamed->feed_ids.begin(), renamed->feed_ids.end()) != last_feed_id) {
+        std::cerr << "Renamed synthetics did not reuse the removed ones' feed ids" << std::endl;
+        return 1;
+    }
+    publish_formulas(renamed);
+    allocations.store(0);
+    counting.store(true);
+    adopt_pending_formulas();
+    counting.store(false);
+    size_t reload_counted = allocations.load();
+    size_t announced = broadcast_cycle()->dictionary.size() / sizeof(WireSymbol);
+    std::cout << "Rename reload: " << reload_counted << " allocations adopting, " << announced
+              << " symbols announced again" << std::endl;
+    if (announced != SYNTHETICS) {
+        std::cerr << "Expected every renamed synthetic to be announced again" << std::endl;
+        return 1;
+    }
+    return counted == 0 && reload_counted == 0 ? 0 : 1;
+}
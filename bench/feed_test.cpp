@@ -0,0 +1,212 @@
+// Checks the feed handler's book keeping: apply_book_update's New, Change
+// and Delete at MarketDepth > 1, addressed by price and by position, and
+// that the raw fast path (FastPath=Y) leaves the same prices and books in
+// shm as QuickFIX's parsed messages for the same 35=W / 35=X bytes.
+//
+// Build and run next to price (QuickFIX):
+//   g++ -std=c++14 -O2 -pthread bench/feed_test.cpp -o feed_test -lquickfix -lrt
+//   ./feed_test [FIX44.xml]
+// Exits non-zero, naming each failed check. The two paths write private
+// segments, /feed_test_quickfix and /feed_test_fast, never /market_prices.
+
+// The producer's code, without its main()
+#define main price_main
+#include "../price.cpp"
+#undef main
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (ok) return;
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+// The side as "price:size price:size ..."
+std::string levels(const std::vector<FeedLevel>& side) {
+    std::ostringstream out;
+    for (const auto& level : side) out << (out.tellp() > 0 ? " " : "") << level.price << ":" << level.size;
+    return out.str();
+}
+
+FeedLevel level(double price, double size) {
+    return FeedLevel{price, size, std::to_string(price)};
+}
+
+void expect(const std::vector<FeedLevel>& side, const std::string& expected, const std::string& what) {
+    check(levels(side) == expected, what + ": got \"" + levels(side) + "\", want \"" + expected + "\"");
+}
+
+const char NEW = FIX::MDUpdateAction_NEW;
+const char CHANGE = FIX::MDUpdateAction_CHANGE;
+const char DELETE = FIX::MDUpdateAction_DELETE;
+
+// Levels found by price, as when the feed sends no MDEntryPositionNo
+void test_by_price() {
+    std::vector<FeedLevel> bids, asks;
+    apply_book_update(bids, true, NEW, 0, level(100, 1), 3);
+    apply_book_update(bids, true, NEW, 0, level(99, 2), 3);
+    apply_book_update(bids, true, NEW, 0, level(101, 3), 3);
+    expect(bids, "101:3 100:1 99:2", "bids sorted best first");
+
+    apply_book_update(bids, true, NEW, 0, level(98, 4), 3);
+    expect(bids, "101:3 100:1 99:2", "a bid below a full book is dropped");
+    apply_book_update(bids, true, NEW, 0, level(102, 5), 3);
+    expect(bids, "102:5 101:3 100:1", "a better bid pushes the worst out");
+
+    apply_book_update(bids, true, CHANGE, 0, level(101, 7), 3);
+    expect(bids, "102:5 101:7 100:1", "Change replaces the size at that price");
+    apply_book_update(bids, true, NEW, 0, level(100, 8), 3);
+    expect(bids, "102:5 101:7 100:8", "New at an existing price replaces it");
+    apply_book_update(bids, true, CHANGE, 0, level(100.5, 9), 3);
+    expect(bids, "102:5 101:7 100.5:9", "Change at an unknown price inserts it");
+
+    apply_book_update(bids, true, DELETE, 0, level(101, 0), 3);
+    expect(bids, "102:5 100.5:9", "Delete by price");
+    apply_book_update(bids, true, DELETE, 0, level(50, 0), 3);
+    expect(bids, "102:5 100.5:9", "Delete of an unknown price does nothing");
+
+    apply_book_update(asks, false, NEW, 0, level(103, 1), 3);
+    apply_book_update(asks, false, NEW, 0, level(105, 2), 3);
+    apply_book_update(asks, false, NEW, 0, level(104, 3), 3);
+    apply_book_update(asks, false, NEW, 0, level(102.5, 4), 3);
+    expect(asks, "102.5:4 103:1 104:3", "asks sorted best first, worst pushed out");
+    apply_book_update(asks, false, DELETE, 0, level(102.5, 0), 3);
+    expect(asks, "103:1 104:3", "Delete of the best ask");
+}
+
+// Levels addressed by MDEntryPositionNo
+void test_by_position() {
+    std::vector<FeedLevel> bids;
+    apply_book_update(bids, true, NEW, 1, level(100, 1), 3);
+    apply_book_update(bids, true, NEW, 2, level(99, 2), 3);
+    apply_book_update(bids, true, NEW, 3, level(98, 3), 3);
+    expect(bids, "100:1 99:2 98:3", "New at positions 1-3");
+
+    apply_book_update(bids, true, NEW, 1, level(101, 4), 3);
+    expect(bids, "101:4 100:1 99:2", "New at position 1 shifts the rest down");
+    apply_book_update(bids, true, CHANGE, 2, level(100, 5), 3);
+    expect(bids, "101:4 100:5 99:2", "Change at position 2");
+    apply_book_update(bids, true, DELETE, 1, level(0, 0), 3);
+    expect(bids, "100:5 99:2", "Delete at position 1 shifts the rest up");
+    apply_book_update(bids, true, DELETE, 3, level(0, 0), 3);
+    expect(bids, "100:5 99:2", "Delete past the last level does nothing");
+    apply_book_update(bids, true, NEW, 7, level(97, 6), 3);
+    expect(bids, "100:5 99:2 97:6", "New past the last level appends");
+    apply_book_update(bids, true, CHANGE, 3, level(98, 7), 3);
+    expect(bids, "100:5 99:2 98:7", "Change at the last position");
+}
+
+// --- Raw decoder parity ---
+
+// A complete FIX 4.4 message with body, BodyLength and CheckSum filled in.
+// Fields are written with '|' for SOH.
+std::string fix_message(char type, uint64_t seq, const std::string& fields) {
+    std::string body = std::string("35=") + type + "|34=" + std::to_string(seq) +
+                       "|49=TEST_SERVER_ID|56=CLIENT_ID|52=20260101-00:00:00.000|" + fields;
+    std::string message = "8=FIX.4.4|9=" + std::to_string(body.size()) + "|" + body;
+    std::replace(message.begin(), message.end(), '|', SOH);
+    unsigned sum = 0;
+    for (char c : message) sum += static_cast<unsigned char>(c);
+    char checksum[8];
+    std::snprintf(checksum, sizeof(checksum), "10=%03u", sum & 255);
+    return message + checksum + SOH;
+}
+
+// The refreshes both paths are fed, in order
+std::vector<std::string> parity_messages() {
+    std::vector<std::string> messages;
+    uint64_t seq = 1;
+    auto add = [&](char type, const std::string& fields) { messages.push_back(fix_message(type, seq++, fields)); };
+
+    add('W', "55=AAA|268=4|269=0|270=100.10|271=5|269=0|270=100.05|271=6|269=1|270=100.20|271=7|"
+             "269=1|270=100.25|271=8|");
+    add('W', "55=BBB|268=2|269=0|270=50.5|269=1|270=50.75|271=1|");
+    // By price: New, Change, Delete, on two symbols in one message
+    add('X', "268=4|279=0|269=0|55=AAA|270=100.08|271=9|279=1|269=1|55=AAA|270=100.20|271=3|"
+             "279=2|269=0|55=BBB|270=50.5|279=0|269=1|55=BBB|270=50.70|271=2|");
+    // By position
+    add('X', "268=3|279=0|269=0|55=AAA|270=100.12|271=1|290=1|279=2|269=1|55=AAA|290=2|"
+             "279=1|269=0|55=AAA|270=100.09|271=4|290=2|");
+    // Entries without Symbol continue the previous entry's symbol
+    add('X', "268=3|279=0|269=1|55=BBB|270=50.80|271=3|279=0|269=0|270=50.40|271=4|279=2|269=1|270=50.70|");
+    // A first entry without Symbol is ignored, not applied to the last
+    // message's symbol
+    add('X', "268=2|279=0|269=0|270=49|271=1|279=0|269=0|55=CCC|270=10.5|271=2|");
+    // Entries that are not bid or offer, and a Delete naming no level
+    add('X', "268=3|279=0|269=2|55=AAA|270=100.15|271=1|279=2|269=0|55=AAA|279=0|269=1|55=CCC|270=11|271=1|");
+    // A new snapshot replaces the book
+    add('W', "55=AAA|268=2|269=0|270=99.5|271=1|269=1|270=99.75|271=1|");
+    return messages;
+}
+
+// The prices and books both paths left for symbol agree, bit for bit
+void compare_symbol(const SharedMemory* quickfix, const SharedMemory* fast, const char* symbol,
+                    const std::string& mode) {
+    int a = quickfix->find(symbol), b = fast->find(symbol);
+    check((a < 0) == (b < 0), mode + std::string(symbol) + " listed by only one path");
+    if (a < 0 || b < 0) return;
+
+    PriceData price_a, price_b;
+    PriceTicks ticks_a, ticks_b;
+    read_price(quickfix->price(a), price_a, nullptr, &ticks_a);
+    read_price(fast->price(b), price_b, nullptr, &ticks_b);
+    check(std::memcmp(&price_a, &price_b, sizeof(price_a)) == 0 && ticks_a.bid == ticks_b.bid &&
+              ticks_a.ask == ticks_b.ask && quickfix->price(a).decimals == fast->price(b).decimals,
+          mode + std::string(symbol) + " prices differ");
+
+    BookLevel bids_a[MAX_BOOK_DEPTH], asks_a[MAX_BOOK_DEPTH], bids_b[MAX_BOOK_DEPTH], asks_b[MAX_BOOK_DEPTH];
+    uint32_t bid_count_a, ask_count_a, bid_count_b, ask_count_b;
+    read_book(quickfix, a, bids_a, bid_count_a, asks_a, ask_count_a);
+    read_book(fast, b, bids_b, bid_count_b, asks_b, ask_count_b);
+    check(bid_count_a == bid_count_b && ask_count_a == ask_count_b &&
+              std::memcmp(bids_a, bids_b, bid_count_a * sizeof(BookLevel)) == 0 &&
+              std::memcmp(asks_a, asks_b, ask_count_a * sizeof(BookLevel)) == 0,
+          mode + std::string(symbol) + " books differ");
+}
+
+// Feed every message to one session through QuickFIX's parse and crack, and
+// to another through the fast path, then compare what each stored
+void test_raw_parity(const FIX::DataDictionary& dictionary, int tick_decimals) {
+    const std::string mode = tick_decimals == NO_TICKS ? "doubles: " : "ticks: ";
+    const FIX::SessionID id("FIX.4.4", "CLIENT_ID", "TEST_SERVER_ID");
+    PriceStore quickfix_store(16, tick_decimals, 3, "/feed_test_quickfix");
+    PriceStore fast_store(16, tick_decimals, 3, "/feed_test_fast");
+    FeedSession quickfix_feed(quickfix_store, 0, id, {});
+    FeedSession fast_feed(fast_store, 0, id, {});
+
+    uint64_t seq = 0;
+    for (const std::string& raw : parity_messages()) {
+        ++seq;
+        FIX::Message message(raw, dictionary, false);
+        quickfix_feed.fromApp(message, id);
+        check(fast_feed.stageRawMarketData(raw, seq), mode + "message " + std::to_string(seq) + " not staged");
+        fast_feed.fromApp(message, id);
+        for (const char* symbol : {"AAA", "BBB", "CCC"}) {
+            compare_symbol(quickfix_store.shm, fast_store.shm, symbol,
+                           mode + "after message " + std::to_string(seq) + ": ");
+        }
+    }
+
+    // A message with a bad checksum or out of sequence is left to QuickFIX
+    std::string corrupt = fix_message('X', seq + 1, "268=1|279=0|269=0|55=AAA|270=99.6|271=1|");
+    corrupt[corrupt.size() - 2] ^= 1;
+    check(!fast_feed.stageRawMarketData(corrupt, seq + 1), mode + "bad checksum staged");
+    check(!fast_feed.stageRawMarketData(fix_message('X', seq + 2, "268=1|279=0|269=0|55=AAA|270=99.6|"), seq + 1),
+          mode + "out of sequence message staged");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    test_by_price();
+    test_by_position();
+    const FIX::DataDictionary dictionary(argc > 1 ? argv[1] : "FIX44.xml");
+    test_raw_parity(dictionary, NO_TICKS);
+    test_raw_parity(dictionary, 2);
+    if (failures) return 1;
+    std::cout << "All feed checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,460 @@
+// End-to-end latency benchmark: FIX feed -> price -> shm -> server -> TCP client.
+//
+// Runs the real price and server binaries against a local FIX acceptor that
+// streams MarketDataSnapshotFullRefresh messages, attaches synthetic binary
+// terminals and reports tick-to-client latency percentiles and throughput.
+// Everything runs on this host, in a scratch directory under /tmp.
+//
+// Each tick k carries bid = k, so a terminal receiving a quote knows which
+// tick it was and when the feed sent it. Ticks the server conflated never
+// arrive and are counted, not timed.
+//
+// Build next to price and server:
+//   g++ -std=c++14 -O2 -pthread bench/latency_bench.cpp -o latency_bench -lquickfix -lrt
+// Run from the directory holding price, server and FIX44.xml:
+//   ./latency_bench --rate 20000 --symbols 500 --clients 4 --seconds 10
+//
+// The producer always uses the /market_prices segment, so do not run this
+// next to a live producer.
+
+#include "quickfix/Application.h"
+#include "quickfix/MessageCracker.h"
+#include "quickfix/Session.h"
+#include "quickfix/ThreadedSocketAcceptor.h"
+#include "quickfix/FileStore.h"
+#include "quickfix/SessionSettings.h"
+#include "quickfix/fix44/MarketDataSnapshotFullRefresh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../wire_format.h"
+
+struct BenchConfig {
+    std::string price = "./price";
+    std::string server = "./server";
+    std::string fix_spec = "FIX44.xml";   // empty: price runs without a data dictionary
+    long rate = 10000;                     // ticks per second
+    int symbols = 100;
+    int clients = 4;
+    double seconds = 10;
+    double warmup = 2;
+    int fix_port = 15002;
+    int port = 12222;
+    std::string json;                      // write results here as well
+    bool keep = false;                     // keep the scratch directory
+};
+
+using Clock = std::chrono::steady_clock;
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// --- FIX feed ---
+
+// Acceptor side of the price session. Streaming starts once price has
+// logged on and asked for market data.
+class FeedSimulator : public FIX::Application, public FIX::MessageCracker {
+public:
+    void onCreate(const FIX::SessionID&) override {}
+    void onLogon(const FIX::SessionID& sessionID) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        session = sessionID;
+        logged_on = true;
+    }
+    void onLogout(const FIX::SessionID&) override {
+        logged_on = false;
+    }
+
+    void toAdmin(FIX::Message&, const FIX::SessionID&) override {}
+    void fromAdmin(const FIX::Message&, const FIX::SessionID&)
+        throw(FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::RejectLogon) override {}
+    void toApp(FIX::Message&, const FIX::SessionID&) throw(FIX::DoNotSend) override {}
+
+    void fromApp(const FIX::Message& message, const FIX::SessionID&)
+        throw(FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::UnsupportedMessageType) override {
+        FIX::MsgType msgType;
+        message.getHeader().getField(msgType);
+        if (msgType == "V") subscribed = true;   // MarketDataRequest
+    }
+
+    // Send tick k for symbol: bid k, ask k + 1
+    bool send_tick(const std::string& symbol, long k) {
+        FIX44::MarketDataSnapshotFullRefresh snapshot;
+        snapshot.set(FIX::Symbol(symbol));
+        FIX44::MarketDataSnapshotFullRefresh::NoMDEntries entry;
+        entry.set(FIX::MDEntryType(FIX::MDEntryType_BID));
+        entry.set(FIX::MDEntryPx(static_cast<double>(k)));
+        snapshot.addGroup(entry);
+        entry.set(FIX::MDEntryType(FIX::MDEntryType_OFFER));
+        entry.set(FIX::MDEntryPx(static_cast<double>(k + 1)));
+        snapshot.addGroup(entry);
+        try {
+            return FIX::Session::sendToTarget(snapshot, session);
+        } catch (...) {
+            return false;
+        }
+    }
+
+    std::mutex mutex;
+    FIX::SessionID session;
+    std::atomic<bool> logged_on{false};
+    std::atomic<bool> subscribed{false};
+};
+
+// --- Terminals ---
+
+// Send time of every tick, indexed by k; 0 until sent
+std::unique_ptr<std::atomic<int64_t>[]> sent_at;
+long tick_capacity = 0;
+std::atomic<long> first_measured_tick{LONG_MAX};
+std::atomic<bool> stopping{false};
+
+struct ClientStats {
+    int fd = -1;
+    std::vector<int64_t> latencies_ns;
+    long received = 0;          // quotes for measured ticks
+    bool ready = false;         // in binary mode
+};
+
+int connect_client(int port) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return -1;
+}
+
+// Log in, switch to binary records and time every quote until stopped
+void run_client(ClientStats& stats, std::atomic<int>& ready_clients) {
+    const char login[] = "bench\nbench\nSUB BENCH*\nBINARY\n";
+    if (send(stats.fd, login, sizeof(login) - 1, MSG_NOSIGNAL) < 0) return;
+
+    std::string buffer;
+    size_t pos = 0;
+    char chunk[65536];
+    while (!stopping) {
+        ssize_t n = recv(stats.fd, chunk, sizeof(chunk), 0);
+        int64_t now = now_ns();
+        if (n <= 0) return;
+        buffer.append(chunk, static_cast<size_t>(n));
+
+        if (!stats.ready) {
+            size_t marker = buffer.find("> Binary mode\n");
+            if (marker == std::string::npos) continue;
+            pos = marker + std::strlen("> Binary mode\n");
+            stats.ready = true;
+            ready_clients++;
+        }
+
+        const long first = first_measured_tick.load(std::memory_order_relaxed);
+        for (; pos + WIRE_RECORD_SIZE <= buffer.size(); pos += WIRE_RECORD_SIZE) {
+            WireQuote quote;
+            std::memcpy(&quote, buffer.data() + pos, sizeof(quote));
+            if (quote.type != WIRE_QUOTE || quote.exponent > 0) continue;
+            int64_t scale = 1;
+            for (int i = 0; i < -quote.exponent; ++i) scale *= 10;
+            long k = static_cast<long>(quote.bid / scale);
+            if (k < first || k >= tick_capacity) continue;
+            int64_t sent = sent_at[k].load(std::memory_order_relaxed);
+            if (!sent) continue;
+            stats.latencies_ns.push_back(now - sent);
+            stats.received++;
+        }
+        buffer.erase(0, pos);
+        pos = 0;
+    }
+}
+
+// --- Processes ---
+
+bool write_file(const std::string& path, const std::string& contents) {
+    std::ofstream file(path);
+    file << contents;
+    return static_cast<bool>(file);
+}
+
+// Start program in directory with its output going to log
+pid_t spawn(const std::string& program, const std::string& directory, const std::string& log) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+    if (chdir(directory.c_str()) != 0) _exit(127);
+    int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    execl(program.c_str(), program.c_str(), static_cast<char*>(nullptr));
+    _exit(127);
+}
+
+void stop_process(pid_t pid) {
+    if (pid <= 0) return;
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+std::string absolute_path(const std::string& path) {
+    char resolved[PATH_MAX];
+    return realpath(path.c_str(), resolved) ? resolved : path;
+}
+
+template <typename Predicate>
+bool wait_for(Predicate ready, double seconds) {
+    auto deadline = Clock::now() + std::chrono::duration<double>(seconds);
+    while (!ready()) {
+        if (Clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+// --- Report ---
+
+int64_t percentile(const std::vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, index == 0 ? 0 : index - 1)];
+}
+
+bool parse_arguments(int argc, char* argv[], BenchConfig& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--keep") {
+            cfg.keep = true;
+            continue;
+        }
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+        try {
+            if (arg == "--price") cfg.price = value;
+            else if (arg == "--server") cfg.server = value;
+            else if (arg == "--fix-spec") cfg.fix_spec = value;
+            else if (arg == "--rate") cfg.rate = std::max(1L, std::stol(value));
+            else if (arg == "--symbols") cfg.symbols = std::max(1, std::stoi(value));
+            else if (arg == "--clients") cfg.clients = std::max(1, std::stoi(value));
+            else if (arg == "--seconds") cfg.seconds = std::stod(value);
+            else if (arg == "--warmup") cfg.warmup = std::stod(value);
+            else if (arg == "--fix-port") cfg.fix_port = std::stoi(value);
+            else if (arg == "--port") cfg.port = std::stoi(value);
+            else if (arg == "--json") cfg.json = value;
+            else return false;
+        } catch (...) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig cfg;
+    if (!parse_arguments(argc, argv, cfg)) {
+        std::cerr << "Usage: latency_bench [--rate ticks/s] [--symbols N] [--clients N] [--seconds S] [--warmup S]\n"
+                     "                     [--price path] [--server path] [--fix-spec FIX44.xml|\"\"]\n"
+                     "                     [--fix-port N] [--port N] [--json file] [--keep]\n";
+        return 1;
+    }
+    std::string price = absolute_path(cfg.price);
+    std::string server = absolute_path(cfg.server);
+    std::string fix_spec = cfg.fix_spec.empty() ? "" : absolute_path(cfg.fix_spec);
+
+    char scratch[] = "/tmp/latency_bench.XXXXXX";
+    if (!mkdtemp(scratch)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = scratch;
+
+    // Both ends of the FIX session, subscribing to every symbol, the server
+    // and an empty formulas.cfg
+    const std::string common =
+        "FileStorePath=" + dir + "/store\n"
+        "StartTime=00:00:00\nEndTime=23:59:59\nHeartBtInt=30\n"
+        "ResetOnLogon=Y\nResetOnLogout=Y\nResetOnDisconnect=Y\n";
+    write_file(dir + "/acceptor.cfg",
+               "[DEFAULT]\nConnectionType=acceptor\nSocketAcceptPort=" + std::to_string(cfg.fix_port) + "\n" + common +
+               "UseDataDictionary=N\n[SESSION]\nBeginString=FIX.4.4\nSenderCompID=TEST_SERVER_ID\nTargetCompID=CLIENT_ID\n");
+    std::vector<std::string> symbols;
+    std::string symbol_list;
+    for (int i = 0; i < cfg.symbols; ++i) {
+        symbols.push_back("BENCH" + std::to_string(i));
+        symbol_list += (i ? "," : "") + symbols.back();
+    }
+    write_file(dir + "/initiator.cfg",
+               "[DEFAULT]\nConnectionType=initiator\nReconnectInterval=1\nFileLogPath=" + dir + "/log\n" + common +
+               (fix_spec.empty() ? "UseDataDictionary=N\n" : "UseDataDictionary=Y\nDataDictionary=" + fix_spec + "\n") +
+               "SharedMemoryCapacity=" + std::to_string(cfg.symbols + 64) + "\n"
+               "Symbols=" + symbol_list + "\nFormulasFile=\n"
+               "[SESSION]\nBeginString=FIX.4.4\nSenderCompID=CLIENT_ID\nTargetCompID=TEST_SERVER_ID\n"
+               "SocketConnectHost=127.0.0.1\nSocketConnectPort=" + std::to_string(cfg.fix_port) + "\n");
+    write_file(dir + "/server.cfg", "Port=" + std::to_string(cfg.port) + "\n");
+    write_file(dir + "/formulas.cfg", "");
+
+    tick_capacity = cfg.symbols + static_cast<long>(cfg.rate * (cfg.warmup + cfg.seconds) * 1.1) + 1;
+    sent_at.reset(new std::atomic<int64_t>[tick_capacity]);
+    for (long k = 0; k < tick_capacity; ++k) sent_at[k].store(0, std::memory_order_relaxed);
+
+    pid_t price_pid = -1, server_pid = -1;
+    std::vector<std::unique_ptr<ClientStats>> clients;
+    std::vector<std::thread> client_threads;
+    int status = 1;
+
+    try {
+        FIX::SessionSettings settings(dir + "/acceptor.cfg");
+        FeedSimulator feed;
+        FIX::FileStoreFactory storeFactory(settings);
+        FIX::ThreadedSocketAcceptor acceptor(feed, storeFactory, settings);
+        acceptor.start();
+
+        std::cout << "Scratch directory " << dir << std::endl;
+        price_pid = spawn(price, dir, dir + "/price.log");
+        if (!wait_for([&] { return feed.logged_on && feed.subscribed; }, 30)) {
+            std::cerr << "price did not log on and request market data; see " << dir << "/price.log\n";
+            throw std::runtime_error("no FIX session");
+        }
+
+        // One tick per symbol so the server knows them before terminals subscribe
+        long k = 0;
+        for (const auto& symbol : symbols) {
+            sent_at[k].store(now_ns(), std::memory_order_relaxed);
+            feed.send_tick(symbol, k++);
+        }
+
+        server_pid = spawn(server, dir, dir + "/server.log");
+        std::atomic<int> ready_clients{0};
+        for (int i = 0; i < cfg.clients; ++i) {
+            clients.emplace_back(new ClientStats());
+            clients.back()->fd = connect_client(cfg.port);
+            if (clients.back()->fd < 0) {
+                std::cerr << "Could not connect to the server; see " << dir << "/server.log\n";
+                throw std::runtime_error("no server");
+            }
+            clients.back()->latencies_ns.reserve(static_cast<size_t>(cfg.rate * cfg.seconds * 1.1));
+            client_threads.emplace_back(run_client, std::ref(*clients.back()), std::ref(ready_clients));
+        }
+        if (!wait_for([&] { return ready_clients == cfg.clients; }, 10)) {
+            std::cerr << "Terminals did not reach binary mode\n";
+            throw std::runtime_error("no terminals");
+        }
+
+        // Stream at the requested rate: warm up, then measure
+        const auto period = std::chrono::nanoseconds(1000000000L / cfg.rate);
+        const long warmup_ticks = static_cast<long>(cfg.rate * cfg.warmup);
+        const long measured_ticks = static_cast<long>(cfg.rate * cfg.seconds);
+        const long first = k + warmup_ticks;
+        long send_failures = 0;
+        auto start = Clock::now();
+        auto measure_start = start;
+        for (long i = 0; i < warmup_ticks + measured_ticks && k < tick_capacity; ++i, ++k) {
+            if (k == first) {
+                first_measured_tick = first;
+                measure_start = Clock::now();
+            }
+            auto due = start + i * period;
+            while (Clock::now() < due) {}
+            sent_at[k].store(now_ns(), std::memory_order_relaxed);
+            if (!feed.send_tick(symbols[k % symbols.size()], k)) send_failures++;
+        }
+        auto measure_end = Clock::now();
+
+        // Let the last ticks arrive, then stop the terminals
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        stopping = true;
+        for (auto& client : clients) shutdown(client->fd, SHUT_RDWR);
+        for (auto& thread : client_threads) thread.join();
+        client_threads.clear();
+        acceptor.stop();
+
+        // Report
+        double elapsed = std::chrono::duration<double>(measure_end - measure_start).count();
+        long sent = k - first;
+        std::vector<int64_t> all;
+        long received = 0;
+        for (auto& client : clients) {
+            all.insert(all.end(), client->latencies_ns.begin(), client->latencies_ns.end());
+            received += client->received;
+        }
+        std::sort(all.begin(), all.end());
+        double delivered = sent > 0 ? static_cast<double>(received) / (static_cast<double>(sent) * cfg.clients) : 0;
+
+        std::printf("Ticks sent        %ld in %.2f s (%.0f/s, %ld send failures)\n", sent, elapsed, sent / elapsed, send_failures);
+        std::printf("Quotes received   %ld across %d terminals (%.0f/s each, %.1f%% of ticks; the rest were conflated)\n",
+                    received, cfg.clients, received / elapsed / cfg.clients, delivered * 100);
+        std::printf("Tick-to-terminal  p50 %.1f us  p90 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us\n",
+                    percentile(all, 50) / 1e3, percentile(all, 90) / 1e3, percentile(all, 99) / 1e3,
+                    percentile(all, 99.9) / 1e3, all.empty() ? 0.0 : all.back() / 1e3);
+
+        if (!cfg.json.empty()) {
+            std::ofstream json(cfg.json);
+            json << "{\n"
+                 << "  \"rate\": " << cfg.rate << ",\n"
+                 << "  \"symbols\": " << cfg.symbols << ",\n"
+                 << "  \"clients\": " << cfg.clients << ",\n"
+                 << "  \"seconds\": " << elapsed << ",\n"
+                 << "  \"ticks_sent\": " << sent << ",\n"
+                 << "  \"ticks_per_second\": " << sent / elapsed << ",\n"
+                 << "  \"quotes_received\": " << received << ",\n"
+                 << "  \"delivered_fraction\": " << delivered << ",\n"
+                 << "  \"latency_ns\": {\"p50\": " << percentile(all, 50) << ", \"p90\": " << percentile(all, 90)
+                 << ", \"p99\": " << percentile(all, 99) << ", \"p99_9\": " << percentile(all, 99.9)
+                 << ", \"max\": " << (all.empty() ? 0 : all.back()) << "}\n"
+                 << "}\n";
+        }
+        status = all.empty() ? 1 : 0;
+    } catch (std::exception& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+    }
+
+    stopping = true;
+    for (auto& client : clients) {
+        if (client->fd >= 0) shutdown(client->fd, SHUT_RDWR);
+    }
+    for (auto& thread : client_threads) thread.join();
+    for (auto& client : clients) {
+        if (client->fd >= 0) close(client->fd);
+    }
+    stop_process(server_pid);
+    stop_process(price_pid);
+
+    if (status == 0 && !cfg.keep) {
+        std::string command = "rm -rf '" + dir + "'";
+        if (std::system(command.c_str()) != 0) std::cerr << "Warning: could not remove " << dir << "\n";
+    } else {
+        std::cout << "Logs kept in " << dir << std::endl;
+    }
+    return status;
+}
@@ -0,0 +1,280 @@
+// Checks the order acceptor's matching engine (matching_engine.h): price-time
+// priority, partial fills across levels, the remainder of an IOC order,
+// replace_order, trading against and marking to a market book in shm, and
+// the LeavesQty, CumQty and AvgPx that t4btofix reports after each fill.
+//
+// Build and run:
+//   g++ -std=c++17 -O2 bench/matching_test.cpp -o matching_test -lrt
+//   ./matching_test
+// Exits non-zero, naming each failed check.
+//
+// Runs against a private segment, never /market_prices.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+
+#include "../shared_memory.h"
+#include "../matching_engine.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (ok) return;
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+// What t4btofix reports for one fill of one order
+struct Fill {
+    uint64_t id;
+    int64_t price;      // LastPx, in ticks
+    int64_t lots;       // LastQty, in lots
+    double leaves_qty;  // LeavesQty
+    double cum_qty;     // CumQty
+    double avg_px;      // AvgPx
+};
+
+struct Fills {
+    MatchingEngine& engine;
+    std::vector<Fill> fills;
+
+    void operator()(const Order& order, int64_t price, int64_t lots) {
+        fills.push_back({order.id, price, lots, order.leaves / engine.lot_scale, order.cum / engine.lot_scale,
+                         average_price(engine.books[order.book], order)});
+    }
+
+    // The fills as "id:lots@price id:lots@price ...", then cleared
+    std::string take() {
+        std::ostringstream out;
+        for (const Fill& fill : fills) out << (out.tellp() > 0 ? " " : "") << fill.id << ":" << fill.lots << "@" << fill.price;
+        fills.clear();
+        return out.str();
+    }
+};
+
+void expect_fills(Fills& fills, const std::string& expected, const std::string& what) {
+    std::string got = fills.take();
+    check(got == expected, what + ": got \"" + got + "\", want \"" + expected + "\"");
+}
+
+bool near(double a, double b) { return std::fabs(a - b) < 1e-9; }
+
+void expect_report(const Fill& fill, double leaves_qty, double cum_qty, double avg_px, const std::string& what) {
+    std::ostringstream got;
+    got << "LeavesQty " << fill.leaves_qty << " CumQty " << fill.cum_qty << " AvgPx " << fill.avg_px;
+    check(near(fill.leaves_qty, leaves_qty) && near(fill.cum_qty, cum_qty) && near(fill.avg_px, avg_px),
+          what + ": got " + got.str());
+}
+
+Order* submit(MatchingEngine& engine, Fills& fills, uint32_t book, OrderSide side, int64_t price, int64_t quantity,
+              bool immediate = false) {
+    Order request;
+    request.book = book;
+    request.side = side;
+    request.immediate = immediate;
+    request.price = price;
+    request.quantity = quantity;
+    Order* order = new_order(engine, request);
+    execute_order(engine, *order, fills);
+    return order;
+}
+
+// The resting orders of a side as "id:leaves@price ...", best first
+std::string resting(const MatchingEngine& engine, uint32_t book, OrderSide side) {
+    const OrderBook& b = engine.books[book];
+    const std::vector<PriceLevel*>& levels = side == OrderSide::BUY ? b.bids : b.asks;
+    std::ostringstream out;
+    for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+        for (const Order* order = (*level)->head; order; order = order->next) {
+            out << (out.tellp() > 0 ? " " : "") << order->id << ":" << order->leaves << "@" << order->price;
+        }
+    }
+    return out.str();
+}
+
+void expect_resting(const MatchingEngine& engine, uint32_t book, OrderSide side, const std::string& expected,
+                    const std::string& what) {
+    std::string got = resting(engine, book, side);
+    check(got == expected, what + ": got \"" + got + "\", want \"" + expected + "\"");
+}
+
+// Orders between clients: priority, levels, IOC and the report fields
+void test_priority() {
+    MatchingEngine engine(2, 2);
+    Fills fills{engine, {}};
+    uint32_t book = book_for(engine, "XYZ");
+    const OrderSide BUY = OrderSide::BUY, SELL = OrderSide::SELL;
+
+    Order* a = submit(engine, fills, book, SELL, 10100, 1000);
+    Order* b = submit(engine, fills, book, SELL, 10000, 500);
+    Order* c = submit(engine, fills, book, SELL, 10000, 700);
+    check(a->level && b->level && c->level, "sells rest with nothing to trade against");
+    expect_resting(engine, book, SELL, "2:500@10000 3:700@10000 1:1000@10100", "asks by price, then time");
+
+    Order* buy = submit(engine, fills, book, BUY, 10100, 2000);
+    std::vector<Fill> reports = fills.fills;
+    expect_fills(fills, "4:500@10000 2:500@10000 4:700@10000 3:700@10000 4:800@10100 1:800@10100",
+                 "a buy through two levels fills oldest first at each");
+    if (reports.size() == 6) {
+        expect_report(reports[0], 15, 5, 100, "buyer after the first fill");
+        expect_report(reports[1], 0, 5, 100, "first seller, filled");
+        expect_report(reports[4], 0, 20, 100.4, "buyer, filled across two levels");
+        expect_report(reports[5], 2, 8, 101, "last seller, partially filled");
+    }
+    check(buy->leaves == 0 && !buy->level, "a filled buy does not rest");
+    release_order(engine, buy);
+    expect_resting(engine, book, SELL, "1:200@10100", "the partially filled sell keeps its place");
+
+    // IOC: what does not fill at once is canceled, never rested
+    Order* ioc = submit(engine, fills, book, BUY, 10100, 500, true);
+    reports = fills.fills;
+    expect_fills(fills, "5:200@10100 1:200@10100", "an IOC buy takes what there is");
+    check(!ioc->level && ioc->leaves == 300, "an IOC remainder does not rest");
+    cancel_order(engine, *ioc);
+    check(ioc->leaves == 0 && ioc->cum == 200, "cancel leaves nothing open");
+    if (!reports.empty()) expect_report(reports[0], 3, 2, 101, "IOC buyer after its fill");
+    release_order(engine, ioc);
+    expect_resting(engine, book, SELL, "", "the asks are empty");
+
+    Order* unfilled = submit(engine, fills, book, SELL, 10200, 100, true);
+    check(fills.take().empty() && !unfilled->level && unfilled->leaves == 100, "an IOC with nothing to trade");
+    check(average_price(engine.books[book], *unfilled) == 0, "AvgPx is 0 before any fill");
+    release_order(engine, unfilled);
+    check(engine.orders.live() == 0 && engine.books[book].bids.empty() && engine.books[book].asks.empty(),
+          "every order and level released");
+}
+
+void test_replace() {
+    MatchingEngine engine(2, 0);
+    Fills fills{engine, {}};
+    uint32_t book = book_for(engine, "XYZ");
+    const OrderSide BUY = OrderSide::BUY, SELL = OrderSide::SELL;
+
+    Order* x = submit(engine, fills, book, BUY, 9900, 10);
+    Order* y = submit(engine, fills, book, BUY, 9900, 10);
+    check(!replace_order(engine, *x, 9900, 6), "a reduction at the same price is not requeued");
+    check(x->quantity == 6 && x->leaves == 6, "a reduction changes quantity and leaves");
+    expect_resting(engine, book, BUY, "1:6@9900 2:10@9900", "a reduction keeps priority");
+
+    Order* sell = submit(engine, fills, book, SELL, 9900, 8);
+    expect_fills(fills, "3:6@9900 1:6@9900 3:2@9900 2:2@9900", "the reduced order still fills first");
+    release_order(engine, sell);
+
+    // x is filled and released; y has cum 2, leaves 8
+    check(replace_order(engine, *y, 9900, 12), "an increase is requeued");
+    check(y->quantity == 12 && y->leaves == 10 && !y->level, "an increase leaves the book until executed");
+    execute_order(engine, *y, fills);
+    Order* z = submit(engine, fills, book, BUY, 9900, 5);
+    expect_resting(engine, book, BUY, "2:10@9900 4:5@9900", "an increased order rests again, ahead of later ones");
+    check(!replace_order(engine, *y, 9900, 9), "a second reduction");
+    check(replace_order(engine, *y, 9950, 9), "a new price is requeued");
+    execute_order(engine, *y, fills);
+    expect_resting(engine, book, BUY, "2:7@9950 4:5@9900", "a new price moves the order");
+    check(replace_order(engine, *y, 9900, 9), "back to the old price");
+    execute_order(engine, *y, fills);
+    expect_resting(engine, book, BUY, "4:5@9900 2:7@9900", "a price change loses priority");
+
+    check(!replace_order(engine, *y, 9900, 2), "a quantity at the filled quantity is not requeued");
+    check(y->quantity == 2 && y->cum == 2 && y->leaves == 0 && !y->level, "quantity at cum finishes the order");
+    release_order(engine, y);
+    check(!replace_order(engine, *z, 9900, 0) && z->leaves == 0 && !z->level, "quantity below cum finishes the order");
+    release_order(engine, z);
+    check(engine.orders.live() == 0 && engine.books[book].bids.empty(), "every order and level released");
+}
+
+// A market book in shm: taken size is remembered until the producer writes
+// the symbol again, the market trades first at a price, and mark_book fills
+// resting orders at their own limit
+void test_market() {
+    const uint32_t DEPTH = 3;
+    size_t size = SharedMemory::size_for(4, DEPTH);
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        check(false, "mmap a private segment");
+        return;
+    }
+    SharedMemory* segment = static_cast<SharedMemory*>(memory);
+    init_shared_memory(segment, 4, DEPTH);
+    int slot = segment->add("EURUSD", 1.0000, 1.0001);
+    auto write = [&](std::initializer_list<BookLevel> bids, std::initializer_list<BookLevel> asks) {
+        segment->write_book(slot, bids.begin(), static_cast<uint32_t>(bids.size()), asks.begin(),
+                            static_cast<uint32_t>(asks.size()));
+        segment->update(slot, bids.size() ? bids.begin()->price : 0, asks.size() ? asks.begin()->price : 0);
+    };
+    write({{1.0000, 1}}, {{1.0001, 2}, {1.0002, 3}, {1.0003, 5}});
+
+    MatchingEngine engine(5, 2);
+    attach_market(engine, segment);
+    Fills fills{engine, {}};
+    uint32_t book = book_for(engine, "EURUSD");
+    check(engine.books[book].slot == slot, "the book is bound to its slot");
+    check(engine.books[book].decimals == 5, "the book has price_decimals");
+    const OrderSide BUY = OrderSide::BUY, SELL = OrderSide::SELL;
+
+    Order* client_ask = submit(engine, fills, book, SELL, 100010, 50);
+    check(client_ask->level != nullptr, "a client sell above the market bid rests");
+
+    submit(engine, fills, book, BUY, 100020, 600);
+    std::vector<Fill> reports = fills.fills;
+    expect_fills(fills, "2:200@100010 2:50@100010 1:50@100010 2:300@100020",
+                 "the market trades before a resting order at the same price, then the next level");
+    if (reports.size() == 4) expect_report(reports[3], 0.5, 5.5, (2.5 * 1.0001 + 3 * 1.0002) / 5.5, "buyer across levels");
+    expect_resting(engine, book, BUY, "2:50@100020", "the rest of the buy rests");
+
+    submit(engine, fills, book, BUY, 100020, 100);
+    check(fills.take().empty(), "size already taken from the market is not taken again");
+    expect_resting(engine, book, BUY, "2:50@100020 3:100@100020", "the second buy rests behind the first");
+
+    // The producer writes the symbol again: the ask came down to the orders
+    write({{1.0000, 1}}, {{1.0002, 1}, {1.0003, 5}});
+    mark_slot(engine, slot, fills);
+    reports = fills.fills;
+    expect_fills(fills, "2:50@100020 3:50@100020", "marking fills the oldest resting buy first");
+    if (reports.size() == 2) expect_report(reports[1], 0.5, 0.5, 1.0002, "second buy, marked");
+
+    // The market moves through the rest: it fills at its own limit
+    write({{0.9998, 1}}, {{0.9999, 5}});
+    mark_book(engine, book, fills);
+    expect_fills(fills, "3:50@100020", "a buy the market moved through fills at its limit");
+    expect_resting(engine, book, BUY, "", "the bids are empty");
+
+    // A restarted producer: books are bound to the new segment afresh
+    init_shared_memory(segment, 4, DEPTH);
+    segment->add("OTHER", 1, 2);
+    slot = segment->add("EURUSD", 0.9998, 0.9999);
+    write({{0.9998, 1}}, {{0.9999, 1}});
+    attach_market(engine, segment);
+    check(engine.books[book].slot == slot, "re-attaching binds the book to its new slot");
+    Order* sell = submit(engine, fills, book, SELL, 99980, 500, true);
+    expect_fills(fills, "4:100@99980", "the new segment's book is traded");
+    release_order(engine, sell);
+    attach_market(engine, nullptr);
+    check(engine.books[book].slot < 0, "detaching unbinds the book");
+
+    munmap(segment, size);
+}
+
+void test_book_lookup() {
+    MatchingEngine engine(3, 0);
+    check(find_book(engine, "NEW") < 0 && book_decimals(engine, "NEW") == 3, "an unknown symbol has no book");
+    check(engine.books.empty(), "looking up a symbol does not create its book");
+    uint32_t id = book_for(engine, "NEW");
+    check(find_book(engine, "NEW") == id && book_for(engine, "NEW") == id, "book_for creates the book once");
+}
+
+}  // namespace
+
+int main() {
+    test_priority();
+    test_replace();
+    test_market();
+    test_book_lookup();
+    if (failures) return 1;
+    std::cout << "All matching checks passed" << std::endl;
+    return 0;
+}
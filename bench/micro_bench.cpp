@@ -0,0 +1,313 @@
+// Microbenchmarks for the hot paths: formula loading and evaluation, symbol
+// lookup, producer writes to shared memory, one broadcaster cycle and the
+// order acceptor's matching engine.
+//
+// Build and run (Google Benchmark):
+//   g++ -std=c++17 -O2 -pthread bench/micro_bench.cpp -o micro_bench -lbenchmark -lrt
+//   ./micro_bench --benchmark_out=results.json --benchmark_out_format=json
+//
+// make -C bench baseline records a reference run as bench/baseline.json,
+// refusing a debug build of Google Benchmark or a one-CPU host. Compare a
+// new run against it with Google Benchmark's tools/compare.py:
+//   compare.py benchmarks bench/baseline.json results.json
+// Numbers are only comparable on the same machine; refresh the baseline
+// when the hardware changes or a change is meant to move them.
+//
+// bench/alloc_test.cpp checks that a steady-state broadcaster cycle does
+// not allocate, and bench/kernel_test.cpp that the formula kernels agree.
+//
+// Everything runs in-process against private segments, never /market_prices;
+// generated formula files and the journal go under /tmp/micro_bench_*.
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+// The broadcaster's code and globals, without its main()
+#define main server_main
+#include "../server.cpp"
+#undef main
+
+#include "../matching_engine.h"
+
+namespace {
+
+// A private segment holding SYM0..SYM<symbols-1>, doubles or ticks
+SharedMemory* make_segment(uint32_t symbols, int32_t decimals = NO_TICKS) {
+    size_t size = SharedMemory::size_for(symbols);
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    SharedMemory* segment = static_cast<SharedMemory*>(memory);
+    init_shared_memory(segment, symbols);
+    for (uint32_t i = 0; i < symbols; ++i) {
+        std::string name = "SYM" + std::to_string(i);
+        if (decimals == NO_TICKS) segment->add(name.c_str(), 100.0 + i, 100.5 + i);
+        else segment->add_ticks(name.c_str(), decimals, PriceTicks{10000 + i, 10050 + i});
+    }
+    return segment;
+}
+
+void free_segment(SharedMemory* segment) {
+    munmap(segment, segment->size());
+}
+
+// formulas.cfg with count synthetics whose sides are weighted sums of terms
+// symbols drawn from a universe of SYM0..SYM<universe-1>
+std::string write_formulas(int count, int terms, int universe) {
+    std::string path = "/tmp/micro_bench_formulas_" + std::to_string(count) + "_" + std::to_string(terms) + "_" +
+                       std::to_string(universe) + ".cfg";
+    std::ofstream file(path);
+    std::mt19937 random(count * 31 + terms * 7 + universe);
+    std::uniform_int_distribution<int> pick(0, universe - 1);
+    for (int i = 0; i < count; ++i) {
+        for (const char* side : {"bid", "ask"}) {
+            file << "F" << i << "_" << side << " = ";
+            for (int t = 0; t < terms; ++t) {
+                if (t) file << (t % 2 ? " - " : " + ");
+                file << (1 + t % 4) * 0.25 << " * SYM" << pick(random) << "." << side;
+            }
+            file << ", digits=4\n";
+        }
+    }
+    return path;
+}
+
+// A program loaded from write_formulas and bound to segment, all values known
+void load_bound_program(FormulaProgram& program, SharedMemory* segment, int count, int terms, int universe) {
+    load_formulas_from_file(write_formulas(count, terms, universe), program);
+    bind_formulas(program, segment);
+    evaluate_formulas(program, segment);
+}
+
+// --- Formulas ---
+
+void BM_LoadFormulas(benchmark::State& state) {
+    const int count = static_cast<int>(state.range(0));
+    std::string path = write_formulas(count, 4, 1000);
+    for (auto _ : state) {
+        FormulaProgram program;
+        load_formulas_from_file(path, program);
+        benchmark::DoNotOptimize(program.nodes.data());
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_LoadFormulas)->Arg(100)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+// One input symbol moves: mark it and recompute and quote what depends on it
+void BM_RecomputeOneInput(benchmark::State& state) {
+    const int terms = static_cast<int>(state.range(0));
+    const int universe = static_cast<int>(state.range(1));
+    SharedMemory* segment = make_segment(universe);
+    FormulaProgram program;
+    load_bound_program(program, segment, 1000, terms, universe);
+
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> pick(0, universe - 1);
+    double price = 100;
+    size_t quoted = 0;
+    for (auto _ : state) {
+        price += 0.25;
+        formula_input_changed(program, pick(random), PriceData{price, price + 0.5});
+        for (uint32_t id : recompute_formulas(program)) {
+            PriceTicks quote;
+            quoted += quote_synthetic(program, id, quote);
+        }
+    }
+    state.counters["synthetics_per_tick"] = static_cast<double>(quoted) / state.iterations();
+    free_segment(segment);
+}
+BENCHMARK(BM_RecomputeOneInput)
+    ->ArgsProduct({{2, 8, 32}, {100, 10000}})
+    ->ArgNames({"terms", "universe"});
+
+// Every node of every formula, with each evaluation kernel
+void BM_EvaluateAll(benchmark::State& state) {
+    const int terms = static_cast<int>(state.range(0));
+    const int universe = static_cast<int>(state.range(1));
+    const FormulaKernel kernel = static_cast<FormulaKernel>(state.range(2));
+    if (!formula_kernel_supported(kernel)) {
+        state.SkipWithError("kernel not supported by this CPU");
+        return;
+    }
+    SharedMemory* segment = make_segment(universe);
+    FormulaProgram program;
+    load_bound_program(program, segment, 1000, terms, universe);
+    program.kernel = kernel;
+
+    for (auto _ : state) {
+        evaluate_all_nodes(program);
+        benchmark::DoNotOptimize(program.values.data());
+    }
+    state.SetItemsProcessed(state.iterations() * program.nodes.size());
+    state.SetLabel(formula_kernel_name(kernel));
+    free_segment(segment);
+}
+BENCHMARK(BM_EvaluateAll)
+    ->ArgsProduct({{2, 8, 32},
+                   {100, 10000},
+                   {static_cast<int>(FormulaKernel::SCALAR), static_cast<int>(FormulaKernel::SSE2),
+                    static_cast<int>(FormulaKernel::AVX2)}})
+    ->ArgNames({"terms", "universe", "kernel"});
+
+// --- Shared memory ---
+
+void BM_ShmFind(benchmark::State& state) {
+    const uint32_t universe = static_cast<uint32_t>(state.range(0));
+    SharedMemory* segment = make_segment(universe);
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < 1024; ++i) names.push_back("SYM" + std::to_string((i * 7919u) % universe));
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(segment->find(names[i++ & 1023].c_str()));
+    }
+    free_segment(segment);
+}
+BENCHMARK(BM_ShmFind)->Arg(100)->Arg(10000)->Arg(1 << 20);
+
+// What price does per quote: look the symbol up, then write it. Arg 1 also
+// journals the write.
+void BM_SaveToSharedMemory(benchmark::State& state) {
+    SharedMemory* segment = make_segment(10000);
+    std::unique_ptr<TickJournal> journal;
+    if (state.range(0)) {
+        journal.reset(new TickJournal());
+        if (!journal->open("/tmp/micro_bench_journal", size_t(256) << 20, segment)) {
+            state.SkipWithError("cannot open journal");
+            free_segment(segment);
+            return;
+        }
+    }
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < 1024; ++i) names.push_back("SYM" + std::to_string((i * 7919u) % 10000));
+
+    size_t i = 0;
+    double price = 100;
+    for (auto _ : state) {
+        int slot = segment->find(names[i++ & 1023].c_str());
+        price += 0.25;
+        segment->update(slot, price, price + 0.5);
+        if (journal) journal->append_price(slot, segment->price(slot));
+    }
+    journal.reset();
+    free_segment(segment);
+}
+BENCHMARK(BM_SaveToSharedMemory)->Arg(0)->Arg(1)->ArgName("journal");
+
+// The PriceFormat=ticks variant of the same
+void BM_SaveTicksToSharedMemory(benchmark::State& state) {
+    SharedMemory* segment = make_segment(10000, 5);
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < 1024; ++i) names.push_back("SYM" + std::to_string((i * 7919u) % 10000));
+
+    size_t i = 0;
+    int64_t ticks = 10000000;
+    for (auto _ : state) {
+        int slot = segment->find(names[i++ & 1023].c_str());
+        ticks += 25;
+        segment->update_ticks(slot, PriceTicks{ticks, ticks + 50});
+    }
+    free_segment(segment);
+}
+BENCHMARK(BM_SaveTicksToSharedMemory);
+
+// --- Broadcaster ---
+
+// One broadcaster cycle, without the doorbell wait or any terminal: the
+// producer writes updates symbols (included in the time), then change
+// detection, formula recomputation and encoding of the batch run.
+void BM_BroadcastCycle(benchmark::State& state) {
+    const int updates = static_cast<int>(state.range(0));
+    const int universe = 5000;
+    SharedMemory* segment = make_segment(universe);
+    shm = shm_control = segment;
+    publish_formulas(compile_formulas(write_formulas(1000, 4, universe)));
+    {
+        std::lock_guard<std::mutex> lock(last_prices_mutex);
+        update_cursor = 0;
+        slot_versions.clear();
+        adopt_pending_formulas();
+        std::fill(formulas->last_quotes.begin(), formulas->last_quotes.end(), NEVER_QUOTED);
+    }
+    broadcast_cycle();  // first sight of every symbol
+
+    int next = 0;
+    double price = 100;
+    size_t lines = 0;
+    for (auto _ : state) {
+        price += 0.25;
+        for (int i = 0; i < updates; ++i) {
+            segment->update(next, price, price + 0.5);
+            next = (next + 1) % universe;
+        }
+        lines += broadcast_cycle()->entries.size();
+    }
+    state.counters["lines_per_cycle"] = static_cast<double>(lines) / state.iterations();
+    shm = shm_control = nullptr;
+    free_segment(segment);
+}
+BENCHMARK(BM_BroadcastCycle)->Arg(1)->Arg(100)->Arg(5000)->ArgName("updates");
+
+// --- Matching engine ---
+
+// A stream of orders on one book: limits up to 55 ticks either side of a
+// mid of 100.25, a few crossing it, and 1 in 20 a market order. Whenever
+// more than depth orders rest, a random one is canceled, which is part of
+// the time. With market set, orders also trade against the top of book
+// (100.20 / 100.30) in shm. Items are new orders; fills_per_order counts both sides
+// of each trade.
+void BM_MatchOrders(benchmark::State& state) {
+    const bool with_market = state.range(0) != 0;
+    const size_t depth = static_cast<size_t>(state.range(1));
+    SharedMemory* segment = make_segment(1);
+    MatchingEngine engine(2);
+    segment->update(0, 100.20, 100.30);
+    if (with_market) attach_market(engine, segment);
+    const uint32_t book = book_for(engine, "SYM0");
+
+    std::vector<Order> requests(1 << 16);
+    std::mt19937 rng(7);
+    for (Order& request : requests) {
+        request.book = book;
+        request.side = rng() % 2 ? OrderSide::BUY : OrderSide::SELL;
+        request.market = rng() % 20 == 0;
+        int64_t away = static_cast<int64_t>(rng() % 64) - 8; // ticks from mid, negative crosses
+        request.price = request.side == OrderSide::BUY ? 10025 - away : 10025 + away;
+        request.quantity = 1 + rng() % 100;
+    }
+
+    // Resting orders with their ids, so one filled and recycled meanwhile
+    // is recognised and skipped
+    std::vector<std::pair<Order*, uint64_t>> resting;
+    uint64_t fills = 0;
+    auto on_fill = [&](const Order&, int64_t, int64_t) { fills++; };
+    size_t next = 0;
+    for (auto _ : state) {
+        Order* order = new_order(engine, requests[next++ & (requests.size() - 1)]);
+        execute_order(engine, *order, on_fill);
+        if (!order->level) {
+            release_order(engine, order);
+            continue;
+        }
+        resting.emplace_back(order, order->id);
+
+        while (engine.orders.live() > depth) {
+            size_t k = rng() % resting.size();
+            Order* victim = resting[k].first;
+            bool live = victim->id == resting[k].second && victim->level;
+            resting[k] = resting.back();
+            resting.pop_back();
+            if (!live) continue;
+            cancel_order(engine, *victim);
+            release_order(engine, victim);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["fills_per_order"] = static_cast<double>(fills) / state.iterations();
+    free_segment(segment);
+}
+BENCHMARK(BM_MatchOrders)->ArgsProduct({{0, 1}, {100, 100000}})->ArgNames({"market", "depth"});
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,455 @@
+// Checks multicast recovery over loopback: a receiver on the group sees
+// packets numbered without gaps, notices the ones it lost, and gets them
+// back byte for byte with RETRANSMIT on its binary TCP connection. Packets
+// that aged out of the retransmit buffer, or more than MaxClientBufferBytes
+// of them, are answered with "send SNAPSHOT". A SNAPSHOT lists every symbol
+// once, as of the packet its header names, so that it plus the packets after
+// that one gives the same quotes as the whole stream.
+//
+// Build and run:
+//   g++ -std=c++17 -O2 -pthread bench/multicast_test.cpp -o multicast_test -lrt
+//   ./multicast_test
+// Exits non-zero, naming each failed check. Needs multicast on the loopback
+// interface (the group is joined on 127.0.0.1).
+//
+// Runs the broadcaster and one reactor in-process against a private
+// segment, never /market_prices; the generated formula file goes under
+// /tmp/multicast_test_formulas.cfg.
+
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <set>
+
+// The broadcaster's code and globals, without its main()
+#define main server_main
+#include "../server.cpp"
+#undef main
+
+namespace {
+
+const int SYMBOLS = 500;
+const size_t RING_PACKETS = 16;
+const size_t MAX_PACKET = (MULTICAST_RECORDS_PER_PACKET + 1) * WIRE_RECORD_SIZE;
+const size_t CLIENT_BUFFER = 4 * MAX_PACKET;    // four full packets
+const char GROUP[] = "239.255.42.99";
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (ok) return;
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+uint64_t packet_seq(const std::string& packet) {
+    WirePacket header;
+    std::memcpy(&header, packet.data(), sizeof(header));
+    return header.seq;
+}
+
+// Latest quote per symbol id
+typedef std::map<uint32_t, WireQuote> Quotes;
+
+void apply_quote(Quotes& quotes, const char* record) {
+    WireQuote quote;
+    std::memcpy(&quote, record, sizeof(quote));
+    if (quote.type != WIRE_QUOTE) return;
+    auto found = quotes.find(quote.symbol_id);
+    if (found == quotes.end() || found->second.seq < quote.seq) quotes[quote.symbol_id] = quote;
+}
+
+void apply_packet(Quotes& quotes, const std::string& packet) {
+    for (size_t offset = WIRE_RECORD_SIZE; offset + WIRE_RECORD_SIZE <= packet.size(); offset += WIRE_RECORD_SIZE) {
+        apply_quote(quotes, packet.data() + offset);
+    }
+}
+
+// Every datagram multicast so far, by seq
+std::map<uint64_t, std::string> history;
+
+// The quotes of packets from..to of the history, applied to quotes
+Quotes replay(Quotes quotes, uint64_t from, uint64_t to) {
+    for (auto it = history.lower_bound(from); it != history.end() && it->first <= to; ++it) {
+        apply_packet(quotes, it->second);
+    }
+    return quotes;
+}
+
+bool same_quotes(const Quotes& a, const Quotes& b) {
+    if (a.size() != b.size()) return false;
+    for (auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+        if (i->first != j->first || std::memcmp(&i->second, &j->second, sizeof(WireQuote)) != 0) return false;
+    }
+    return true;
+}
+
+// What a binary SNAPSHOT reply held
+struct Snapshot {
+    size_t symbols = 0;         // as its header says
+    uint64_t packet = 0;        // the packet it is current to
+    size_t records = 0;         // quote records
+    bool repeats = false;       // some symbol id had more than one quote
+    Quotes quotes;
+};
+
+// SYM0..SYM<symbols-1> in a private segment
+SharedMemory* make_segment(uint32_t symbols) {
+    size_t size = SharedMemory::size_for(symbols);
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    SharedMemory* segment = static_cast<SharedMemory*>(memory);
+    init_shared_memory(segment, symbols);
+    for (uint32_t i = 0; i < symbols; ++i) {
+        std::string name = "SYM" + std::to_string(i);
+        segment->add(name.c_str(), 100.0 + i, 100.5 + i);
+    }
+    return segment;
+}
+
+std::string write_formulas() {
+    std::string path = "/tmp/multicast_test_formulas.cfg";
+    std::ofstream file(path);
+    file << "SPREAD_bid = SYM0.bid - SYM1.ask, digits=2\n";
+    file << "SPREAD_ask = SYM0.ask - SYM1.bid, digits=2\n";
+    return path;
+}
+
+// A UDP socket that has joined the group on the loopback interface
+int join_group(int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, GROUP, &address.sin_addr);
+    struct ip_mreq membership{};
+    inet_pton(AF_INET, GROUP, &membership.imr_multiaddr);
+    inet_pton(AF_INET, "127.0.0.1", &membership.imr_interface);
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// A multicast receiver: takes packets in order and notes each gap
+struct Receiver {
+    int fd = -1;
+    uint64_t next = 1;                  // packet seq expected next
+    std::vector<std::pair<uint64_t, uint64_t>> gaps;
+
+    // The next datagram, empty after a second without one
+    std::string receive() {
+        char buffer[2048];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        return n > 0 ? std::string(buffer, static_cast<size_t>(n)) : std::string();
+    }
+
+    void take(const std::string& packet) {
+        uint64_t seq = packet_seq(packet);
+        if (seq > next) gaps.push_back({next, seq - 1});
+        if (seq >= next) next = seq + 1;
+    }
+};
+
+// A logged-in terminal in binary mode that has unsubscribed from updates
+struct Terminal {
+    int fd = -1;
+    std::string input;  // received, not yet consumed
+
+    // Connect and log in; the snapshot is next
+    bool log_in(int port) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        struct timeval timeout = {2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) return false;
+        return send_line("u") && send_line("p") && read_text_until("> Access granted\n");
+    }
+
+    bool open(int port) {
+        return log_in(port) && read_text_until("> End of snapshot\n") && send_line("UNSUB *") &&
+               send_line("BINARY") && read_text_until("> Binary mode\n");
+    }
+
+    bool send_line(const std::string& line) {
+        std::string data = line + "\n";
+        return send(fd, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+    }
+
+    bool fill(size_t bytes) {
+        char buffer[65536];
+        while (input.size() < bytes) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) return false;
+            input.append(buffer, static_cast<size_t>(n));
+        }
+        return true;
+    }
+
+    // Text mode: consume everything up to and including marker
+    bool read_text_until(const std::string& marker) {
+        size_t found;
+        while ((found = input.find(marker)) == std::string::npos) {
+            if (!fill(input.size() + 1)) return false;
+        }
+        input.erase(0, found + marker.size());
+        return true;
+    }
+
+    // Binary mode: SNAPSHOT and the records of its reply
+    bool read_snapshot(Snapshot& snapshot) {
+        std::vector<std::string> packets;
+        send_line("SNAPSHOT");
+        std::string header = read_reply(packets);
+        unsigned long long packet = 0;
+        if (std::sscanf(header.c_str(), "> Snapshot of %zu symbols at packet %llu", &snapshot.symbols, &packet) != 2) {
+            return false;
+        }
+        snapshot.packet = packet;
+        std::string line;
+        for (;;) {
+            if (!fill(WIRE_RECORD_SIZE)) return false;
+            uint16_t type;
+            std::memcpy(&type, input.data(), sizeof(type));
+            if (type == WIRE_QUOTE) {
+                WireQuote quote;
+                std::memcpy(&quote, input.data(), sizeof(quote));
+                snapshot.records++;
+                if (snapshot.quotes.count(quote.symbol_id)) snapshot.repeats = true;
+                snapshot.quotes[quote.symbol_id] = quote;
+            } else if (type == WIRE_TEXT) {
+                WireText text;
+                std::memcpy(&text, input.data(), sizeof(text));
+                line.append(text.text, text.length);
+            }
+            input.erase(0, WIRE_RECORD_SIZE);
+            if (line == "> End of snapshot\n") return true;
+        }
+    }
+
+    // Binary mode: the next server message line, collecting the packets
+    // sent ahead of it. Other records are skipped.
+    std::string read_reply(std::vector<std::string>& packets) {
+        std::string line;
+        for (;;) {
+            if (!fill(WIRE_RECORD_SIZE)) return "(connection lost)";
+            uint16_t type;
+            std::memcpy(&type, input.data(), sizeof(type));
+            if (type == WIRE_PACKET) {
+                WirePacket header;
+                std::memcpy(&header, input.data(), sizeof(header));
+                size_t length = (header.count + 1) * WIRE_RECORD_SIZE;
+                if (!fill(length)) return "(connection lost)";
+                packets.push_back(input.substr(0, length));
+                input.erase(0, length);
+                continue;
+            }
+            if (type == WIRE_TEXT) {
+                WireText text;
+                std::memcpy(&text, input.data(), sizeof(text));
+                line.append(text.text, text.length);
+            }
+            input.erase(0, WIRE_RECORD_SIZE);
+            if (!line.empty() && line.back() == '\n') return line;
+        }
+    }
+};
+
+// Move count symbols' prices, round-robin, and broadcast them
+void cycle(SharedMemory* segment, int count) {
+    static int next = 0;
+    static double price = 100;
+    price += 0.25;
+    for (int i = 0; i < count; ++i) {
+        segment->update(next, price, price + 0.5);
+        next = (next + 1) % SYMBOLS;
+    }
+    broadcast_cycle();
+}
+
+// Every datagram sent so far, in order
+std::vector<std::string> receive_all(Receiver& receiver) {
+    std::vector<std::string> packets;
+    for (std::string packet; !(packet = receiver.receive()).empty();) {
+        packets.push_back(packet);
+        history[packet_seq(packet)] = packet;
+        if (packet_seq(packet) == last_packet_seq) break;
+    }
+    return packets;
+}
+
+void test_retransmit(SharedMemory* segment, Receiver& receiver, Terminal& terminal) {
+    // 100 quotes a cycle: packets of 35, 35 and 30 records
+    cycle(segment, 100);
+    cycle(segment, 100);
+    std::vector<std::string> sent = receive_all(receiver);
+    check(sent.size() == 6, "two cycles of 100 quotes are six packets, got " + std::to_string(sent.size()));
+    if (sent.size() != 6) return;
+
+    // Lose the second and third
+    for (size_t i = 0; i < sent.size(); ++i) {
+        if (i != 1 && i != 2) receiver.take(sent[i]);
+    }
+    check(receiver.gaps.size() == 1, "one gap noticed");
+    if (receiver.gaps.size() != 1) return;
+    uint64_t first = receiver.gaps[0].first, last = receiver.gaps[0].second;
+    check(first == packet_seq(sent[1]) && last == packet_seq(sent[2]), "the gap is the two lost packets");
+
+    std::vector<std::string> resent;
+    terminal.send_line("RETRANSMIT " + std::to_string(first) + " " + std::to_string(last));
+    std::string reply = terminal.read_reply(resent);
+    check(reply == "> Retransmitted packets " + std::to_string(first) + " to " + std::to_string(last) + "\n",
+          "RETRANSMIT reply: " + reply);
+    check(resent.size() == 2 && resent[0] == sent[1] && resent[1] == sent[2],
+          "the lost packets come back as they were sent");
+
+    // Five more packets than the client buffer takes
+    for (int i = 0; i < 3; ++i) cycle(segment, 100);
+    sent = receive_all(receiver);
+    for (const std::string& packet : sent) receiver.take(packet);
+    check(receiver.gaps.size() == 1, "no further gaps");
+    first = packet_seq(sent.front());
+    resent.clear();
+    terminal.send_line("RETRANSMIT " + std::to_string(first) + " 18446744073709551615");
+    reply = terminal.read_reply(resent);
+    check(resent.size() == 4, "a buffer of four packets' bytes takes four, got " + std::to_string(resent.size()));
+    check(reply == "> Packets from " + std::to_string(first + resent.size()) +
+                       " do not fit in the client buffer, send SNAPSHOT\n",
+          "RETRANSMIT past the client buffer: " + reply);
+    for (size_t i = 0; i < resent.size() && i < sent.size(); ++i) {
+        check(resent[i] == sent[i], "packet " + std::to_string(first + i) + " resent as sent");
+    }
+
+    resent.clear();
+    terminal.send_line("RETRANSMIT 1");
+    reply = terminal.read_reply(resent);
+    check(resent.empty() && reply == "> Packet 1 is not available, send SNAPSHOT\n",
+          "RETRANSMIT of an aged-out packet: " + reply);
+}
+
+// The quotes a snapshot gives, against the multicast stream up to its packet,
+// and with the packets after it applied, against the whole stream
+void check_snapshot(const Snapshot& snapshot, const std::string& what) {
+    check(snapshot.symbols == SYMBOLS + 1, what + ": header counts " + std::to_string(snapshot.symbols) + " symbols");
+    check(snapshot.records == snapshot.symbols && !snapshot.repeats,
+          what + ": " + std::to_string(snapshot.records) + " quotes for " + std::to_string(snapshot.symbols) +
+              " symbols" + (snapshot.repeats ? ", some repeated" : ""));
+    check(same_quotes(snapshot.quotes, replay(Quotes(), 1, snapshot.packet)),
+          what + ": quotes differ from the stream up to packet " + std::to_string(snapshot.packet));
+    check(same_quotes(replay(snapshot.quotes, snapshot.packet + 1, last_packet_seq),
+                      replay(Quotes(), 1, last_packet_seq)),
+          what + ": with the later packets, quotes differ from the stream");
+}
+
+// A text login's snapshot has a line per symbol, none repeated
+void check_text_snapshot(int port) {
+    Terminal text;
+    std::vector<std::string> lines;
+    bool ok = text.log_in(port);
+    while (ok) {
+        size_t newline;
+        while ((newline = text.input.find('\n')) == std::string::npos && (ok = text.fill(text.input.size() + 1))) {}
+        if (!ok) break;
+        lines.push_back(text.input.substr(0, newline));
+        text.input.erase(0, newline + 1);
+        if (lines.back() == "> End of snapshot") break;
+    }
+    close(text.fd);
+    check(ok && lines.size() == SYMBOLS + 3, "text snapshot: " + std::to_string(lines.size()) + " lines");
+    std::set<std::string> names;
+    for (size_t i = 1; i + 1 < lines.size(); ++i) names.insert(lines[i].substr(0, lines[i].find(' ')));
+    check(names.size() == SYMBOLS + 1, "text snapshot: " + std::to_string(names.size()) + " distinct symbols");
+}
+
+void test_snapshot(SharedMemory* segment, Terminal& terminal, Receiver& receiver, int port) {
+    Snapshot first, second;
+    check(terminal.read_snapshot(first), "a SNAPSHOT reply");
+    // Fewer than a quarter of the symbols move, so the image is reused with
+    // these in place of their entries
+    cycle(segment, 50);
+    receive_all(receiver);
+    // The reactor takes the batch on its own thread; ask until it has
+    bool answered = false;
+    for (int tries = 0; tries < 100; ++tries) {
+        second = Snapshot();
+        answered = terminal.read_snapshot(second);
+        if (!answered || second.packet > first.packet) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    check(answered, "a second SNAPSHOT reply");
+    check_text_snapshot(port);
+    cycle(segment, 50);
+    receive_all(receiver);
+
+    check_snapshot(first, "first snapshot");
+    check_snapshot(second, "snapshot after updates");
+    check(second.packet > first.packet, "the second snapshot is current to a later packet");
+}
+
+}  // namespace
+
+int main() {
+    set_log_level(LOG_LEVEL_WARNING);
+    SharedMemory* segment = make_segment(SYMBOLS);
+    if (!segment) {
+        perror("mmap");
+        return 1;
+    }
+    shm = shm_control = segment;
+    FormulaSet* set = compile_formulas(write_formulas());
+    if (!set) {
+        std::cerr << "Could not compile the generated formulas" << std::endl;
+        return 1;
+    }
+    publish_formulas(set);
+
+    std::random_device random;
+    int group_port = 20000 + static_cast<int>(random() % 20000);
+    config.multicast_group = std::string(GROUP) + ":" + std::to_string(group_port);
+    config.multicast_interface = "127.0.0.1";
+    config.retransmit_packets = RING_PACKETS;
+    config.max_client_buffer = CLIENT_BUFFER;
+    Receiver receiver;
+    receiver.fd = join_group(group_port);
+    if (receiver.fd < 0 || !open_multicast(config)) {
+        std::cerr << "Multicast on the loopback interface is not available" << std::endl;
+        return 1;
+    }
+
+    reactors.emplace_back(new Reactor());
+    Reactor& reactor = *reactors.back();
+    if (!start_reactor(reactor, 0)) return 1;
+    struct sockaddr_in address{};
+    socklen_t length = sizeof(address);
+    getsockname(reactor.listen_fd, (struct sockaddr*)&address, &length);
+    std::thread(run_reactor, std::ref(reactor)).detach();
+
+    // Every symbol's first quote, received in order from packet 1
+    broadcast_cycle();
+    for (const std::string& packet : receive_all(receiver)) receiver.take(packet);
+    check(last_packet_seq > 1 && receiver.next == last_packet_seq + 1 && receiver.gaps.empty(),
+          "the first packets arrive numbered from 1 without gaps");
+
+    Terminal terminal;
+    if (!terminal.open(ntohs(address.sin_port))) {
+        std::cerr << "Could not log in to the reactor" << std::endl;
+        return 1;
+    }
+    test_retransmit(segment, receiver, terminal);
+    test_snapshot(segment, terminal, receiver, ntohs(address.sin_port));
+
+    if (failures == 0) std::cout << "All multicast checks passed" << std::endl;
+    // The reactor thread never returns
+    std::cout.flush();
+    std::_Exit(failures ? 1 : 0);
+}
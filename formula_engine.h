@@ -0,0 +1,1017 @@
+#pragma once
+
+// Expression engine for the synthetic symbols defined in formulas.cfg.
+//
+// Each line defines one side of a synthetic:
+//
+//   NAME_bid = <expr>[, digits=N]
+//   NAME_ask = <expr>[, digits=N]
+//
+// <expr> supports + - * /, unary minus, parentheses, numeric constants,
+// SYM.bid, SYM.ask, SYM.mid, mid(SYM), min(a, b, ...) and max(a, b, ...).
+//
+// Every synthetic in the file is compiled into one DAG. Identical
+// subexpressions are hash-consed into a single node and nodes are stored
+// children first, so one forward pass over the array evaluates each shared
+// subexpression (say mid(EURUSD) used by 200 crosses) exactly once.
+//
+// For each raw symbol the program also records the nodes and synthetics
+// downstream of it, so a cycle in which a few symbols ticked only recomputes
+// and re-checks what those symbols feed (see recompute_formulas).
+//
+// A full pass runs over groups rather than single nodes. Nodes are numbered
+// by depth and then operation, so every group (all depth-1 "A.bid - B.ask"
+// spreads, say) is a contiguous range of node ids. A group is evaluated by a
+// kernel that gathers its operands through index arrays and writes results
+// with plain vector stores. The kernel is AVX2, SSE2 or scalar, chosen at
+// runtime (see FormulaKernel); all of them give bit-identical results.
+//
+// When the producer stores prices as ticks (PriceFormat=ticks), a node built
+// only from tick-priced symbols and decimal constants with + - * min max mid
+// is also evaluated exactly in int64 ticks, and synthetics are rounded from
+// those. Division, and anything that would overflow, uses the double.
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FORMULA_X86_KERNELS 1
+#endif
+
+#include "shared_memory.h"
+
+enum class NodeOp : uint8_t {
+    CONSTANT,
+    BID, ASK, MID,             // leaves reading a raw symbol
+    ADD, SUBTRACT, MULTIPLY, DIVIDE, MIN, MAX,
+    NEGATE,
+};
+
+struct FormulaNode {
+    NodeOp op;
+    uint32_t lhs;      // first operand, or the symbol id for BID/ASK/MID
+    uint32_t rhs;      // second operand of binary ops
+    double constant;
+};
+
+constexpr uint32_t NO_NODE = UINT32_MAX;
+
+// Nodes [begin, end) share one operation and depth
+struct NodeGroup {
+    NodeOp op;
+    uint32_t begin;
+    uint32_t end;
+};
+
+enum class FormulaKernel { SCALAR, SSE2, AVX2 };
+
+// Fastest kernel this CPU supports
+inline FormulaKernel best_formula_kernel() {
+#ifdef FORMULA_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) return FormulaKernel::AVX2;
+    return FormulaKernel::SSE2;
+#else
+    return FormulaKernel::SCALAR;
+#endif
+}
+
+inline bool formula_kernel_supported(FormulaKernel kernel) {
+    return kernel <= best_formula_kernel();
+}
+
+inline const char* formula_kernel_name(FormulaKernel kernel) {
+    switch (kernel) {
+        case FormulaKernel::AVX2: return "avx2";
+        case FormulaKernel::SSE2: return "sse2";
+        case FormulaKernel::SCALAR: break;
+    }
+    return "scalar";
+}
+
+// Exact node values: decimals of at most MAX_NODE_DECIMALS, and
+// NO_TICK_VALUE when the value is missing or overflowed
+constexpr int MAX_NODE_DECIMALS = 15;
+constexpr int64_t NO_TICK_VALUE = INT64_MIN;
+
+struct SyntheticSymbol {
+    std::string name;
+    uint32_t bid_node = NO_NODE;
+    uint32_t ask_node = NO_NODE;
+    int precision = 5; // number of decimal places
+    double scale = 1e5; // 10^precision
+};
+
+// A compiled formulas.cfg. Node operands always have lower ids than the node
+// itself. A result is NaN while any symbol it reads is missing from shm.
+struct FormulaProgram {
+    std::vector<FormulaNode> nodes;
+    std::vector<SyntheticSymbol> synthetics;  // in formulas.cfg order
+    std::vector<double> values;               // per node, filled by evaluate_formulas
+
+    // Batched evaluation: node groups in evaluation order, and each node's
+    // operands (or symbol id for BID/ASK/MID) as gather indices
+    std::vector<NodeGroup> groups;
+    std::vector<int32_t> node_lhs;
+    std::vector<int32_t> node_rhs;
+    FormulaKernel kernel = FormulaKernel::SCALAR;
+
+    std::vector<std::string> symbols;         // raw symbols the formulas read
+    std::vector<int> symbol_slots;            // shm slot per symbol, -1 until it appears
+    std::vector<double> symbol_bids;          // latest price seen for each symbol,
+    std::vector<double> symbol_asks;          // kept as separate arrays for gathers
+    std::vector<PriceTicks> symbol_ticks;     // same as ticks, for tick-priced symbols
+    std::vector<int> symbol_decimals;         // NO_TICKS unless bound to a tick-priced slot
+    int unbound_symbols = 0;
+    int64_t bound_shm_listed = -1;            // shm->listed at the last binding pass
+
+    // Reverse dependencies, flattened per symbol: the nodes downstream of
+    // symbol s are cone_nodes[cone_begin[s] .. cone_begin[s + 1]), in
+    // evaluation order, and likewise for the synthetics that read it.
+    std::vector<uint32_t> cone_begin;
+    std::vector<uint32_t> cone_nodes;
+    std::vector<uint32_t> reader_begin;
+    std::vector<uint32_t> reader_synthetics;
+    std::vector<int> slot_symbols;            // symbol id per shm slot, -1 if no formula reads it
+
+    // Exact evaluation: node n also holds tick_values[n] in units of
+    // 10^-tick_decimals[n], unless tick_decimals[n] is NO_TICKS
+    std::vector<int8_t> tick_decimals;
+    std::vector<int64_t> tick_values;
+
+    // Incremental recomputation state
+    bool recompute_all = true;                // next recompute evaluates everything
+    std::vector<uint32_t> changed_symbols;    // inputs reported since the last recompute
+    std::vector<uint32_t> dirty_nodes;
+    std::vector<uint32_t> dirty_synthetics;   // result of the last recompute
+    std::vector<uint32_t> node_marks;
+    std::vector<uint32_t> synthetic_marks;
+    uint32_t epoch = 0;
+};
+
+// Trim whitespace from a string
+inline std::string trim(const std::string& str) {
+    const std::string whitespace = " \t\n\r\f\v";
+    size_t start = str.find_first_not_of(whitespace);
+    if (std::string::npos == start) {
+        return str;
+    }
+    size_t end = str.find_last_not_of(whitespace);
+    return str.substr(start, end - start + 1);
+}
+
+// Builds nodes into a FormulaProgram, reusing an existing node whenever the
+// same operation over the same operands was already emitted.
+class FormulaCompiler {
+public:
+    explicit FormulaCompiler(FormulaProgram& program) : program(program) {}
+
+    uint32_t constant(double value) {
+        return intern({NodeOp::CONSTANT, 0, 0, value});
+    }
+
+    uint32_t leaf(NodeOp op, const std::string& symbol) {
+        auto inserted = symbol_ids.emplace(symbol, static_cast<uint32_t>(program.symbols.size()));
+        if (inserted.second) {
+            program.symbols.push_back(symbol);
+            program.symbol_slots.push_back(-1);
+            program.unbound_symbols++;
+        }
+        return intern({op, inserted.first->second, 0, 0.0});
+    }
+
+    uint32_t unary(NodeOp op, uint32_t operand) {
+        const FormulaNode& a = program.nodes[operand];
+        if (a.op == NodeOp::CONSTANT) return constant(-a.constant);
+        if (a.op == NodeOp::NEGATE) return a.lhs;
+        return intern({op, operand, 0, 0.0});
+    }
+
+    uint32_t binary(NodeOp op, uint32_t lhs, uint32_t rhs) {
+        const FormulaNode& a = program.nodes[lhs];
+        const FormulaNode& b = program.nodes[rhs];
+        if (a.op == NodeOp::CONSTANT && b.op == NodeOp::CONSTANT) {
+            return constant(apply(op, a.constant, b.constant));
+        }
+        // Commutative operations share one canonical operand order
+        if ((op == NodeOp::ADD || op == NodeOp::MULTIPLY || op == NodeOp::MIN || op == NodeOp::MAX) && rhs < lhs) {
+            std::swap(lhs, rhs);
+        }
+        return intern({op, lhs, rhs, 0.0});
+    }
+
+    static double apply(NodeOp op, double a, double b) {
+        switch (op) {
+            case NodeOp::ADD:      return a + b;
+            case NodeOp::SUBTRACT: return a - b;
+            case NodeOp::MULTIPLY: return a * b;
+            case NodeOp::DIVIDE:   return a / b;
+            case NodeOp::MIN:      return (a < b || std::isnan(a)) ? a : b;
+            case NodeOp::MAX:      return (a > b || std::isnan(a)) ? a : b;
+            default:               return NAN;
+        }
+    }
+
+    // Parse one expression; throws std::invalid_argument on a syntax error.
+    uint32_t compile(const std::string& text);
+
+private:
+    uint32_t intern(const FormulaNode& node) {
+        uint64_t bits;
+        std::memcpy(&bits, &node.constant, sizeof(bits));
+        auto key = std::make_tuple(static_cast<int>(node.op), node.lhs, node.rhs, bits);
+        auto inserted = node_ids.emplace(key, static_cast<uint32_t>(program.nodes.size()));
+        if (inserted.second) program.nodes.push_back(node);
+        return inserted.first->second;
+    }
+
+    FormulaProgram& program;
+    std::map<std::tuple<int, uint32_t, uint32_t, uint64_t>, uint32_t> node_ids;
+    std::unordered_map<std::string, uint32_t> symbol_ids;
+};
+
+// Recursive descent over one expression:
+//
+//   expr    := term (('+' | '-') term)*
+//   term    := unary (('*' | '/') unary)*
+//   unary   := '-' unary | '+' unary | primary
+//   primary := number | SYM.bid | SYM.ask | SYM.mid | '(' expr ')'
+//            | mid '(' SYM ')' | (min | max) '(' expr (',' expr)* ')'
+class FormulaParser {
+public:
+    FormulaParser(FormulaCompiler& compiler, const std::string& text)
+        : compiler(compiler), text(text) {}
+
+    uint32_t parse() {
+        uint32_t node = expression();
+        skip_space();
+        if (pos != text.size()) fail("unexpected '" + text.substr(pos, 1) + "'");
+        return node;
+    }
+
+private:
+    static bool is_name_char(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+    }
+
+    [[noreturn]] void fail(const std::string& what) const {
+        throw std::invalid_argument(what + " at column " + std::to_string(pos + 1));
+    }
+
+    void skip_space() {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) pos++;
+    }
+
+    bool accept(char c) {
+        skip_space();
+        if (pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!accept(c)) fail(std::string("expected '") + c + "'");
+    }
+
+    // A run of name characters; a number additionally swallows an exponent sign
+    std::string word() {
+        skip_space();
+        size_t start = pos;
+        while (pos < text.size() && is_name_char(text[pos])) {
+            pos++;
+            if (pos + 1 < text.size() && (text[pos] == '+' || text[pos] == '-') &&
+                (text[pos - 1] == 'e' || text[pos - 1] == 'E') &&
+                std::isdigit(static_cast<unsigned char>(text[start])) &&
+                std::isdigit(static_cast<unsigned char>(text[pos + 1]))) {
+                pos++;
+            }
+        }
+        if (pos == start) fail(pos < text.size() ? "unexpected '" + text.substr(pos, 1) + "'" : "unexpected end");
+        return text.substr(start, pos - start);
+    }
+
+    uint32_t expression() {
+        uint32_t node = term();
+        for (;;) {
+            if (accept('+')) node = compiler.binary(NodeOp::ADD, node, term());
+            else if (accept('-')) node = compiler.binary(NodeOp::SUBTRACT, node, term());
+            else return node;
+        }
+    }
+
+    uint32_t term() {
+        uint32_t node = unary();
+        for (;;) {
+            if (accept('*')) node = compiler.binary(NodeOp::MULTIPLY, node, unary());
+            else if (accept('/')) node = compiler.binary(NodeOp::DIVIDE, node, unary());
+            else return node;
+        }
+    }
+
+    uint32_t unary() {
+        if (accept('-')) return compiler.unary(NodeOp::NEGATE, unary());
+        if (accept('+')) return unary();
+        return primary();
+    }
+
+    uint32_t primary() {
+        if (accept('(')) {
+            uint32_t node = expression();
+            expect(')');
+            return node;
+        }
+
+        std::string name = word();
+
+        char* end = nullptr;
+        double value = std::strtod(name.c_str(), &end);
+        if (*end == '\0') return compiler.constant(value);
+
+        if (accept('(')) {
+            if (name == "mid") {
+                std::string symbol = word();
+                expect(')');
+                return compiler.leaf(NodeOp::MID, symbol);
+            }
+            NodeOp op;
+            if (name == "min") op = NodeOp::MIN;
+            else if (name == "max") op = NodeOp::MAX;
+            else fail("unknown function '" + name + "'");
+            uint32_t node = expression();
+            while (accept(',')) node = compiler.binary(op, node, expression());
+            expect(')');
+            return node;
+        }
+
+        size_t last_dot = name.rfind('.');
+        if (last_dot != std::string::npos && last_dot > 0) {
+            std::string symbol = name.substr(0, last_dot);
+            std::string field = name.substr(last_dot + 1);
+            if (field == "bid") return compiler.leaf(NodeOp::BID, symbol);
+            if (field == "ask") return compiler.leaf(NodeOp::ASK, symbol);
+            if (field == "mid") return compiler.leaf(NodeOp::MID, symbol);
+        }
+        fail("'" + name + "' is not a number or SYMBOL.bid/.ask/.mid");
+    }
+
+    FormulaCompiler& compiler;
+    const std::string& text;
+    size_t pos = 0;
+};
+
+inline uint32_t FormulaCompiler::compile(const std::string& text) {
+    return FormulaParser(*this, text).parse();
+}
+
+// Drop nodes no synthetic reaches (lines that failed half-way, overridden
+// definitions) and renumber the rest, keeping children before parents.
+inline void prune_formula_program(FormulaProgram& program) {
+    std::vector<uint32_t> remap(program.nodes.size(), NO_NODE);
+    std::vector<bool> used(program.nodes.size(), false);
+    for (const auto& synthetic : program.synthetics) {
+        used[synthetic.bid_node] = true;
+        used[synthetic.ask_node] = true;
+    }
+    for (size_t i = program.nodes.size(); i-- > 0;) {
+        if (!used[i]) continue;
+        const FormulaNode& node = program.nodes[i];
+        if (node.op >= NodeOp::ADD) used[node.lhs] = true;
+        if (node.op >= NodeOp::ADD && node.op != NodeOp::NEGATE) used[node.rhs] = true;
+    }
+
+    std::vector<FormulaNode> kept;
+    for (size_t i = 0; i < program.nodes.size(); ++i) {
+        if (!used[i]) continue;
+        FormulaNode node = program.nodes[i];
+        if (node.op >= NodeOp::ADD) node.lhs = remap[node.lhs];
+        if (node.op >= NodeOp::ADD && node.op != NodeOp::NEGATE) node.rhs = remap[node.rhs];
+        remap[i] = static_cast<uint32_t>(kept.size());
+        kept.push_back(node);
+    }
+    for (auto& synthetic : program.synthetics) {
+        synthetic.bid_node = remap[synthetic.bid_node];
+        synthetic.ask_node = remap[synthetic.ask_node];
+    }
+    program.nodes.swap(kept);
+}
+
+// Renumber nodes by (depth, operation) and record the resulting groups and
+// gather indices. Operands are always shallower, so the new order still
+// evaluates children first.
+inline void group_formula_nodes(FormulaProgram& program) {
+    size_t node_count = program.nodes.size();
+    std::vector<uint32_t> depth(node_count, 0);
+    for (size_t i = 0; i < node_count; ++i) {
+        const FormulaNode& node = program.nodes[i];
+        if (node.op >= NodeOp::ADD) depth[i] = depth[node.lhs] + 1;
+        if (node.op >= NodeOp::ADD && node.op != NodeOp::NEGATE) depth[i] = std::max(depth[i], depth[node.rhs] + 1);
+    }
+
+    std::vector<uint32_t> order(node_count);
+    for (uint32_t i = 0; i < node_count; ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        if (depth[a] != depth[b]) return depth[a] < depth[b];
+        return program.nodes[a].op < program.nodes[b].op;
+    });
+
+    std::vector<uint32_t> remap(node_count);
+    for (uint32_t i = 0; i < node_count; ++i) remap[order[i]] = i;
+    std::vector<FormulaNode> sorted(node_count);
+    for (uint32_t i = 0; i < node_count; ++i) {
+        FormulaNode node = program.nodes[order[i]];
+        if (node.op >= NodeOp::ADD) node.lhs = remap[node.lhs];
+        if (node.op >= NodeOp::ADD && node.op != NodeOp::NEGATE) node.rhs = remap[node.rhs];
+        sorted[i] = node;
+    }
+    for (auto& synthetic : program.synthetics) {
+        synthetic.bid_node = remap[synthetic.bid_node];
+        synthetic.ask_node = remap[synthetic.ask_node];
+    }
+    program.nodes.swap(sorted);
+
+    program.groups.clear();
+    program.node_lhs.resize(node_count);
+    program.node_rhs.resize(node_count);
+    for (uint32_t i = 0; i < node_count; ++i) {
+        const FormulaNode& node = program.nodes[i];
+        bool binary = node.op >= NodeOp::ADD && node.op != NodeOp::NEGATE;
+        program.node_lhs[i] = node.op == NodeOp::CONSTANT ? 0 : static_cast<int32_t>(node.lhs);
+        program.node_rhs[i] = binary ? static_cast<int32_t>(node.rhs) : 0;
+        if (program.groups.empty() || program.groups.back().op != node.op || depth[order[i]] != depth[order[i - 1]]) {
+            program.groups.push_back({node.op, i, i});
+        }
+        program.groups.back().end = i + 1;
+    }
+}
+
+// Fill the per-symbol cones of downstream nodes and synthetics.
+inline void build_formula_dependencies(FormulaProgram& program) {
+    size_t node_count = program.nodes.size();
+    std::vector<std::vector<uint32_t>> parents(node_count);
+    std::vector<std::vector<uint32_t>> roots(node_count);
+    std::vector<std::vector<uint32_t>> leaves(program.symbols.size());
+    for (uint32_t i = 0; i < node_count; ++i) {
+        const FormulaNode& node = program.nodes[i];
+        if (node.op == NodeOp::BID || node.op == NodeOp::ASK || node.op == NodeOp::MID) {
+            leaves[node.lhs].push_back(i);
+        } else if (node.op >= NodeOp::ADD) {
+            parents[node.lhs].push_back(i);
+            if (node.op != NodeOp::NEGATE && node.rhs != node.lhs) parents[node.rhs].push_back(i);
+        }
+    }
+    for (uint32_t i = 0; i < program.synthetics.size(); ++i) {
+        roots[program.synthetics[i].bid_node].push_back(i);
+        if (program.synthetics[i].ask_node != program.synthetics[i].bid_node) {
+            roots[program.synthetics[i].ask_node].push_back(i);
+        }
+    }
+
+    program.cone_begin.assign(1, 0);
+    program.cone_nodes.clear();
+    program.reader_begin.assign(1, 0);
+    program.reader_synthetics.clear();
+    std::vector<uint32_t> seen(node_count, UINT32_MAX);
+    std::vector<uint32_t> synthetic_seen(program.synthetics.size(), UINT32_MAX);
+    std::vector<uint32_t> stack;
+    for (uint32_t s = 0; s < program.symbols.size(); ++s) {
+        size_t cone_start = program.cone_nodes.size();
+        size_t reader_start = program.reader_synthetics.size();
+        stack = leaves[s];
+        for (uint32_t leaf : stack) seen[leaf] = s;
+        while (!stack.empty()) {
+            uint32_t n = stack.back();
+            stack.pop_back();
+            program.cone_nodes.push_back(n);
+            for (uint32_t synthetic : roots[n]) {
+                if (synthetic_seen[synthetic] == s) continue;
+                synthetic_seen[synthetic] = s;
+                program.reader_synthetics.push_back(synthetic);
+            }
+            for (uint32_t parent : parents[n]) {
+                if (seen[parent] == s) continue;
+                seen[parent] = s;
+                stack.push_back(parent);
+            }
+        }
+        std::sort(program.cone_nodes.begin() + cone_start, program.cone_nodes.end());
+        std::sort(program.reader_synthetics.begin() + reader_start, program.reader_synthetics.end());
+        program.cone_begin.push_back(static_cast<uint32_t>(program.cone_nodes.size()));
+        program.reader_begin.push_back(static_cast<uint32_t>(program.reader_synthetics.size()));
+    }
+}
+
+// Fewest decimals that represent value exactly, or NO_TICKS
+inline int constant_decimals(double value) {
+    for (int d = 0; d <= MAX_TICK_DECIMALS; ++d) {
+        double scaled = value * static_cast<double>(pow10_ticks(d));
+        if (!(std::fabs(scaled) < 1e15)) return NO_TICKS;
+        if (static_cast<double>(std::llround(scaled)) / static_cast<double>(pow10_ticks(d)) == value) return d;
+    }
+    return NO_TICKS;
+}
+
+// Decide which nodes can be evaluated exactly, given the decimals of the
+// symbols bound so far. Nodes come children first, so one pass suffices.
+inline void assign_tick_decimals(FormulaProgram& program) {
+    for (uint32_t i = 0, n = static_cast<uint32_t>(program.nodes.size()); i < n; ++i) {
+        const FormulaNode& node = program.nodes[i];
+        int d = NO_TICKS;
+        int lhs = node.op >= NodeOp::ADD ? program.tick_decimals[node.lhs] : NO_TICKS;
+        int rhs = node.op >= NodeOp::ADD && node.op != NodeOp::NEGATE ? program.tick_decimals[node.rhs] : NO_TICKS;
+        switch (node.op) {
+            case NodeOp::CONSTANT:
+                d = constant_decimals(node.constant);
+                if (d != NO_TICKS) program.tick_values[i] = std::llround(node.constant * static_cast<double>(pow10_ticks(d)));
+                break;
+            case NodeOp::BID:
+            case NodeOp::ASK:
+                d = program.symbol_decimals[node.lhs];
+                break;
+            case NodeOp::MID:
+                // (bid + ask) / 2 is exact with one more decimal
+                if (program.symbol_decimals[node.lhs] != NO_TICKS) d = program.symbol_decimals[node.lhs] + 1;
+                break;
+            case NodeOp::NEGATE:
+                d = lhs;
+                break;
+            case NodeOp::ADD:
+            case NodeOp::SUBTRACT:
+            case NodeOp::MIN:
+            case NodeOp::MAX:
+                if (lhs != NO_TICKS && rhs != NO_TICKS) d = std::max(lhs, rhs);
+                break;
+            case NodeOp::MULTIPLY:
+                if (lhs != NO_TICKS && rhs != NO_TICKS && lhs + rhs <= MAX_NODE_DECIMALS) d = lhs + rhs;
+                break;
+            case NodeOp::DIVIDE:
+                break;
+        }
+        program.tick_decimals[i] = static_cast<int8_t>(d);
+    }
+}
+
+// value * 10^(to - from), to >= from, or NO_TICK_VALUE if it does not fit
+inline int64_t widen_ticks(int64_t value, int from, int to) {
+    int64_t result;
+    if (value == NO_TICK_VALUE || __builtin_mul_overflow(value, pow10_ticks(to - from), &result)) return NO_TICK_VALUE;
+    return result;
+}
+
+// Load formulas from a config file into program. Lines that fail to parse
+// are reported and skipped. Returns false if the file cannot be opened.
+inline bool load_formulas_from_file(const std::string& filename, FormulaProgram& program) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    program = FormulaProgram();
+    FormulaCompiler compiler(program);
+    std::unordered_map<std::string, size_t> synthetic_ids;
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+
+        // Split at '='
+        size_t equals_pos = line.find('=');
+        if (equals_pos == std::string::npos) continue;
+
+        std::string synth_name_part = trim(line.substr(0, equals_pos));
+        std::string formula_and_digits = trim(line.substr(equals_pos + 1));
+
+        // Extract digits if present
+        int precision = 5; // default
+        size_t digits_pos = formula_and_digits.rfind(", digits=");
+        std::string formula_str;
+        if (digits_pos != std::string::npos) {
+            formula_str = trim(formula_and_digits.substr(0, digits_pos));
+            std::string digits_str = trim(formula_and_digits.substr(digits_pos + 9));
+            try {
+                precision = std::stoi(digits_str);
+                if (precision < 0 || precision > 15) throw std::out_of_range(digits_str);
+            } catch (...) {
+                std::cerr << "Warning: Invalid digits for " << synth_name_part << "\n";
+                precision = 5;
+            }
+        } else {
+            formula_str = formula_and_digits;
+        }
+
+        // Extract bid/ask from name
+        size_t last_underscore = synth_name_part.find_last_of('_');
+        if (last_underscore == std::string::npos) continue;
+        std::string synth_base_name = synth_name_part.substr(0, last_underscore);
+        std::string price_type_str = synth_name_part.substr(last_underscore + 1);
+        if (price_type_str != "bid" && price_type_str != "ask") continue;
+
+        uint32_t node;
+        try {
+            node = compiler.compile(formula_str);
+        } catch (const std::invalid_argument& e) {
+            std::cerr << "Warning: " << filename << ":" << line_number << ": " << synth_name_part
+                      << ": " << e.what() << "\n";
+            continue;
+        }
+
+        // Save formula and precision
+        auto inserted = synthetic_ids.emplace(synth_base_name, program.synthetics.size());
+        if (inserted.second) {
+            program.synthetics.emplace_back();
+            program.synthetics.back().name = synth_base_name;
+        }
+        SyntheticSymbol& synthetic = program.synthetics[inserted.first->second];
+        (price_type_str == "bid" ? synthetic.bid_node : synthetic.ask_node) = node;
+        synthetic.precision = precision;
+        synthetic.scale = std::pow(10.0, precision);
+    }
+
+    // A synthetic with only one side defined quotes 0 on the other
+    for (auto& synthetic : program.synthetics) {
+        if (synthetic.bid_node == NO_NODE || synthetic.ask_node == NO_NODE) {
+            std::cerr << "Warning: " << synthetic.name << " has no "
+                      << (synthetic.bid_node == NO_NODE ? "bid" : "ask") << " formula, quoting 0\n";
+            uint32_t zero = compiler.constant(0.0);
+            if (synthetic.bid_node == NO_NODE) synthetic.bid_node = zero;
+            if (synthetic.ask_node == NO_NODE) synthetic.ask_node = zero;
+        }
+    }
+
+    prune_formula_program(program);
+    group_formula_nodes(program);
+    build_formula_dependencies(program);
+    program.values.assign(program.nodes.size(), NAN);
+    program.symbol_bids.assign(program.symbols.size(), NAN);
+    program.symbol_asks.assign(program.symbols.size(), NAN);
+    program.kernel = best_formula_kernel();
+    program.symbol_ticks.assign(program.symbols.size(), PriceTicks{0, 0});
+    program.symbol_decimals.assign(program.symbols.size(), NO_TICKS);
+    program.tick_decimals.assign(program.nodes.size(), NO_TICKS);
+    program.tick_values.assign(program.nodes.size(), NO_TICK_VALUE);
+    assign_tick_decimals(program);
+    program.node_marks.assign(program.nodes.size(), 0);
+    program.synthetic_marks.assign(program.synthetics.size(), 0);
+    return true;
+}
+
+// Record a new price for an shm slot. Ignored unless some formula reads it;
+// the affected synthetics are recomputed by the next recompute_formulas.
+// ticks is only used for symbols bound to a tick-priced slot.
+inline void formula_input_changed(FormulaProgram& program, int slot, const PriceData& price,
+                                  const PriceTicks& ticks = PriceTicks{0, 0}) {
+    if (slot < 0 || slot >= static_cast<int>(program.slot_symbols.size())) return;
+    int symbol = program.slot_symbols[slot];
+    if (symbol < 0) return;
+    program.symbol_bids[symbol] = price.bid;
+    program.symbol_asks[symbol] = price.ask;
+    program.symbol_ticks[symbol] = ticks;
+    program.changed_symbols.push_back(static_cast<uint32_t>(symbol));
+}
+
+// Resolve symbols that had not reached shm yet. Only rescans when the
+// producer has listed symbols since the previous pass. A newly bound symbol
+// counts as changed.
+inline void bind_formulas(FormulaProgram& program, const SharedMemory* shm) {
+    if (!shm || program.unbound_symbols == 0) return;
+    int64_t listed = shm->listed.load(std::memory_order_acquire);
+    if (listed == program.bound_shm_listed) return;
+    program.bound_shm_listed = listed;
+    if (program.slot_symbols.size() != shm->capacity) program.slot_symbols.assign(shm->capacity, -1);
+
+    bool bound = false;
+    for (size_t i = 0; i < program.symbols.size(); ++i) {
+        if (program.symbol_slots[i] >= 0) continue;
+        int slot = shm->find(program.symbols[i].c_str());
+        if (slot < 0) continue;
+        program.symbol_slots[i] = slot;
+        program.slot_symbols[slot] = static_cast<int>(i);
+        program.unbound_symbols--;
+        bound = true;
+
+        int decimals = shm->price(slot).decimals;
+        program.symbol_decimals[i] = decimals >= 0 && decimals <= MAX_TICK_DECIMALS ? decimals : NO_TICKS;
+
+        PriceData price;
+        PriceTicks ticks;
+        read_price(shm->price(slot), price, nullptr, &ticks);
+        formula_input_changed(program, slot, price, ticks);
+    }
+    if (bound) assign_tick_decimals(program);
+}
+
+// Exact counterpart of evaluate_node for a node with tick_decimals != NO_TICKS
+inline void evaluate_node_ticks(FormulaProgram& program, uint32_t i) {
+    const FormulaNode& node = program.nodes[i];
+    const PriceTicks* prices = program.symbol_ticks.data();
+    const int8_t* decimals = program.tick_decimals.data();
+    int64_t* values = program.tick_values.data();
+    int64_t result = NO_TICK_VALUE;
+    switch (node.op) {
+        case NodeOp::CONSTANT:
+            return; // set by assign_tick_decimals
+        case NodeOp::BID:
+            result = prices[node.lhs].bid;
+            break;
+        case NodeOp::ASK:
+            result = prices[node.lhs].ask;
+            break;
+        case NodeOp::MID: {
+            int64_t sum;
+            if (__builtin_add_overflow(prices[node.lhs].bid, prices[node.lhs].ask, &sum) ||
+                __builtin_mul_overflow(sum, 5, &result)) result = NO_TICK_VALUE;
+            break;
+        }
+        case NodeOp::NEGATE:
+            if (values[node.lhs] != NO_TICK_VALUE) result = -values[node.lhs];
+            break;
+        case NodeOp::MULTIPLY:
+            if (values[node.lhs] == NO_TICK_VALUE || values[node.rhs] == NO_TICK_VALUE ||
+                __builtin_mul_overflow(values[node.lhs], values[node.rhs], &result)) result = NO_TICK_VALUE;
+            break;
+        default: {
+            int64_t a = widen_ticks(values[node.lhs], decimals[node.lhs], decimals[i]);
+            int64_t b = widen_ticks(values[node.rhs], decimals[node.rhs], decimals[i]);
+            if (a == NO_TICK_VALUE || b == NO_TICK_VALUE) break;
+            switch (node.op) {
+                case NodeOp::ADD:      if (__builtin_add_overflow(a, b, &result)) result = NO_TICK_VALUE; break;
+                case NodeOp::SUBTRACT: if (__builtin_sub_overflow(a, b, &result)) result = NO_TICK_VALUE; break;
+                case NodeOp::MIN:      result = std::min(a, b); break;
+                case NodeOp::MAX:      result = std::max(a, b); break;
+                default: break;
+            }
+            break;
+        }
+    }
+    values[i] = result;
+}
+
+inline void evaluate_node_value(FormulaProgram& program, uint32_t i) {
+    const FormulaNode& node = program.nodes[i];
+    const double* bids = program.symbol_bids.data();
+    const double* asks = program.symbol_asks.data();
+    double* values = program.values.data();
+    switch (node.op) {
+        case NodeOp::CONSTANT: values[i] = node.constant; break;
+        case NodeOp::BID:      values[i] = bids[node.lhs]; break;
+        case NodeOp::ASK:      values[i] = asks[node.lhs]; break;
+        case NodeOp::MID:      values[i] = (bids[node.lhs] + asks[node.lhs]) * 0.5; break;
+        case NodeOp::NEGATE:   values[i] = -values[node.lhs]; break;
+        default:
+            values[i] = FormulaCompiler::apply(node.op, values[node.lhs], values[node.rhs]);
+            break;
+    }
+}
+
+inline void evaluate_node(FormulaProgram& program, uint32_t i) {
+    evaluate_node_value(program, i);
+    if (program.tick_decimals[i] != NO_TICKS) evaluate_node_ticks(program, i);
+}
+
+// --- Group kernels ---
+//
+// Each evaluates the doubles of one NodeGroup. The vector kernels do the
+// same IEEE operations as evaluate_node_value in the same order, including
+// NaN propagation through min/max, so results match bit for bit.
+
+inline void evaluate_group_scalar(FormulaProgram& program, const NodeGroup& group) {
+    for (uint32_t i = group.begin; i < group.end; ++i) evaluate_node_value(program, i);
+}
+
+#ifdef FORMULA_X86_KERNELS
+inline void evaluate_group_sse2(FormulaProgram& program, const NodeGroup& group) {
+    if (group.op == NodeOp::CONSTANT) return evaluate_group_scalar(program, group);
+
+    double* values = program.values.data();
+    const int32_t* lhs = program.node_lhs.data();
+    const int32_t* rhs = program.node_rhs.data();
+    const double* a_src = group.op == NodeOp::ASK ? program.symbol_asks.data()
+                        : group.op <= NodeOp::MID ? program.symbol_bids.data() : values;
+    const double* b_src = group.op == NodeOp::MID ? program.symbol_asks.data() : values;
+    const __m128d half = _mm_set1_pd(0.5);
+    const __m128d sign = _mm_set1_pd(-0.0);
+
+    uint32_t i = group.begin;
+    for (; i + 2 <= group.end; i += 2) {
+        __m128d a = _mm_set_pd(a_src[lhs[i + 1]], a_src[lhs[i]]);
+        __m128d r;
+        switch (group.op) {
+            case NodeOp::BID:
+            case NodeOp::ASK:
+                r = a;
+                break;
+            case NodeOp::MID:
+                r = _mm_mul_pd(_mm_add_pd(a, _mm_set_pd(b_src[lhs[i + 1]], b_src[lhs[i]])), half);
+                break;
+            case NodeOp::NEGATE:
+                r = _mm_xor_pd(a, sign);
+                break;
+            default: {
+                __m128d b = _mm_set_pd(b_src[rhs[i + 1]], b_src[rhs[i]]);
+                __m128d a_nan = _mm_cmpunord_pd(a, a);
+                switch (group.op) {
+                    case NodeOp::ADD:      r = _mm_add_pd(a, b); break;
+                    case NodeOp::SUBTRACT: r = _mm_sub_pd(a, b); break;
+                    case NodeOp::MULTIPLY: r = _mm_mul_pd(a, b); break;
+                    case NodeOp::DIVIDE:   r = _mm_div_pd(a, b); break;
+                    case NodeOp::MIN:      r = _mm_or_pd(_mm_and_pd(a_nan, a), _mm_andnot_pd(a_nan, _mm_min_pd(a, b))); break;
+                    default:               r = _mm_or_pd(_mm_and_pd(a_nan, a), _mm_andnot_pd(a_nan, _mm_max_pd(a, b))); break;
+                }
+                break;
+            }
+        }
+        _mm_storeu_pd(values + i, r);
+    }
+    for (; i < group.end; ++i) evaluate_node_value(program, i);
+}
+
+// Four doubles src[index[k]]. The masked form with a defined source keeps
+// GCC from warning about the unmasked intrinsic's undefined register.
+__attribute__((target("avx2")))
+inline __m256d gather4(const double* src, __m128i index) {
+    const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), src, index, all, 8);
+}
+
+__attribute__((target("avx2")))
+inline void evaluate_group_avx2(FormulaProgram& program, const NodeGroup& group) {
+    if (group.op == NodeOp::CONSTANT) return evaluate_group_scalar(program, group);
+
+    double* values = program.values.data();
+    const int32_t* lhs = program.node_lhs.data();
+    const int32_t* rhs = program.node_rhs.data();
+    const double* a_src = group.op == NodeOp::ASK ? program.symbol_asks.data()
+                        : group.op <= NodeOp::MID ? program.symbol_bids.data() : values;
+    const double* b_src = group.op == NodeOp::MID ? program.symbol_asks.data() : values;
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+
+    uint32_t i = group.begin;
+    for (; i + 4 <= group.end; i += 4) {
+        __m128i a_index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i));
+        __m256d a = gather4(a_src, a_index);
+        __m256d r;
+        switch (group.op) {
+            case NodeOp::BID:
+            case NodeOp::ASK:
+                r = a;
+                break;
+            case NodeOp::MID:
+                r = _mm256_mul_pd(_mm256_add_pd(a, gather4(b_src, a_index)), half);
+                break;
+            case NodeOp::NEGATE:
+                r = _mm256_xor_pd(a, sign);
+                break;
+            default: {
+                __m128i b_index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i));
+                __m256d b = gather4(b_src, b_index);
+                __m256d a_nan = _mm256_cmp_pd(a, a, _CMP_UNORD_Q);
+                switch (group.op) {
+                    case NodeOp::ADD:      r = _mm256_add_pd(a, b); break;
+                    case NodeOp::SUBTRACT: r = _mm256_sub_pd(a, b); break;
+                    case NodeOp::MULTIPLY: r = _mm256_mul_pd(a, b); break;
+                    case NodeOp::DIVIDE:   r = _mm256_div_pd(a, b); break;
+                    case NodeOp::MIN:      r = _mm256_blendv_pd(_mm256_min_pd(a, b), a, a_nan); break;
+                    default:               r = _mm256_blendv_pd(_mm256_max_pd(a, b), a, a_nan); break;
+                }
+                break;
+            }
+        }
+        _mm256_storeu_pd(values + i, r);
+    }
+    for (; i < group.end; ++i) evaluate_node_value(program, i);
+}
+#endif
+
+// Evaluate every node, a group at a time
+inline void evaluate_all_nodes(FormulaProgram& program) {
+    for (const NodeGroup& group : program.groups) {
+        switch (program.kernel) {
+#ifdef FORMULA_X86_KERNELS
+            case FormulaKernel::AVX2: evaluate_group_avx2(program, group); break;
+            case FormulaKernel::SSE2: evaluate_group_sse2(program, group); break;
+#endif
+            default: evaluate_group_scalar(program, group); break;
+        }
+        for (uint32_t i = group.begin; i < group.end; ++i) {
+            if (program.tick_decimals[i] != NO_TICKS) evaluate_node_ticks(program, i);
+        }
+    }
+}
+
+// Snapshot every referenced symbol once, then evaluate all nodes in order.
+// Both sides of every synthetic therefore see the same set of ticks.
+inline void evaluate_formulas(FormulaProgram& program, const SharedMemory* shm) {
+    for (size_t i = 0; i < program.symbols.size(); ++i) {
+        int slot = program.symbol_slots[i];
+        PriceData price = {NAN, NAN};
+        if (slot >= 0) read_price(shm->price(slot), price, nullptr, &program.symbol_ticks[i]);
+        program.symbol_bids[i] = price.bid;
+        program.symbol_asks[i] = price.ask;
+    }
+    evaluate_all_nodes(program);
+}
+
+// Re-evaluate only the nodes downstream of inputs reported through
+// formula_input_changed since the previous call, and return the synthetics
+// they feed (ascending). The first call after loading evaluates everything.
+inline const std::vector<uint32_t>& recompute_formulas(FormulaProgram& program) {
+    program.dirty_synthetics.clear();
+
+    if (program.recompute_all) {
+        program.recompute_all = false;
+        program.changed_symbols.clear();
+        evaluate_all_nodes(program);
+        for (uint32_t i = 0, n = static_cast<uint32_t>(program.synthetics.size()); i < n; ++i) {
+            program.dirty_synthetics.push_back(i);
+        }
+        return program.dirty_synthetics;
+    }
+    if (program.changed_symbols.empty()) return program.dirty_synthetics;
+
+    if (++program.epoch == 0) {
+        std::fill(program.node_marks.begin(), program.node_marks.end(), 0);
+        std::fill(program.synthetic_marks.begin(), program.synthetic_marks.end(), 0);
+        program.epoch = 1;
+    }
+    program.dirty_nodes.clear();
+    for (uint32_t symbol : program.changed_symbols) {
+        for (uint32_t k = program.cone_begin[symbol]; k < program.cone_begin[symbol + 1]; ++k) {
+            uint32_t n = program.cone_nodes[k];
+            if (program.node_marks[n] == program.epoch) continue;
+            program.node_marks[n] = program.epoch;
+            program.dirty_nodes.push_back(n);
+        }
+        for (uint32_t k = program.reader_begin[symbol]; k < program.reader_begin[symbol + 1]; ++k) {
+            uint32_t synthetic = program.reader_synthetics[k];
+            if (program.synthetic_marks[synthetic] == program.epoch) continue;
+            program.synthetic_marks[synthetic] = program.epoch;
+            program.dirty_synthetics.push_back(synthetic);
+        }
+    }
+    bool merged = program.changed_symbols.size() > 1;
+    program.changed_symbols.clear();
+
+    // A single symbol's cone is already in evaluation order
+    if (merged) std::sort(program.dirty_synthetics.begin(), program.dirty_synthetics.end());
+
+    // When most of the DAG is dirty, the batched pass beats walking the cones
+    if (program.dirty_nodes.size() * 2 > program.nodes.size()) {
+        evaluate_all_nodes(program);
+    } else {
+        if (merged) std::sort(program.dirty_nodes.begin(), program.dirty_nodes.end());
+        for (uint32_t n : program.dirty_nodes) evaluate_node(program, n);
+    }
+    return program.dirty_synthetics;
+}
+
+// Round node n to whole units of 10^-digits (scale = 10^digits). Exact nodes
+// round half away from zero in integer arithmetic; the rest round the double.
+// False while the value is missing or out of range.
+inline bool round_node(const FormulaProgram& program, uint32_t n, int digits, double scale, int64_t& out) {
+    int decimals = program.tick_decimals[n];
+    int64_t ticks = decimals == NO_TICKS ? NO_TICK_VALUE : program.tick_values[n];
+    if (ticks != NO_TICK_VALUE) {
+        if (decimals <= digits) {
+            out = widen_ticks(ticks, decimals, digits);
+            if (out != NO_TICK_VALUE) return true;
+        } else {
+            int64_t unit = pow10_ticks(decimals - digits);
+            int64_t quotient = ticks / unit;
+            int64_t remainder = ticks % unit; // same sign as ticks
+            if (remainder >= unit - remainder) quotient++;
+            else if (-remainder >= unit + remainder) quotient--;
+            out = quotient;
+            return true;
+        }
+    }
+    double scaled = program.values[n] * scale;
+    if (!(std::fabs(scaled) < 9e18)) return false; // also rejects NaN
+    out = std::llround(scaled);
+    return true;
+}
+
+// A synthetic's quote in units of 10^-precision. False until every symbol it
+// reads has reached shm.
+inline bool quote_synthetic(const FormulaProgram& program, uint32_t id, PriceTicks& quote) {
+    const SyntheticSymbol& synthetic = program.synthetics[id];
+    return round_node(program, synthetic.bid_node, synthetic.precision, synthetic.scale, quote.bid) &&
+           round_node(program, synthetic.ask_node, synthetic.precision, synthetic.scale, quote.ask);
+}
@@ -0,0 +1,452 @@
+#pragma once
+
+// Tick journal: every price the producer writes to shared memory, appended
+// to memory-mapped files of fixed-size records, so a misprint can be
+// reproduced and formula changes backtested (server --replay).
+//
+// Files are named after the UTC day of their records, ticks-YYYYMMDD.journal,
+// with a part number if the day needs more than one: ticks-YYYYMMDD.1.journal.
+// Each producer run starts a new part. A file is a JournalHeader followed by
+// records back to back; count in the header says how many are complete, so a
+// file can be read while it is being written or after the producer died.
+//
+// A file is self-contained: it opens with a JOURNAL_SYMBOL record for every
+// symbol its journal has named so far, and a new symbol gets one before its
+// first price. Slot numbers only mean something within the file that names
+// them.
+//
+// Appending is a copy into a page that is already mapped and populated. A
+// background thread creates and preallocates the next file with the symbol
+// table already in it, names it once the producer has switched to it and
+// unmaps and trims the finished one, so rotating is a pointer swap and the
+// producer never touches the disk. Until the worker has renamed it, a file
+// just switched to is still called .spare.<n>.journal. If no file is ready
+// when one is needed, records are dropped and counted, not waited for.
+//
+// The producer takes no lock and allocates nothing: spares come to it
+// through a single slot, rotations go back through a small ring, and it
+// wakes the worker with a futex doorbell only when the worker is asleep.
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/futex.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "shared_memory.h"
+
+constexpr uint32_t JOURNAL_MAGIC = 0x4A4B5450;  // "PTKJ"
+constexpr uint32_t JOURNAL_VERSION = 1;
+constexpr size_t JOURNAL_RECORD_SIZE = 48;
+constexpr uint64_t NS_PER_DAY = 86400ull * 1000000000ull;
+
+// Size of each journal file when JournalFileMB is not set in initiator.cfg
+constexpr size_t DEFAULT_JOURNAL_FILE_BYTES = size_t(256) << 20;
+
+// How often the worker retries after failing to create a journal file
+constexpr int JOURNAL_RETRY_MS = 1000;
+
+// Rotations the worker may fall behind by before the producer drops records
+constexpr uint32_t JOURNAL_PENDING_ROTATIONS = 4;
+
+enum JournalRecordType : uint16_t {
+    JOURNAL_SYMBOL = 1,
+    JOURNAL_PRICE = 2,
+};
+
+struct alignas(64) JournalHeader {
+    uint32_t magic;                 // JOURNAL_MAGIC, written last
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t shm_capacity;          // SharedMemoryCapacity of the producer that wrote it
+    uint64_t capacity;              // records the file has room for
+    std::atomic<uint64_t> count;    // records written so far
+};
+
+// A write to a shm slot, copied from the slot after the write
+struct JournalPrice {
+    uint64_t timestamp_ns;  // the slot's timestamp
+    uint32_t slot;
+    uint16_t type;          // JOURNAL_PRICE
+    int8_t decimals;        // the slot's decimals; ticks are 0 when NO_TICKS
+    uint8_t reserved;
+    double bid;
+    double ask;
+    int64_t bid_ticks;
+    int64_t ask_ticks;
+};
+
+// Names the symbol in a slot for the rest of the file
+struct JournalSymbol {
+    uint64_t timestamp_ns;
+    uint32_t slot;
+    uint16_t type;          // JOURNAL_SYMBOL
+    int8_t decimals;
+    uint8_t reserved;
+    char name[SYMBOL_NAME_LEN];
+};
+
+static_assert(sizeof(JournalHeader) == 64, "JournalHeader must stay 64 bytes");
+static_assert(sizeof(JournalPrice) == JOURNAL_RECORD_SIZE, "JournalPrice must stay 48 bytes");
+static_assert(sizeof(JournalSymbol) == JOURNAL_RECORD_SIZE, "JournalSymbol must stay 48 bytes");
+
+// "ticks-YYYYMMDD.journal", or "ticks-YYYYMMDD.<part>.journal" for part > 0
+inline std::string journal_file_name(uint64_t day, int part) {
+    time_t seconds = static_cast<time_t>(day * 86400);
+    struct tm date;
+    gmtime_r(&seconds, &date);
+    char name[64];
+    if (part == 0) {
+        std::snprintf(name, sizeof(name), "ticks-%04d%02d%02d.journal",
+                      date.tm_year + 1900, date.tm_mon + 1, date.tm_mday);
+    } else {
+        std::snprintf(name, sizeof(name), "ticks-%04d%02d%02d.%d.journal",
+                      date.tm_year + 1900, date.tm_mon + 1, date.tm_mday, part);
+    }
+    return name;
+}
+
+// One thread's journal. Not thread-safe: all appends must come from the
+// thread writing the slots it records, and only one TickJournal may use a
+// directory. A producer with several writer threads gives each its own.
+class TickJournal {
+public:
+    TickJournal() = default;
+    TickJournal(const TickJournal&) = delete;
+    TickJournal& operator=(const TickJournal&) = delete;
+
+    ~TickJournal() {
+        stopping_.store(true, std::memory_order_seq_cst);
+        wake_worker();
+        if (worker_.joinable()) worker_.join();
+        if (current_.base) {
+            current_.path = active_path_;
+            release_file(current_, header(current_)->count.load(std::memory_order_acquire));
+        }
+        for (JournalFile* file : {&next_, &spare_}) {
+            if (!file->base) continue;
+            std::string path = file->path;
+            release_file(*file, 0);
+            unlink(path.c_str());
+        }
+    }
+
+    // Start journaling into directory, in files of file_bytes. shm supplies
+    // the symbols' names and decimals. False if the directory is not
+    // writable or the files could not hold the symbol table.
+    bool open(const std::string& directory, size_t file_bytes, const SharedMemory* shm) {
+        directory_ = directory;
+        shm_ = shm;
+        capacity_ = file_bytes > sizeof(JournalHeader) ? (file_bytes - sizeof(JournalHeader)) / JOURNAL_RECORD_SIZE : 0;
+        if (capacity_ < 2 * static_cast<uint64_t>(shm->capacity)) {
+            std::cerr << "Journal files must have room for twice SharedMemoryCapacity records" << std::endl;
+            return false;
+        }
+        mkdir(directory.c_str(), 0755);
+        day_ = wall_clock_ns() / NS_PER_DAY;
+        if (!create_file(next_path(day_), current_)) {
+            std::cerr << "Failed to create journal file " << next_path(day_) << std::endl;
+            return false;
+        }
+        active_path_ = current_.path;
+        named_.assign(shm->capacity, 0);
+        named_slots_.assign(shm->capacity, false);
+        worker_ = std::thread(&TickJournal::run_worker, this);
+        return true;
+    }
+
+    bool is_open() const { return current_.base != nullptr; }
+
+    // The file open() started; later files are named by the worker. Only
+    // meaningful before the first rotation.
+    const std::string& first_path() const { return current_.path; }
+
+    // Records dropped because no file was ready to rotate into
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // Record the slot's name; call when the producer adds a symbol
+    void append_symbol(int slot, uint64_t timestamp_ns) {
+        if (!current_.base) return;
+        if (!named_slots_[slot]) {
+            named_slots_[slot] = true;
+            named_[named_total_] = static_cast<uint32_t>(slot);
+            named_count_.store(++named_total_, std::memory_order_release);
+        }
+        // The next file gets every name too, so rotating needs no table
+        if (next_.base) put(next_, symbol_record(slot, timestamp_ns));
+        else adopt_spare(timestamp_ns);
+
+        if (needs_rotation(timestamp_ns)) {
+            if (!rotate(timestamp_ns)) dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;     // the file rotated into names it already
+        }
+        put(current_, symbol_record(slot, timestamp_ns));
+    }
+
+    // Record the slot's current contents; call after each write to it
+    void append_price(int slot, const PriceSlot& price) {
+        if (!current_.base) return;
+        JournalPrice record;
+        record.timestamp_ns = price.timestamp_ns.load(std::memory_order_relaxed);
+        record.slot = static_cast<uint32_t>(slot);
+        record.type = JOURNAL_PRICE;
+        record.decimals = static_cast<int8_t>(price.decimals);
+        record.reserved = 0;
+        record.bid = price.bid.load(std::memory_order_relaxed);
+        record.ask = price.ask.load(std::memory_order_relaxed);
+        record.bid_ticks = price.bid_ticks.load(std::memory_order_relaxed);
+        record.ask_ticks = price.ask_ticks.load(std::memory_order_relaxed);
+        if (needs_rotation(record.timestamp_ns) && !rotate(record.timestamp_ns)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        put(current_, record);
+    }
+
+private:
+    struct JournalFile {
+        int fd = -1;
+        char* base = nullptr;
+        size_t bytes = 0;
+        std::string path;       // the producer gives current_'s away on rotating
+        uint32_t named = 0;     // entries of named_ whose symbol records it holds
+    };
+
+    // The producer switched from finished to the file at started_path, a
+    // file for day
+    struct Rotation {
+        JournalFile finished;
+        std::string started_path;
+        uint64_t day = 0;
+    };
+
+    static JournalHeader* header(const JournalFile& file) { return reinterpret_cast<JournalHeader*>(file.base); }
+
+    bool needs_rotation(uint64_t timestamp_ns) const {
+        return timestamp_ns / NS_PER_DAY != day_ || header(current_)->count.load(std::memory_order_relaxed) == capacity_;
+    }
+
+    template <typename Record>
+    static void put(JournalFile& file, const Record& record) {
+        JournalHeader* h = header(file);
+        uint64_t n = h->count.load(std::memory_order_relaxed);
+        std::memcpy(file.base + sizeof(JournalHeader) + n * JOURNAL_RECORD_SIZE, &record, sizeof(record));
+        h->count.store(n + 1, std::memory_order_release);
+    }
+
+    JournalSymbol symbol_record(int slot, uint64_t timestamp_ns) const {
+        JournalSymbol record{};
+        record.timestamp_ns = timestamp_ns;
+        record.slot = static_cast<uint32_t>(slot);
+        record.type = JOURNAL_SYMBOL;
+        record.decimals = static_cast<int8_t>(shm_->price(slot).decimals);
+        std::memcpy(record.name, shm_->symbol(slot), SYMBOL_NAME_LEN);
+        return record;
+    }
+
+    // Ring the doorbell, waking the worker if it sleeps. Seq_cst pairs with
+    // wait_for_producer: either it sees the new doorbell value or we see it
+    // asleep and wake it.
+    void wake_worker() {
+        doorbell_.fetch_add(1, std::memory_order_seq_cst);
+        if (worker_sleeping_.load(std::memory_order_seq_cst)) {
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&doorbell_), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+    }
+
+    // Take the worker's spare as the next file, naming in it the symbols
+    // named since the worker wrote its table. Producer thread only; next_ is
+    // empty, so the swap leaves spare_ empty without allocating.
+    void adopt_spare(uint64_t timestamp_ns) {
+        if (!spare_ready_.load(std::memory_order_acquire)) return;
+        std::swap(next_, spare_);
+        spare_ready_.store(false, std::memory_order_release);
+        wake_worker();
+        for (uint32_t i = next_.named; i < named_total_; ++i) put(next_, symbol_record(named_[i], timestamp_ns));
+        next_.named = named_total_;
+    }
+
+    // Switch to the next file, leaving it to the worker to name it after
+    // the day and release the finished one. False, with nothing changed, if
+    // no file is ready yet or the worker is JOURNAL_PENDING_ROTATIONS behind.
+    // Strings are swapped through the ring slot, never copied.
+    bool rotate(uint64_t timestamp_ns) {
+        if (!next_.base) adopt_spare(timestamp_ns);
+        if (!next_.base) return false;
+        uint64_t posted = rotations_posted_.load(std::memory_order_relaxed);
+        if (posted - rotations_done_.load(std::memory_order_acquire) == JOURNAL_PENDING_ROTATIONS) return false;
+        Rotation& rotation = rotations_[posted % JOURNAL_PENDING_ROTATIONS];
+        rotation.day = timestamp_ns / NS_PER_DAY;
+        std::swap(rotation.finished, current_);
+        std::swap(current_, next_);
+        std::swap(current_.path, rotation.started_path);
+        rotations_posted_.store(posted + 1, std::memory_order_release);
+        wake_worker();
+        day_ = rotation.day;
+        return true;
+    }
+
+    // Create, preallocate and map an empty journal file
+    bool create_file(const std::string& path, JournalFile& file) const {
+        file.path = path;
+        file.bytes = sizeof(JournalHeader) + capacity_ * JOURNAL_RECORD_SIZE;
+        file.fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file.fd < 0 || posix_fallocate(file.fd, 0, static_cast<off_t>(file.bytes)) != 0) {
+            if (file.fd >= 0) {
+                close(file.fd);
+                unlink(path.c_str());
+            }
+            file = JournalFile();
+            return false;
+        }
+        void* base = mmap(nullptr, file.bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, file.fd, 0);
+        if (base == MAP_FAILED) {
+            close(file.fd);
+            unlink(path.c_str());
+            file = JournalFile();
+            return false;
+        }
+        file.base = static_cast<char*>(base);
+
+        JournalHeader* h = header(file);
+        h->version = JOURNAL_VERSION;
+        h->record_size = JOURNAL_RECORD_SIZE;
+        h->shm_capacity = shm_->capacity;
+        h->capacity = capacity_;
+        h->count.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        h->magic = JOURNAL_MAGIC;
+        return true;
+    }
+
+    // Unmap a file and trim it to the records written
+    static void release_file(JournalFile& file, uint64_t records) {
+        munmap(file.base, file.bytes);
+        if (ftruncate(file.fd, static_cast<off_t>(sizeof(JournalHeader) + records * JOURNAL_RECORD_SIZE)) != 0) {
+            std::cerr << "Warning: Could not trim journal file " << file.path << std::endl;
+        }
+        close(file.fd);
+        file = JournalFile();
+    }
+
+    // First unused part name for day
+    std::string next_path(uint64_t day) const {
+        struct stat st;
+        for (int part = 0;; ++part) {
+            std::string path = directory_ + "/" + journal_file_name(day, part);
+            if (stat(path.c_str(), &st) != 0) return path;
+        }
+    }
+
+    // A spare with the symbol table as named so far. Worker thread only.
+    bool create_spare(JournalFile& spare) {
+        std::string path = directory_ + "/.spare." + std::to_string(spare_serial_++) + ".journal";
+        if (!create_file(path, spare)) return false;
+        spare.named = named_count_.load(std::memory_order_acquire);
+        uint64_t now = wall_clock_ns();
+        for (uint32_t i = 0; i < spare.named; ++i) put(spare, symbol_record(named_[i], now));
+        return true;
+    }
+
+    // Worker thread: sleep until the doorbell moves past bell, or for
+    // timeout_ms if that is not negative
+    void wait_for_producer(uint32_t bell, int timeout_ms) {
+        worker_sleeping_.store(1, std::memory_order_seq_cst);
+        if (doorbell_.load(std::memory_order_seq_cst) == bell) {
+            struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&doorbell_), FUTEX_WAIT_PRIVATE, bell,
+                    timeout_ms < 0 ? nullptr : &timeout, nullptr, 0);
+        }
+        worker_sleeping_.store(0, std::memory_order_seq_cst);
+    }
+
+    // Background thread: name the files the producer rotated into, release
+    // finished ones and keep a spare ready. A spare that cannot be created
+    // is retried every JOURNAL_RETRY_MS; the producer drops records meanwhile.
+    void run_worker() {
+        bool failing = false;
+        uint64_t dropped_before = 0;
+        uint64_t done = 0;
+        for (;;) {
+            // Read before looking for work, so a ring after the look wakes us
+            uint32_t bell = doorbell_.load(std::memory_order_seq_cst);
+
+            for (; done != rotations_posted_.load(std::memory_order_acquire); ++done) {
+                Rotation& rotation = rotations_[done % JOURNAL_PENDING_ROTATIONS];
+                rotation.finished.path = active_path_;
+                release_file(rotation.finished, header(rotation.finished)->count.load(std::memory_order_acquire));
+                active_path_ = next_path(rotation.day);
+                if (rename(rotation.started_path.c_str(), active_path_.c_str()) != 0) {
+                    std::cerr << "Warning: Could not rename journal file " << rotation.started_path << " to "
+                              << active_path_ << std::endl;
+                    active_path_ = rotation.started_path;
+                }
+                rotations_done_.store(done + 1, std::memory_order_release);
+            }
+            if (stopping_.load(std::memory_order_seq_cst)) return;
+            if (spare_ready_.load(std::memory_order_acquire)) {
+                wait_for_producer(bell, -1);
+                continue;
+            }
+
+            bool created = create_spare(spare_);
+            uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+            if (!created && !failing) {
+                std::cerr << "Warning: Failed to create a journal file in " << directory_ << ", retrying" << std::endl;
+            } else if (created && dropped != dropped_before) {
+                std::cerr << "Warning: Journal dropped " << dropped - dropped_before
+                          << " records while no file was ready" << std::endl;
+                dropped_before = dropped;
+            }
+            failing = !created;
+            if (created) spare_ready_.store(true, std::memory_order_release);
+            else wait_for_producer(bell, JOURNAL_RETRY_MS);
+        }
+    }
+
+    std::string directory_;
+    const SharedMemory* shm_ = nullptr;
+    uint64_t capacity_ = 0;     // records per file
+
+    // Producer thread only
+    uint64_t day_ = 0;          // UTC day of current_
+    JournalFile current_;
+    JournalFile next_;          // taken from the worker, named like current_
+    std::vector<bool> named_slots_;
+    uint32_t named_total_ = 0;
+
+    // Slots in the order they were named, published by named_count_
+    std::vector<uint32_t> named_;
+    std::atomic<uint32_t> named_count_{0};
+    std::atomic<uint64_t> dropped_{0};
+
+    // spare_ belongs to the worker while spare_ready_ is false and to the
+    // producer while it is true
+    JournalFile spare_;
+    std::atomic<bool> spare_ready_{false};
+
+    // Rotations the producer posted and the worker finished; a slot of
+    // rotations_ belongs to the worker between the two
+    Rotation rotations_[JOURNAL_PENDING_ROTATIONS];
+    std::atomic<uint64_t> rotations_posted_{0};
+    std::atomic<uint64_t> rotations_done_{0};
+
+    std::atomic<uint32_t> doorbell_{0};         // futex word, bumped by wake_worker
+    std::atomic<uint32_t> worker_sleeping_{0};
+    std::atomic<bool> stopping_{false};
+
+    std::string active_path_;   // worker thread: where current_ is named now
+    unsigned spare_serial_ = 0;
+    std::thread worker_;
+};
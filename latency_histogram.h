@@ -0,0 +1,106 @@
+#pragma once
+
+// Latency histogram in the style of HdrHistogram: log-linear buckets with
+// LATENCY_SUB_BUCKETS per power of two, so every recorded value is kept to
+// about 3% whatever its magnitude, in a fixed array of counters. Values are
+// nanoseconds; anything beyond LATENCY_MAX_BITS lands in the last bucket.
+//
+// record() is lock-free and may be called from any number of threads while
+// another reads a summary. A summary taken during recording can be off by
+// the samples in flight, which is fine for monitoring.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+constexpr int LATENCY_SUB_BUCKET_BITS = 5;
+constexpr int LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BUCKET_BITS;
+constexpr int LATENCY_MAX_BITS = 40;    // 2^40 ns is about 18 minutes
+constexpr int LATENCY_BUCKETS = (LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS;
+
+// Percentiles are the highest value of the bucket they fall in
+struct LatencySummary {
+    uint64_t count = 0;
+    uint64_t mean = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+    uint64_t max = 0;
+};
+
+class LatencyHistogram {
+public:
+    LatencyHistogram() {
+        for (auto& bucket : counts) bucket.store(0, std::memory_order_relaxed);
+    }
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void record(uint64_t value_ns) {
+        counts[bucket_of(value_ns)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value_ns, std::memory_order_relaxed);
+        uint64_t seen = max.load(std::memory_order_relaxed);
+        while (value_ns > seen && !max.compare_exchange_weak(seen, value_ns, std::memory_order_relaxed)) {}
+    }
+
+    // Between two wall-clock stamps; a negative difference from clock
+    // adjustment counts as zero
+    void record_between(uint64_t start_ns, uint64_t end_ns) {
+        record(end_ns > start_ns ? end_ns - start_ns : 0);
+    }
+
+    LatencySummary summarize() const {
+        LatencySummary summary;
+        uint64_t snapshot[LATENCY_BUCKETS];
+        for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+            snapshot[b] = counts[b].load(std::memory_order_relaxed);
+            summary.count += snapshot[b];
+        }
+        if (summary.count == 0) return summary;
+        summary.mean = sum.load(std::memory_order_relaxed) / summary.count;
+        summary.max = max.load(std::memory_order_relaxed);
+
+        struct Target {
+            uint64_t rank;
+            uint64_t* value;
+        } targets[] = {
+            {(summary.count * 500 + 999) / 1000, &summary.p50},
+            {(summary.count * 900 + 999) / 1000, &summary.p90},
+            {(summary.count * 990 + 999) / 1000, &summary.p99},
+            {(summary.count * 999 + 999) / 1000, &summary.p999},
+        };
+        size_t next = 0;
+        uint64_t seen = 0;
+        for (int b = 0; b < LATENCY_BUCKETS && next < 4; ++b) {
+            seen += snapshot[b];
+            for (; next < 4 && seen >= targets[next].rank; ++next) {
+                *targets[next].value = std::min(bucket_high(b), summary.max);
+            }
+        }
+        return summary;
+    }
+
+private:
+    // Values below LATENCY_SUB_BUCKETS get a bucket each; above that, each
+    // power of two is split into LATENCY_SUB_BUCKETS equal buckets
+    static int bucket_of(uint64_t value) {
+        const uint64_t limit = (uint64_t(1) << LATENCY_MAX_BITS) - 1;
+        if (value > limit) value = limit;
+        if (value < LATENCY_SUB_BUCKETS) return static_cast<int>(value);
+        int shift = 63 - __builtin_clzll(value) - LATENCY_SUB_BUCKET_BITS;
+        return shift * LATENCY_SUB_BUCKETS + static_cast<int>(value >> shift);
+    }
+
+    static uint64_t bucket_high(int bucket) {
+        if (bucket < 2 * LATENCY_SUB_BUCKETS) return static_cast<uint64_t>(bucket);
+        int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+        uint64_t sub = static_cast<uint64_t>(bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS);
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> counts[LATENCY_BUCKETS];
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+};
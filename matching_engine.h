@@ -0,0 +1,512 @@
+#pragma once
+
+// Matching engine behind the order acceptor (t4btofix), which stands in for
+// a venue when testing strategies.
+//
+// Each symbol has a book of the clients' resting limit orders. A side is a
+// vector of price levels sorted so that the best is last, and a level is a
+// FIFO of orders linked through the orders themselves: price-time priority,
+// with O(1) cancels. Orders and levels come from pools that recycle freed
+// objects, so once the pools have grown a busy run allocates nothing.
+//
+// Orders also trade against the market in /market_prices (shared_memory.h).
+// When the producer keeps books (MarketDepth > 1), an order can take up to
+// the size shown on each level. Quantity taken from the market is
+// remembered until the producer writes the symbol again, so two orders
+// cannot take the same shown size. Without books the top of book trades in
+// any size. At the same price the market trades before resting orders,
+// having been there first. When the market moves through a resting order
+// (mark_book), the order fills at its own limit.
+//
+// Prices are int64 ticks of 10^-decimals, fixed per book when it is created.
+// Quantities are int64 lots of 10^-quantity_decimals. The engine is not
+// thread-safe; callers serialise access.
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shared_memory.h"
+
+// Fixed-size objects allocated in chunks and recycled through a free list
+// threaded through the free objects themselves. Memory goes back to the
+// system only when the pool is destroyed.
+template <typename T>
+class ObjectPool {
+public:
+    explicit ObjectPool(size_t chunk_size = 4096) : chunk_size(chunk_size) {}
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    T* acquire() {
+        if (!free_list) grow();
+        Node* node = free_list;
+        free_list = node->next_free;
+        in_use++;
+        return new (node->storage) T();
+    }
+
+    void release(T* object) {
+        object->~T();
+        Node* node = reinterpret_cast<Node*>(object);
+        node->next_free = free_list;
+        free_list = node;
+        in_use--;
+    }
+
+    size_t live() const { return in_use; }
+
+private:
+    union Node {
+        Node* next_free;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    void grow() {
+        chunks.emplace_back(new Node[chunk_size]);
+        Node* chunk = chunks.back().get();
+        for (size_t i = chunk_size; i-- > 0;) {
+            chunk[i].next_free = free_list;
+            free_list = &chunk[i];
+        }
+    }
+
+    size_t chunk_size;
+    std::vector<std::unique_ptr<Node[]>> chunks;
+    Node* free_list = nullptr;
+    size_t in_use = 0;
+};
+
+enum class OrderSide : uint8_t { BUY, SELL };
+
+struct PriceLevel;
+
+// A client's order. A resting order is linked into its price level.
+struct Order {
+    Order* prev = nullptr;          // in the level's queue, oldest first
+    Order* next = nullptr;
+    PriceLevel* level = nullptr;    // null unless resting in the book
+    uint64_t id = 0;                // assigned by new_order, never reused
+    uint32_t book = 0;
+    OrderSide side = OrderSide::BUY;
+    bool market = false;            // no limit price
+    bool immediate = false;         // what does not trade at once is canceled (IOC, market)
+    int64_t price = 0;              // limit, in the book's ticks
+    int64_t quantity = 0;           // lots ordered
+    int64_t leaves = 0;             // lots still open
+    int64_t cum = 0;                // lots filled
+    double cum_value = 0;           // fill price times lots, summed, in ticks
+};
+
+struct PriceLevel {
+    int64_t price = 0;
+    Order* head = nullptr;
+    Order* tail = nullptr;
+};
+
+// Market quantity taken at a price since the symbol was last written
+struct MarketTaken {
+    int64_t price;
+    int64_t lots;
+};
+
+// A market level as seen by an order: what is left to take
+struct MarketLevel {
+    int64_t price;
+    int64_t lots;
+};
+
+// Size of a market level known only from the top of book
+constexpr int64_t UNLIMITED_LOTS = INT64_MAX;
+
+struct OrderBook {
+    std::string symbol;
+    int decimals = 5;
+    double scale = 1e5;                 // 10^decimals
+    int slot = -1;                      // in /market_prices, -1 until it appears there
+    std::vector<PriceLevel*> bids;      // ascending, best bid last
+    std::vector<PriceLevel*> asks;      // descending, best ask last
+    uint32_t market_version = 0;        // slot version the taken lists refer to
+    std::vector<MarketTaken> taken_bids; // sold into market bids
+    std::vector<MarketTaken> taken_asks; // bought from market asks
+};
+
+struct MatchingEngine {
+    explicit MatchingEngine(int price_decimals = 5, int quantity_decimals = 0)
+        : price_decimals(price_decimals), quantity_decimals(quantity_decimals),
+          lot_scale(std::pow(10.0, quantity_decimals)) {}
+
+    const SharedMemory* shm = nullptr;  // market prices; null trades between clients only
+    const int price_decimals;           // for books whose symbol is not priced in ticks
+    const int quantity_decimals;
+    const double lot_scale;             // 10^quantity_decimals
+
+    std::vector<OrderBook> books;
+    std::unordered_map<std::string, uint32_t> book_ids;
+    std::vector<int32_t> slot_books;    // book per shm slot, -1 if none
+    int unbound_books = 0;
+    int64_t bound_shm_listed = -1;      // shm->listed at the last binding pass
+
+    ObjectPool<Order> orders;
+    ObjectPool<PriceLevel> levels;
+    uint64_t next_order_id = 1;
+
+    // The market side the order being matched trades against, best first
+    MarketLevel market[MAX_BOOK_DEPTH];
+};
+
+// Resolve books whose symbol had not reached shm yet. Only rescans when the
+// producer has listed symbols since the previous pass.
+inline void bind_books(MatchingEngine& engine) {
+    const SharedMemory* shm = engine.shm;
+    if (!shm || engine.unbound_books == 0) return;
+    int64_t listed = shm->listed.load(std::memory_order_acquire);
+    if (listed == engine.bound_shm_listed) return;
+    engine.bound_shm_listed = listed;
+    if (engine.slot_books.size() != shm->capacity) engine.slot_books.assign(shm->capacity, -1);
+
+    for (size_t i = 0; i < engine.books.size(); ++i) {
+        OrderBook& book = engine.books[i];
+        if (book.slot >= 0) continue;
+        book.slot = shm->find(book.symbol.c_str());
+        if (book.slot < 0) continue;
+        engine.slot_books[book.slot] = static_cast<int32_t>(i);
+        engine.unbound_books--;
+    }
+}
+
+// Start marking books against shm, e.g. once the producer's segment exists,
+// or against the segment of a restarted producer: every book is bound to
+// its symbol's slot afresh. Null trades between clients only.
+inline void attach_market(MatchingEngine& engine, const SharedMemory* shm) {
+    engine.shm = shm;
+    engine.slot_books.clear();
+    engine.unbound_books = static_cast<int>(engine.books.size());
+    for (OrderBook& book : engine.books) {
+        book.slot = -1;
+        book.market_version = 0;
+        book.taken_bids.clear();
+        book.taken_asks.clear();
+    }
+    engine.bound_shm_listed = -1;
+    bind_books(engine);
+}
+
+// Book for symbol, or -1 if it has none yet
+inline int64_t find_book(const MatchingEngine& engine, const std::string& symbol) {
+    auto found = engine.book_ids.find(symbol);
+    return found == engine.book_ids.end() ? -1 : static_cast<int64_t>(found->second);
+}
+
+// Decimals of symbol's prices: its book's if it has one, else its tick
+// decimals if it is in shm priced in ticks, else price_decimals. Lets an
+// order be checked before book_for creates its book.
+inline int book_decimals(const MatchingEngine& engine, const std::string& symbol) {
+    int64_t id = find_book(engine, symbol);
+    if (id >= 0) return engine.books[id].decimals;
+    int slot = engine.shm ? engine.shm->find(symbol.c_str()) : -1;
+    if (slot >= 0) {
+        int32_t decimals = engine.shm->price(slot).decimals;
+        if (decimals >= 0 && decimals <= MAX_TICK_DECIMALS) return decimals;
+    }
+    return engine.price_decimals;
+}
+
+// Book for symbol, created on first use with book_decimals
+inline uint32_t book_for(MatchingEngine& engine, const std::string& symbol) {
+    int64_t found = find_book(engine, symbol);
+    if (found >= 0) return static_cast<uint32_t>(found);
+
+    uint32_t id = static_cast<uint32_t>(engine.books.size());
+    int decimals = book_decimals(engine, symbol);
+    engine.book_ids.emplace(symbol, id);
+    engine.books.emplace_back();
+    OrderBook& book = engine.books.back();
+    book.symbol = symbol;
+    book.decimals = decimals;
+    book.scale = std::pow(10.0, decimals);
+    engine.unbound_books++;
+    engine.bound_shm_listed = -1;
+    bind_books(engine);
+    return id;
+}
+
+// Ticks of a market price, rounded away from the side taking it so that
+// rounding never improves a fill. 0 if there is no price.
+inline int64_t market_ticks(const OrderBook& book, double price, bool round_up) {
+    if (!(price > 0)) return 0;
+    double ticks = price * book.scale;
+    return static_cast<int64_t>(round_up ? std::ceil(ticks - 1e-6) : std::floor(ticks + 1e-6));
+}
+
+// Fill engine.market with the market side an order of side `side` trades
+// against, best first, less what earlier orders took. Returns the number
+// of levels, 0 without a market for the book.
+inline int read_market(MatchingEngine& engine, OrderBook& book, OrderSide side) {
+    if (book.slot < 0) return 0;
+    const SharedMemory* shm = engine.shm;
+    const bool buy = side == OrderSide::BUY;
+
+    PriceData top;
+    PriceTicks top_ticks;
+    const PriceSlot& slot = shm->price(book.slot);
+    uint32_t version = read_price(slot, top, nullptr, &top_ticks);
+    if (version != book.market_version) {
+        book.market_version = version;
+        book.taken_bids.clear();
+        book.taken_asks.clear();
+    }
+
+    int count = 0;
+    if (shm->has_books()) {
+        BookLevel bids[MAX_BOOK_DEPTH], asks[MAX_BOOK_DEPTH];
+        uint32_t bid_count, ask_count;
+        read_book(shm, book.slot, bids, bid_count, asks, ask_count);
+        const BookLevel* side_levels = buy ? asks : bids;
+        uint32_t side_count = buy ? ask_count : bid_count;
+        for (uint32_t i = 0; i < side_count; ++i) {
+            int64_t price = market_ticks(book, side_levels[i].price, buy);
+            int64_t lots = static_cast<int64_t>(side_levels[i].size * engine.lot_scale + 1e-6);
+            if (price <= 0 || lots <= 0) continue;
+            engine.market[count++] = {price, lots};
+        }
+    } else {
+        int64_t price;
+        if (slot.decimals == book.decimals) price = buy ? top_ticks.ask : top_ticks.bid;
+        else price = market_ticks(book, buy ? top.ask : top.bid, buy);
+        if (price > 0) engine.market[count++] = {price, UNLIMITED_LOTS};
+    }
+
+    const std::vector<MarketTaken>& taken = buy ? book.taken_asks : book.taken_bids;
+    for (const MarketTaken& t : taken) {
+        for (int i = 0; i < count; ++i) {
+            if (engine.market[i].price != t.price) continue;
+            engine.market[i].lots = std::max<int64_t>(0, engine.market[i].lots - t.lots);
+        }
+    }
+    return count;
+}
+
+// Remember lots taken from a limited market level by an order of side `side`
+inline void take_market(OrderBook& book, OrderSide side, MarketLevel& level, int64_t lots) {
+    if (level.lots == UNLIMITED_LOTS) return;
+    level.lots -= lots;
+    std::vector<MarketTaken>& taken = side == OrderSide::BUY ? book.taken_asks : book.taken_bids;
+    for (MarketTaken& t : taken) {
+        if (t.price == level.price) {
+            t.lots += lots;
+            return;
+        }
+    }
+    taken.push_back({level.price, lots});
+}
+
+inline void fill_order(Order& order, int64_t price, int64_t lots) {
+    order.leaves -= lots;
+    order.cum += lots;
+    order.cum_value += static_cast<double>(price) * lots;
+}
+
+// Average fill price in the book's units, 0 before the first fill
+inline double average_price(const OrderBook& book, const Order& order) {
+    return order.cum ? order.cum_value / order.cum / book.scale : 0.0;
+}
+
+// Side vector and position where price's level is or would go
+inline std::vector<PriceLevel*>::iterator level_position(std::vector<PriceLevel*>& side_levels, OrderSide side,
+                                                         int64_t price) {
+    if (side == OrderSide::BUY) {
+        return std::lower_bound(side_levels.begin(), side_levels.end(), price,
+                                [](const PriceLevel* level, int64_t p) { return level->price < p; });
+    }
+    return std::lower_bound(side_levels.begin(), side_levels.end(), price,
+                            [](const PriceLevel* level, int64_t p) { return level->price > p; });
+}
+
+// Take a resting order out of its level, dropping the level once empty
+inline void unlink_order(MatchingEngine& engine, Order& order) {
+    PriceLevel* level = order.level;
+    if (!level) return;
+    (order.prev ? order.prev->next : level->head) = order.next;
+    (order.next ? order.next->prev : level->tail) = order.prev;
+    order.prev = order.next = nullptr;
+    order.level = nullptr;
+    if (level->head) return;
+
+    OrderBook& book = engine.books[order.book];
+    std::vector<PriceLevel*>& side_levels = order.side == OrderSide::BUY ? book.bids : book.asks;
+    if (side_levels.back() == level) side_levels.pop_back();
+    else side_levels.erase(level_position(side_levels, order.side, level->price));
+    engine.levels.release(level);
+}
+
+// Queue a limit order behind the others at its price
+inline void rest_order(MatchingEngine& engine, Order& order) {
+    OrderBook& book = engine.books[order.book];
+    std::vector<PriceLevel*>& side_levels = order.side == OrderSide::BUY ? book.bids : book.asks;
+    auto position = level_position(side_levels, order.side, order.price);
+    PriceLevel* level;
+    if (position != side_levels.end() && (*position)->price == order.price) {
+        level = *position;
+    } else {
+        level = engine.levels.acquire();
+        level->price = order.price;
+        side_levels.insert(position, level);
+    }
+    order.level = level;
+    order.prev = level->tail;
+    (level->tail ? level->tail->next : level->head) = &order;
+    level->tail = &order;
+}
+
+// A new order from request's book, side, market, immediate, price and
+// quantity. It is not in the book yet: report it, then execute_order.
+inline Order* new_order(MatchingEngine& engine, const Order& request) {
+    Order* order = engine.orders.acquire();
+    order->id = engine.next_order_id++;
+    order->book = request.book;
+    order->side = request.side;
+    order->market = request.market;
+    order->immediate = request.immediate || request.market;
+    order->price = request.price;
+    order->quantity = request.quantity;
+    order->leaves = request.quantity;
+    return order;
+}
+
+// Trade order against the market and the resting orders on the other side,
+// best price first, for as long as its limit allows, then rest what is left
+// unless it is immediate. on_fill(const Order&, int64_t price, int64_t lots)
+// is called after each fill of each order involved. Resting orders that
+// fill completely are released after their call; order itself never is:
+// unless it ended up resting, the caller releases it with release_order.
+template <typename Fn>
+void execute_order(MatchingEngine& engine, Order& order, Fn&& on_fill) {
+    OrderBook& book = engine.books[order.book];
+    const bool buy = order.side == OrderSide::BUY;
+    std::vector<PriceLevel*>& opposite = buy ? book.asks : book.bids;
+    const int market_count = read_market(engine, book, order.side);
+    int m = 0;
+
+    while (order.leaves > 0) {
+        while (m < market_count && engine.market[m].lots == 0) ++m;
+        PriceLevel* level = opposite.empty() ? nullptr : opposite.back();
+        bool from_market;
+        if (m < market_count && level) {
+            from_market = buy ? engine.market[m].price <= level->price : engine.market[m].price >= level->price;
+        } else if (m < market_count || level) {
+            from_market = m < market_count;
+        } else {
+            break;
+        }
+
+        int64_t price = from_market ? engine.market[m].price : level->price;
+        if (!order.market && (buy ? price > order.price : price < order.price)) break;
+
+        if (from_market) {
+            int64_t lots = std::min(order.leaves, engine.market[m].lots);
+            take_market(book, order.side, engine.market[m], lots);
+            fill_order(order, price, lots);
+            on_fill(order, price, lots);
+            continue;
+        }
+
+        // Oldest first at the best resting price
+        while (order.leaves > 0 && level->head) {
+            Order& resting = *level->head;
+            int64_t lots = std::min(order.leaves, resting.leaves);
+            fill_order(order, price, lots);
+            fill_order(resting, price, lots);
+            on_fill(order, price, lots);
+            on_fill(resting, price, lots);
+            if (resting.leaves == 0) {
+                bool last = resting.next == nullptr;
+                unlink_order(engine, resting);
+                engine.orders.release(&resting);
+                if (last) break; // the level went with it
+            }
+        }
+    }
+
+    if (order.leaves > 0 && !order.immediate) rest_order(engine, order);
+}
+
+// Take order out of the book with nothing left open. The caller reports it
+// and then releases it.
+inline void cancel_order(MatchingEngine& engine, Order& order) {
+    unlink_order(engine, order);
+    order.leaves = 0;
+}
+
+// Change a live order's limit and quantity; quantity includes what has
+// filled. A smaller quantity at the same price keeps the order's place in
+// the queue. Any other change takes the order out of the book and returns
+// true: the caller reports the replace and then passes it to execute_order,
+// as it may now trade. At or below the filled quantity the order is done.
+inline bool replace_order(MatchingEngine& engine, Order& order, int64_t price, int64_t quantity) {
+    if (quantity <= order.cum) {
+        unlink_order(engine, order);
+        order.quantity = order.cum;
+        order.leaves = 0;
+        return false;
+    }
+    if (price == order.price && quantity <= order.quantity && order.level) {
+        order.quantity = quantity;
+        order.leaves = quantity - order.cum;
+        return false;
+    }
+    unlink_order(engine, order);
+    order.price = price;
+    order.quantity = quantity;
+    order.leaves = quantity - order.cum;
+    return true;
+}
+
+inline void release_order(MatchingEngine& engine, Order* order) {
+    unlink_order(engine, *order);
+    engine.orders.release(order);
+}
+
+// The market moved: fill the resting orders of book that it now crosses,
+// each at its own limit, oldest first at each price. on_fill as for
+// execute_order; filled orders are released after their call.
+template <typename Fn>
+void mark_book(MatchingEngine& engine, uint32_t book_id, Fn&& on_fill) {
+    OrderBook& book = engine.books[book_id];
+    for (OrderSide side : {OrderSide::BUY, OrderSide::SELL}) {
+        const bool buy = side == OrderSide::BUY;
+        std::vector<PriceLevel*>& resting_levels = buy ? book.bids : book.asks;
+        if (resting_levels.empty()) continue;
+
+        const int market_count = read_market(engine, book, side);
+        for (int m = 0; m < market_count && !resting_levels.empty(); ++m) {
+            MarketLevel& market = engine.market[m];
+            while (market.lots > 0 && !resting_levels.empty()) {
+                PriceLevel* level = resting_levels.back();
+                if (buy ? level->price < market.price : level->price > market.price) break;
+                Order& resting = *level->head;
+                int64_t lots = std::min(resting.leaves, market.lots);
+                take_market(book, side, market, lots);
+                fill_order(resting, level->price, lots);
+                on_fill(resting, level->price, lots);
+                if (resting.leaves == 0) release_order(engine, &resting);
+            }
+        }
+    }
+}
+
+// mark_book for the book of an shm slot the producer wrote, if it has one
+template <typename Fn>
+void mark_slot(MatchingEngine& engine, int slot, Fn&& on_fill) {
+    if (slot < 0 || slot >= static_cast<int>(engine.slot_books.size())) return;
+    int32_t book = engine.slot_books[slot];
+    if (book >= 0) mark_book(engine, static_cast<uint32_t>(book), on_fill);
+}
@@ -1,115 +1,726 @@
 #include "quickfix/Application.h"
 #include "quickfix/MessageCracker.h"
-#include "quickfix/SocketInitiator.h"
+#include "quickfix/ThreadedSocketInitiator.h"
 #include "quickfix/SessionSettings.h"
 #include "quickfix/FileStore.h"
 #include "quickfix/FileLog.h"
+#include "quickfix/Log.h"
 #include "quickfix/fix44/MarketDataRequest.h"
 #include "quickfix/fix44/MarketDataSnapshotFullRefresh.h"
+#include "quickfix/fix44/MarketDataIncrementalRefresh.h"
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <chrono>
 #include <unordered_map>
+#include <unordered_set>
 #include <cstring>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 
-struct PriceData {
-    double bid;
-    double ask;
-};
+#include "async_log.h"
+#include "formula_engine.h"
+#include "shared_memory.h"
+#include "journal.h"
+
+SharedMemory* shm = nullptr;
 
-// Maximum number of symbols you want to support
-constexpr int MAX_SYMBOLS = 100;
+// Decimals of a ticks-format symbol when PriceDecimals is not set
+constexpr int DEFAULT_PRICE_DECIMALS = 5;
 
-struct SharedMemory {
-    char symbols[MAX_SYMBOLS][32]; // symbol names
-    PriceData prices[MAX_SYMBOLS];
-    int count;
+// Digits after the decimal point in a FIX price such as "1.2340"
+int price_text_decimals(const std::string& text) {
+    size_t dot = text.find('.');
+    return dot == std::string::npos ? 0 : static_cast<int>(text.size() - dot - 1);
+}
+
+// Parse a FIX price into ticks of 10^-decimals without going through a
+// double. Digits past the tick size are rounded half away from zero. False if
+// text is not a plain decimal number or does not fit in int64.
+bool parse_price_ticks(const std::string& text, int decimals, int64_t& ticks) {
+    size_t i = 0;
+    bool negative = false;
+    if (i < text.size() && (text[i] == '-' || text[i] == '+')) negative = text[i++] == '-';
+
+    int64_t value = 0;
+    int kept = 0;               // fraction digits taken into value
+    bool in_fraction = false, any_digit = false, round_up = false, rounding_seen = false;
+    for (; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '.' && !in_fraction) {
+            in_fraction = true;
+            continue;
+        }
+        if (c < '0' || c > '9') return false;
+        any_digit = true;
+        if (in_fraction && kept == decimals) {
+            if (!rounding_seen) round_up = c >= '5';
+            rounding_seen = true;
+            continue;
+        }
+        if (value > (INT64_MAX - 9) / 10) return false;
+        value = value * 10 + (c - '0');
+        if (in_fraction) kept++;
+    }
+    if (!any_digit) return false;
+    for (; kept < decimals; ++kept) {
+        if (value > INT64_MAX / 10) return false;
+        value *= 10;
+    }
+    if (round_up) value++;
+    ticks = negative ? -value : value;
+    return true;
+}
+
+// One price level as the feed sent it
+struct FeedLevel {
+    double price;
+    double size;
+    std::string text;   // MDEntryPx as received, for exact ticks
 };
 
-SharedMemory* shm = nullptr;
+// A symbol's book, best level first on each side, at most MarketDepth deep
+struct FeedBook {
+    std::vector<FeedLevel> bids;
+    std::vector<FeedLevel> asks;
+};
+
+// Apply one MDUpdateAction to a side of a book. position is the 1-based
+// MDEntryPositionNo, or 0 to find the level by price instead.
+void apply_book_update(std::vector<FeedLevel>& side, bool bids, char action, int position, const FeedLevel& level,
+                       size_t depth) {
+    auto at = side.end();
+    bool same_level = false;
+    if (position > 0) {
+        at = side.begin() + std::min<size_t>(position - 1, side.size());
+        same_level = at != side.end();
+    } else {
+        at = std::find_if(side.begin(), side.end(), [&](const FeedLevel& existing) {
+            return bids ? existing.price <= level.price : existing.price >= level.price;
+        });
+        same_level = at != side.end() && at->price == level.price;
+    }
+
+    if (action == FIX::MDUpdateAction_DELETE) {
+        if (same_level) side.erase(at);
+    } else if (action == FIX::MDUpdateAction_CHANGE && same_level) {
+        *at = level;
+    } else if (action == FIX::MDUpdateAction_NEW || action == FIX::MDUpdateAction_CHANGE) {
+        if (position == 0 && same_level) *at = level;
+        else side.insert(at, level);
+        if (side.size() > depth) side.resize(depth);
+    }
+}
+
+// --- Raw FIX fast path ---
+//
+// With FastPath=Y, market data is decoded straight from the inbound string
+// QuickFIX passes to the session log before parsing it, skipping message
+// construction, repeating-group copies and the file log for 35=W and 35=X.
+// QuickFIX still runs the session: sequence numbers, resends, heartbeats,
+// admin messages and validation. Helpers below read a message in place;
+// values end at the SOH that follows them.
+
+constexpr char SOH = '\x01';
+
+// Call fn(tag, value, length) for each field until it returns false. False
+// if the message is malformed before that.
+template <typename Fn>
+bool for_each_fix_field(const char* data, size_t size, Fn fn) {
+    const char* end = data + size;
+    for (const char* p = data; p < end;) {
+        int tag = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) tag = tag * 10 + (*p - '0');
+        if (p == end || *p != '=' || tag == 0) return false;
+        const char* value = ++p;
+        const char* soh = static_cast<const char*>(std::memchr(value, SOH, end - value));
+        if (!soh) return false;
+        if (!fn(tag, value, static_cast<size_t>(soh - value))) return true;
+        p = soh + 1;
+    }
+    return true;
+}
+
+bool parse_fix_uint(const char* text, size_t length, uint64_t& value) {
+    if (length == 0 || length > 19) return false;
+    value = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (text[i] < '0' || text[i] > '9') return false;
+        value = value * 10 + static_cast<uint64_t>(text[i] - '0');
+    }
+    return true;
+}
+
+// A FIX price or quantity. Up to 15 significant digits this is one exact
+// division, which rounds the same as strtod; longer values go to strtod.
+bool parse_fix_double(const char* text, size_t length, double& value) {
+    size_t i = 0;
+    bool negative = length > 0 && text[0] == '-';
+    if (negative) i++;
+    int64_t mantissa = 0;
+    int digits = 0, decimals = -1;
+    bool any_digit = false;
+    for (; i < length; ++i) {
+        if (text[i] == '.' && decimals < 0) {
+            decimals = 0;
+        } else if (text[i] >= '0' && text[i] <= '9' && digits < 15) {
+            mantissa = mantissa * 10 + (text[i] - '0');
+            if (mantissa) digits++;
+            if (decimals >= 0) decimals++;
+            any_digit = true;
+        } else {
+            break;
+        }
+    }
+    if (i == length && digits < 15 && decimals <= 18) {
+        value = static_cast<double>(mantissa) / static_cast<double>(pow10_ticks(decimals > 0 ? decimals : 0));
+        if (negative) value = -value;
+        return any_digit;
+    }
+
+    char buffer[64];
+    if (length >= sizeof(buffer)) return false;
+    std::memcpy(buffer, text, length);
+    buffer[length] = '\0';
+    char* end = nullptr;
+    value = std::strtod(buffer, &end);
+    return end == buffer + length;
+}
+
+// True if the trailing 10= field matches the byte sum of everything before it
+bool fix_checksum_ok(const char* data, size_t size) {
+    if (size < 8 || data[size - 1] != SOH || std::memcmp(data + size - 8, "\x01" "10=", 4) != 0) return false;
+    unsigned sum = 0;
+    for (size_t i = 0; i < size - 7; ++i) sum += static_cast<unsigned char>(data[i]);
+    const char* digits = data + size - 4;
+    for (int i = 0; i < 3; ++i) {
+        if (digits[i] < '0' || digits[i] > '9') return false;
+    }
+    return (sum & 255) == static_cast<unsigned>((digits[0] - '0') * 100 + (digits[1] - '0') * 10 + (digits[2] - '0'));
+}
+
+// --- Price store ---
 
-class MarketDataListener : public FIX::Application, public FIX::MessageCracker {
+// The /market_prices segment shared by all sessions, and their tick journals.
+// Every symbol has one owning session, the only one that writes its slot:
+// the session configured to subscribe to it or, for a symbol nobody asked
+// for, the first to receive it. Each session's symbols get their slots
+// reserved in one block before it connects.
+class PriceStore {
 public:
-    MarketDataListener() {
-        // Create shared memory
-        int fd = shm_open("/market_prices", O_CREAT | O_RDWR, 0666);
-        ftruncate(fd, sizeof(SharedMemory));
-        shm = (SharedMemory*)mmap(nullptr, sizeof(SharedMemory), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-        if (!shm) {
+    // tick_decimals is NO_TICKS to store doubles, or the minimum decimals of
+    // symbols stored as ticks. book_depth is the number of levels per side
+    // requested and kept in shm; 1 is top of book only. Tests name a
+    // segment of their own.
+    PriceStore(uint32_t capacity, int tick_decimals, uint32_t book_depth,
+               const std::string& segment_name = "/market_prices")
+        : tick_decimals(tick_decimals), book_depth(book_depth), segment_name(segment_name),
+          owners(new std::atomic<int>[capacity]) {
+        for (uint32_t i = 0; i < capacity; ++i) owners[i].store(-1, std::memory_order_relaxed);
+
+        // Create shared memory sized for the configured number of symbols
+        shm_size = SharedMemory::size_for(capacity, book_depth);
+        int fd = shm_open(segment_name.c_str(), O_CREAT | O_RDWR, 0666);
+        ftruncate(fd, shm_size);
+        shm = (SharedMemory*)mmap(nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (shm == MAP_FAILED) {
             std::cerr << "Failed to map shared memory\n";
+            shm = nullptr;
+            return;
         }
-        shm->count = 0;
-        close(fd);
+        init_shared_memory(shm, capacity, book_depth);
+        std::cout << "Shared memory ready for " << capacity << " symbols";
+        if (book_depth > 1) std::cout << " with " << book_depth << " book levels each";
+        std::cout << "\n";
     }
 
-    ~MarketDataListener() {
+    ~PriceStore() {
         if (shm) {
-            munmap(shm, sizeof(SharedMemory));
-            shm_unlink("/market_prices");
+            munmap(shm, shm_size);
+            shm_unlink(segment_name.c_str());
         }
     }
 
-    void onCreate(const FIX::SessionID &sessionID) override { 
-        std::cout << "Session created: " << sessionID << std::endl; 
+    // Record every price written from now on under directory, in one
+    // journal per session so sessions never share one. With more than one
+    // session, session i journals to directory/session<i + 1>.
+    bool startJournals(const std::string& directory, size_t file_bytes, size_t sessions) {
+        if (!shm) return false;
+        if (sessions > 1) mkdir(directory.c_str(), 0755);
+        for (size_t i = 0; i < sessions; ++i) {
+            journals.emplace_back(new TickJournal());
+            std::string path = sessions == 1 ? directory : directory + "/session" + std::to_string(i + 1);
+            if (!journals.back()->open(path, file_bytes, shm)) return false;
+            std::cout << "Journaling ticks to " << journals.back()->first_path() << std::endl;
+        }
+        journaling = true;
+        return true;
     }
 
-    void onLogon(const FIX::SessionID &sessionID) override {
-        std::cout << "Logon: " << sessionID << std::endl;
-        requestMarketData(sessionID, {"XAUUSD.m", "GCZ25.m"});
+    // The slot symbol is kept in, reserving one for owner if it has none.
+    // -1 if the segment is full.
+    int claim(const std::string& symbol, int owner) {
+        std::lock_guard<std::mutex> lock(slots_mutex);
+        auto it = slots.find(symbol);
+        if (it != slots.end()) return it->second;
+        int slot = shm ? shm->reserve(symbol.c_str()) : -1;
+        if (slot < 0) return -1;
+        owners[slot].store(owner, std::memory_order_relaxed);
+        slots.emplace(symbol, slot);
+        return slot;
     }
 
-    void onLogout(const FIX::SessionID &sessionID) override { 
-        std::cout << "Logout: " << sessionID << std::endl; 
-    }
+    int owner(int slot) const { return owners[slot].load(std::memory_order_relaxed); }
 
-    void toAdmin(FIX::Message &, const FIX::SessionID &) override {}
-    void fromAdmin(const FIX::Message& msg, const FIX::SessionID& s)
-        throw(FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::RejectLogon) override {
-        std::cout << "Admin Msg: " << msg.toString() << std::endl;
+    // Journal a write to slot; only its owner, on its own thread, calls these
+    void journalSymbol(int owner, int slot) {
+        if (!journaling) return;
+        journals[owner]->append_symbol(slot, shm->price(slot).timestamp_ns.load(std::memory_order_relaxed));
     }
 
-    void toApp(FIX::Message& msg, const FIX::SessionID& s) throw(FIX::DoNotSend) override {
-        std::cout << "Sending: " << msg.toString() << std::endl;
+    void journalPrice(int owner, int slot) {
+        if (!journaling) return;
+        journals[owner]->append_price(slot, shm->price(slot));
     }
 
-    void fromApp(const FIX::Message& msg, const FIX::SessionID& s)
-        throw(FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::UnsupportedMessageType) override {
+    SharedMemory* shm = nullptr;
+    const int tick_decimals;
+    const uint32_t book_depth;
+
+private:
+    const std::string segment_name;
+    size_t shm_size = 0;
+    std::unique_ptr<std::atomic<int>[]> owners;     // session index per slot, -1 if unclaimed
+    std::mutex slots_mutex;                         // guards slots and reserving in shm
+    std::unordered_map<std::string, int> slots;     // every claimed symbol, priced or not
+    bool journaling = false;                        // set before sessions start
+    std::vector<std::unique_ptr<TickJournal>> journals;    // per session, from startJournals
+};
+
+// --- Sessions ---
+
+// One FIX session's market data: the symbols it subscribes to, its books,
+// and decoding its messages, fast path included. Sessions run on threads of
+// their own and share nothing but the PriceStore.
+class FeedSession : public FIX::MessageCracker {
+public:
+    FeedSession(PriceStore& store, int index, const FIX::SessionID& id, const std::vector<std::string>& symbols)
+        : id(id), index(index), symbols(symbols), store(store) {}
+
+    const FIX::SessionID id;
+    const int index;
+    const std::vector<std::string> symbols;     // subscribed on logon
+
+    // QuickFIX calls this only for a message it has accepted, so this is
+    // also where the fast path's decoded entries are applied
+    void fromApp(const FIX::Message& msg, const FIX::SessionID& s) {
+        if (fast_path_seq) {
+            FIX::MsgSeqNum seq;
+            msg.getHeader().getField(seq);
+            bool staged = static_cast<uint64_t>(seq.getValue()) == fast_path_seq;
+            fast_path_seq = 0;
+            if (staged) {
+                applyStaged();
+                return;
+            }
+        }
+        received_ns = wall_clock_ns();
         crack(msg, s);
     }
 
+    // A full refresh replaces the symbol's book
     void onMessage(const FIX44::MarketDataSnapshotFullRefresh& msg, const FIX::SessionID&) {
         FIX::Symbol symbol;
         FIX::NoMDEntries noEntries;
         msg.get(symbol);
         msg.get(noEntries);
 
-        double bid = 0.0, ask = 0.0;
+        FeedBook& book = books[symbol.getString()];
+        book.bids.clear();
+        book.asks.clear();
         for (int i = 1; i <= noEntries; ++i) {
             FIX44::MarketDataSnapshotFullRefresh::NoMDEntries group;
             msg.getGroup(i, group);
             FIX::MDEntryType type;
             FIX::MDEntryPx px;
+            FIX::MDEntrySize size;
             group.get(type);
             group.get(px);
-            if (type.getValue() == FIX::MDEntryType_BID) bid = px.getValue();
-            else if (type.getValue() == FIX::MDEntryType_OFFER) ask = px.getValue();
+            if (group.isSetField(FIX::FIELD::MDEntrySize)) group.get(size);
+
+            bool bid = type.getValue() == FIX::MDEntryType_BID;
+            if (!bid && type.getValue() != FIX::MDEntryType_OFFER) continue;
+            apply_book_update(bid ? book.bids : book.asks, bid, FIX::MDUpdateAction_NEW, 0,
+                              FeedLevel{px.getValue(), size.getValue(), px.getString()}, store.book_depth);
         }
+        saveBook(symbol.getString(), book);
+    }
 
-        saveToSharedMemory(symbol.getString(), bid, ask);
+    // Incremental refresh: New/Change/Delete per level, possibly for several
+    // symbols. Levels are addressed by MDEntryPositionNo when the feed sends
+    // it, by price otherwise (or the top level at MarketDepth=1). Each symbol
+    // touched is published once, after the whole message is applied.
+    void onMessage(const FIX44::MarketDataIncrementalRefresh& msg, const FIX::SessionID&) {
+        FIX::NoMDEntries noEntries;
+        msg.get(noEntries);
+
+        touched_books.clear();
+        std::string symbol;     // an entry without Symbol continues the previous one's
+        for (int i = 1; i <= noEntries; ++i) {
+            FIX44::MarketDataIncrementalRefresh::NoMDEntries group;
+            msg.getGroup(i, group);
+            FIX::MDUpdateAction action;
+            FIX::MDEntryType type;
+            group.get(action);
+            group.get(type);
+            if (group.isSetField(FIX::FIELD::Symbol)) {
+                FIX::Symbol entry_symbol;
+                group.get(entry_symbol);
+                symbol = entry_symbol.getString();
+            }
+            FeedLevel level = {0.0, 0.0, std::string()};
+            bool has_price = group.isSetField(FIX::FIELD::MDEntryPx);
+            if (has_price) {
+                FIX::MDEntryPx px;
+                group.get(px);
+                level.price = px.getValue();
+                level.text = px.getString();
+            }
+            if (group.isSetField(FIX::FIELD::MDEntrySize)) {
+                FIX::MDEntrySize size;
+                group.get(size);
+                level.size = size.getValue();
+            }
+            int position = 0;
+            if (group.isSetField(FIX::FIELD::MDEntryPositionNo)) {
+                FIX::MDEntryPositionNo position_no;
+                group.get(position_no);
+                position = std::max(1, position_no.getValue());
+            }
+            applyIncrementalEntry(symbol, action.getValue(), type.getValue(), has_price, level, position);
+        }
+        for (const auto* entry : touched_books) saveBook(entry->first, entry->second);
+    }
+
+    // Called by FastPathLog with every message the session receives, before
+    // QuickFIX parses or validates it. True if it was market data and has
+    // been decoded; fromApp applies it once QuickFIX has accepted it, and
+    // nothing of it is published if QuickFIX rejects it.
+    bool onRawIncoming(const std::string& raw) {
+        if (!session) session = FIX::Session::lookupSession(id);
+        if (!session) return false;
+        return stageRawMarketData(raw, static_cast<uint64_t>(session->getExpectedTargetNum()));
+    }
+
+    // The fast path: decode a 35=W or 35=X in place from the raw message into
+    // staged entries for fromApp to apply like the onMessage handlers above.
+    // Only taken for the message with expected_seq and an intact checksum;
+    // anything else is left to QuickFIX. QuickFIX still validates and
+    // acknowledges every message, and a message it rejects never reaches
+    // fromApp. Once the staged entries have grown this allocates nothing.
+    bool stageRawMarketData(const std::string& raw, uint64_t expected_seq) {
+        char msg_type = 0;
+        uint64_t seq = 0;
+        bool in_entries = false, complete = false;
+        int entry_tag = 0;              // first tag of each NoMDEntries entry
+        StagedEntry* entry = nullptr;
+
+        fast_path_seq = 0;
+        staged_count = 0;
+        raw_symbol.clear();     // an entry without Symbol continues the previous one's, within a message only
+        for_each_fix_field(raw.data(), raw.size(), [&](int tag, const char* value, size_t length) {
+            if (in_entries && tag != 10) {
+                if (entry_tag == 0) entry_tag = tag;
+                if (tag == entry_tag) {
+                    if (staged_count == staged.size()) staged.emplace_back();
+                    entry = &staged[staged_count++];
+                    entry->symbol = raw_symbol;
+                    entry->action = FIX::MDUpdateAction_NEW;
+                    entry->type = 0;
+                    entry->has_price = false;
+                    entry->position = 0;
+                    entry->level.price = entry->level.size = 0.0;
+                    entry->level.text.clear();
+                }
+            }
+            switch (tag) {
+                case 35:
+                    msg_type = length == 1 ? value[0] : 0;
+                    return msg_type == 'W' || msg_type == 'X';
+                case 34:
+                    return parse_fix_uint(value, length, seq) && seq == expected_seq;
+                case 55:
+                    raw_symbol.assign(value, length);
+                    if (entry) entry->symbol = raw_symbol;
+                    return true;
+                case 268:
+                    if (msg_type == 0 || seq != expected_seq || !fix_checksum_ok(raw.data(), raw.size())) return false;
+                    if (msg_type == 'W' && raw_symbol.empty()) return false;
+                    in_entries = true;
+                    staged_snapshot = msg_type == 'W';
+                    staged_symbol = raw_symbol;
+                    return true;
+                case 10:
+                    complete = in_entries;
+                    return false;
+            }
+            if (!entry) return true;
+            switch (tag) {
+                case 279:
+                    entry->action = length == 1 ? value[0] : 0;
+                    break;
+                case 269:
+                    entry->type = length == 1 ? value[0] : 0;
+                    break;
+                case 270:
+                    entry->has_price = parse_fix_double(value, length, entry->level.price);
+                    if (entry->has_price) entry->level.text.assign(value, length);
+                    break;
+                case 271:
+                    parse_fix_double(value, length, entry->level.size);
+                    break;
+                case 290: {
+                    uint64_t number = 0;
+                    if (parse_fix_uint(value, length, number)) {
+                        entry->position = static_cast<int>(std::min<uint64_t>(std::max<uint64_t>(number, 1),
+                                                                              MAX_BOOK_DEPTH + 1));
+                    }
+                    break;
+                }
+            }
+            return true;
+        });
+
+        // A message that does not decode cleanly up to its checksum is left
+        // to QuickFIX whole
+        if (!complete) return false;
+        staged_received_ns = wall_clock_ns();
+        fast_path_seq = expected_seq;
+        return true;
     }
 
 private:
+    // One NoMDEntries entry decoded by the fast path
+    struct StagedEntry {
+        std::string symbol;     // of a 35=X entry
+        char action;
+        char type;
+        bool has_price;
+        int position;
+        FeedLevel level;
+    };
+
+    // One NoMDEntries entry of an incremental refresh. position is its
+    // MDEntryPositionNo, or 0 if it has none.
+    void applyIncrementalEntry(const std::string& symbol, char action, char type, bool has_price,
+                               const FeedLevel& level, int position) {
+        bool bid = type == FIX::MDEntryType_BID;
+        if (symbol.empty() || (!bid && type != FIX::MDEntryType_OFFER)) return;
+        if (!has_price && action != FIX::MDUpdateAction_DELETE) return;
+        if (position == 0 && store.book_depth == 1) position = 1;
+        if (position == 0 && !has_price) return;    // a Delete that names neither level nor price
+
+        auto it = books.find(symbol);
+        if (it == books.end()) it = books.emplace(symbol, FeedBook()).first;
+        if (std::find(touched_books.begin(), touched_books.end(), &*it) == touched_books.end()) {
+            touched_books.push_back(&*it);
+        }
+        apply_book_update(bid ? it->second.bids : it->second.asks, bid, action, position, level, store.book_depth);
+    }
+
+    // Apply what stageRawMarketData decoded, as the onMessage handlers would
+    void applyStaged() {
+        received_ns = staged_received_ns;
+        touched_books.clear();
+        if (staged_snapshot) {
+            auto it = books.find(staged_symbol);
+            if (it == books.end()) it = books.emplace(staged_symbol, FeedBook()).first;
+            FeedBook& book = it->second;
+            book.bids.clear();
+            book.asks.clear();
+            for (size_t i = 0; i < staged_count; ++i) {
+                const StagedEntry& entry = staged[i];
+                bool bid = entry.type == FIX::MDEntryType_BID;
+                if (!entry.has_price || (!bid && entry.type != FIX::MDEntryType_OFFER)) continue;
+                apply_book_update(bid ? book.bids : book.asks, bid, FIX::MDUpdateAction_NEW, 0, entry.level,
+                                  store.book_depth);
+            }
+            touched_books.push_back(&*it);
+        } else {
+            for (size_t i = 0; i < staged_count; ++i) {
+                const StagedEntry& entry = staged[i];
+                applyIncrementalEntry(entry.symbol, entry.action, entry.type, entry.has_price, entry.level,
+                                      entry.position);
+            }
+        }
+        for (const auto* touched : touched_books) saveBook(touched->first, touched->second);
+    }
+
+    // Publish a book: its levels to the slot's book in shm, if kept, and its
+    // top of book to the slot's price. A missing side is stored as 0.
+    void saveBook(const std::string& symbol, const FeedBook& book) {
+        const FeedLevel* bid = book.bids.empty() ? nullptr : &book.bids.front();
+        const FeedLevel* ask = book.asks.empty() ? nullptr : &book.asks.front();
+        const FeedBook* levels = store.shm && store.shm->has_books() ? &book : nullptr;
+        if (store.tick_decimals != NO_TICKS) {
+            saveTicksToSharedMemory(symbol, bid ? bid->text : std::string(), ask ? ask->text : std::string(), levels);
+        } else {
+            saveToSharedMemory(symbol, bid ? bid->price : 0.0, ask ? ask->price : 0.0, levels);
+        }
+    }
+
+    void writeBook(int slot, const FeedBook& book) {
+        book_scratch.clear();
+        for (const auto& level : book.bids) book_scratch.push_back({level.price, level.size});
+        for (const auto& level : book.asks) book_scratch.push_back({level.price, level.size});
+        store.shm->write_book(slot, book_scratch.data(), static_cast<uint32_t>(book.bids.size()),
+                              book_scratch.data() + book.bids.size(), static_cast<uint32_t>(book.asks.size()));
+    }
+
+    // The slot this session writes symbol to, or -1 if the segment is full
+    // or another session owns it. first is set if it has no price yet.
+    int slotFor(const std::string& symbol, bool& first) {
+        first = false;
+        int slot = store.shm->find(symbol.c_str());
+        if (slot < 0) {
+            if ((slot = store.claim(symbol, index)) < 0) {
+                LOG_ERROR("Shared memory full, cannot add symbol ", symbol);
+                return -1;
+            }
+            first = true;
+        }
+        if (store.owner(slot) != index) {
+            if (foreign_symbols.insert(symbol).second) {
+                LOG_WARNING("Warning: Ignoring ", symbol, " on ", id, ", another session feeds it");
+            }
+            return -1;
+        }
+        return slot;
+    }
+
+    // A book goes in before the price, so the price update announces both
+    void saveToSharedMemory(const std::string& symbol, double bid, double ask, const FeedBook* book = nullptr) {
+        if (!store.shm) return;
+
+        bool first;
+        int slot = slotFor(symbol, first);
+        if (slot < 0) return;
+        if (book) writeBook(slot, *book);
+        if (first) {
+            store.shm->first_price(slot, bid, ask, received_ns);
+            store.journalSymbol(index, slot);
+        } else {
+            store.shm->update(slot, bid, ask, received_ns);
+        }
+        store.journalPrice(index, slot);
+    }
+
+    // Store exact ticks parsed from the price text. A new symbol gets the
+    // finer of PriceDecimals and the precision of its first quote.
+    void saveTicksToSharedMemory(const std::string& symbol, const std::string& bid_text, const std::string& ask_text,
+                                 const FeedBook* book = nullptr) {
+        if (!store.shm) return;
+
+        bool first;
+        int slot = slotFor(symbol, first);
+        if (slot < 0) return;
+        int decimals = !first ? store.shm->price(slot).decimals
+                              : std::min<int>(MAX_TICK_DECIMALS, std::max({store.tick_decimals,
+                                                                           price_text_decimals(bid_text),
+                                                                           price_text_decimals(ask_text)}));
+        PriceTicks ticks = {0, 0};
+        if ((!bid_text.empty() && !parse_price_ticks(bid_text, decimals, ticks.bid)) ||
+            (!ask_text.empty() && !parse_price_ticks(ask_text, decimals, ticks.ask))) {
+            LOG_WARNING("Warning: Invalid price for ", symbol, ": ", bid_text, " / ", ask_text);
+            return;
+        }
+
+        if (book) writeBook(slot, *book);
+        if (first) {
+            store.shm->first_price_ticks(slot, decimals, ticks, received_ns);
+            store.journalSymbol(index, slot);
+        } else {
+            store.shm->update_ticks(slot, ticks, received_ns);
+        }
+        store.journalPrice(index, slot);
+    }
+
+    PriceStore& store;
+    FIX::Session* session = nullptr;    // looked up by the fast path
+    uint64_t received_ns = 0;   // when fromApp got the message being saved
+    std::unordered_map<std::string, FeedBook> books;
+    std::vector<const std::pair<const std::string, FeedBook>*> touched_books; // scratch for one message
+    std::vector<BookLevel> book_scratch;
+    std::unordered_set<std::string> foreign_symbols;    // owned by other sessions, warned about
+    // Fast path: the message staged for fromApp, by MsgSeqNum (0 if none)
+    uint64_t fast_path_seq = 0;
+    std::vector<StagedEntry> staged;    // only the first staged_count are current
+    size_t staged_count = 0;
+    bool staged_snapshot = false;       // a 35=W for staged_symbol, not a 35=X
+    std::string staged_symbol;
+    uint64_t staged_received_ns = 0;
+    std::string raw_symbol;             // scratch: the last Symbol seen while decoding
+};
+
+// The FIX application: session events, and each session's messages handed
+// to its FeedSession on that session's thread
+class MarketDataListener : public FIX::Application {
+public:
+    // feeds must not change once the initiator has started
+    MarketDataListener(PriceStore& store, const std::vector<std::unique_ptr<FeedSession>>& feeds) : store(store) {
+        for (const auto& feed : feeds) by_session[feed->id] = feed.get();
+    }
+
+    FeedSession* feed(const FIX::SessionID& sessionID) const {
+        auto it = by_session.find(sessionID);
+        return it == by_session.end() ? nullptr : it->second;
+    }
+
+    void onCreate(const FIX::SessionID &sessionID) override {
+        LOG_INFO("Session created: ", sessionID);
+    }
+
+    void onLogon(const FIX::SessionID &sessionID) override {
+        LOG_INFO("Logon: ", sessionID);
+        FeedSession* session = feed(sessionID);
+        if (session && !session->symbols.empty()) requestMarketData(sessionID, session->symbols);
+    }
+
+    void onLogout(const FIX::SessionID &sessionID) override {
+        LOG_INFO("Logout: ", sessionID);
+    }
+
+    void toAdmin(FIX::Message &, const FIX::SessionID &) override {}
+    void fromAdmin(const FIX::Message& msg, const FIX::SessionID& s)
+        throw(FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::RejectLogon) override {
+        LOG_DEBUG("Admin Msg: ", msg.toString());
+    }
+
+    void toApp(FIX::Message& msg, const FIX::SessionID& s) throw(FIX::DoNotSend) override {
+        LOG_DEBUG("Sending: ", msg.toString());
+    }
+
+    void fromApp(const FIX::Message& msg, const FIX::SessionID& s)
+        throw(FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::UnsupportedMessageType) override {
+        if (FeedSession* session = feed(s)) session->fromApp(msg, s);
+    }
+
     void requestMarketData(const FIX::SessionID &sessionID, const std::vector<std::string> &symbols) {
-        static int mdReqID = 1;
+        static std::atomic<int> mdReqID{1};
         FIX44::MarketDataRequest mdReq;
         mdReq.set(FIX::MDReqID("MD_" + std::to_string(mdReqID++)));
         mdReq.set(FIX::SubscriptionRequestType(FIX::SubscriptionRequestType_SNAPSHOT_PLUS_UPDATES));
-        mdReq.set(FIX::MarketDepth(1));
+        mdReq.set(FIX::MarketDepth(static_cast<int>(store.book_depth)));
         mdReq.set(FIX::MDUpdateType(FIX::MDUpdateType_INCREMENTAL_REFRESH));
 
         FIX44::MarketDataRequest::NoMDEntryTypes entryTypes;
@@ -127,47 +738,224 @@ private:
         try {
             FIX::Session::sendToTarget(mdReq, sessionID);
         } catch (...) {
-            std::cerr << "Failed to send MarketDataRequest\n";
+            LOG_ERROR("Failed to send MarketDataRequest");
         }
     }
 
-    void saveToSharedMemory(const std::string& symbol, double bid, double ask) {
-        // Check if symbol exists
-        for (int i = 0; i < shm->count; ++i) {
-            if (symbol == shm->symbols[i]) {
-                shm->prices[i].bid = bid;
-                shm->prices[i].ask = ask;
-                return;
-            }
-        }
+private:
+    PriceStore& store;
+    std::map<FIX::SessionID, FeedSession*> by_session;
+};
 
-        // Add new symbol
-        if (shm->count < MAX_SYMBOLS) {
-            strncpy(shm->symbols[shm->count], symbol.c_str(), sizeof(shm->symbols[0])-1);
-            shm->symbols[shm->count][sizeof(shm->symbols[0])-1] = '\0';
-            shm->prices[shm->count].bid = bid;
-            shm->prices[shm->count].ask = ask;
-            shm->count++;
-        } else {
-            std::cerr << "Shared memory full, cannot add symbol " << symbol << std::endl;
+// Session log that offers each inbound message to the fast path first. What
+// the fast path decoded is not written to the file log; everything else,
+// outbound messages and events are.
+class FastPathLog : public FIX::Log {
+public:
+    FastPathLog(FeedSession& feed, FIX::Log* inner) : feed(feed), inner(inner) {}
+
+    FIX::Log* wrapped() const { return inner; }
+
+    void clear() override { inner->clear(); }
+    void backup() override { inner->backup(); }
+    void onIncoming(const std::string& raw) override {
+        if (!feed.onRawIncoming(raw)) inner->onIncoming(raw);
+    }
+    void onOutgoing(const std::string& raw) override { inner->onOutgoing(raw); }
+    void onEvent(const std::string& text) override { inner->onEvent(text); }
+
+private:
+    FeedSession& feed;
+    FIX::Log* inner;
+};
+
+class FastPathLogFactory : public FIX::LogFactory {
+public:
+    FastPathLogFactory(MarketDataListener& app, FIX::LogFactory& inner) : app(app), inner(inner) {}
+
+    // The global log and sessions without a feed are not wrapped
+    FIX::Log* create() override { return inner.create(); }
+    FIX::Log* create(const FIX::SessionID& sessionID) override {
+        FeedSession* feed = app.feed(sessionID);
+        FIX::Log* log = inner.create(sessionID);
+        return feed ? new FastPathLog(*feed, log) : log;
+    }
+    void destroy(FIX::Log* log) override {
+        auto* fast = dynamic_cast<FastPathLog*>(log);
+        if (!fast) {
+            inner.destroy(log);
+            return;
         }
+        inner.destroy(fast->wrapped());
+        delete fast;
     }
+
+private:
+    MarketDataListener& app;
+    FIX::LogFactory& inner;
 };
 
+// --- Symbol universe ---
+
+// The symbols in a comma-separated list, in order, without blanks
+std::vector<std::string> split_symbols(const std::string& list) {
+    std::vector<std::string> symbols;
+    std::stringstream stream(list);
+    std::string symbol;
+    while (std::getline(stream, symbol, ',')) {
+        symbol = trim(symbol);
+        if (!symbol.empty()) symbols.push_back(symbol);
+    }
+    return symbols;
+}
+
+// Split the symbols to subscribe to between sessions. pinned[i] is session
+// i's SessionSymbols, which it keeps; every other symbol of universe goes to
+// the session with the fewest so far. A symbol is subscribed once only.
+std::vector<std::vector<std::string>> assign_symbols(const std::vector<std::string>& universe,
+                                                     const std::vector<std::vector<std::string>>& pinned) {
+    std::vector<std::vector<std::string>> assigned(pinned.size());
+    std::unordered_set<std::string> taken;
+    for (size_t i = 0; i < pinned.size(); ++i) {
+        for (const auto& symbol : pinned[i]) {
+            if (taken.insert(symbol).second) assigned[i].push_back(symbol);
+            else std::cerr << "Warning: " << symbol << " is in the SessionSymbols of more than one session\n";
+        }
+    }
+    if (assigned.empty()) return assigned;
+    for (const auto& symbol : universe) {
+        if (!taken.insert(symbol).second) continue;
+        auto smallest = std::min_element(assigned.begin(), assigned.end(),
+                                         [](const std::vector<std::string>& a, const std::vector<std::string>& b) {
+                                             return a.size() < b.size();
+                                         });
+        smallest->push_back(symbol);
+    }
+    return assigned;
+}
+
 int main() {
     try {
         FIX::SessionSettings settings("initiator.cfg");
-        MarketDataListener app;
+
+        uint32_t capacity = DEFAULT_SHM_CAPACITY;
+        const FIX::Dictionary& defaults = settings.get();
+        if (defaults.has("SharedMemoryCapacity")) {
+            int configured = defaults.getInt("SharedMemoryCapacity");
+            if (configured < 1 || configured > static_cast<int>(MAX_SHM_CAPACITY)) {
+                std::cerr << "SharedMemoryCapacity must be between 1 and " << MAX_SHM_CAPACITY << std::endl;
+                return 1;
+            }
+            capacity = static_cast<uint32_t>(configured);
+        }
+
+        int tick_decimals = NO_TICKS;
+        if (defaults.has("PriceFormat")) {
+            std::string format = defaults.getString("PriceFormat");
+            if (format == "ticks") {
+                tick_decimals = DEFAULT_PRICE_DECIMALS;
+            } else if (format != "double") {
+                std::cerr << "PriceFormat must be double or ticks" << std::endl;
+                return 1;
+            }
+        }
+        if (tick_decimals != NO_TICKS && defaults.has("PriceDecimals")) {
+            tick_decimals = defaults.getInt("PriceDecimals");
+            if (tick_decimals < 0 || tick_decimals > MAX_TICK_DECIMALS) {
+                std::cerr << "PriceDecimals must be between 0 and " << MAX_TICK_DECIMALS << std::endl;
+                return 1;
+            }
+        }
+
+        if (defaults.has("LogLevel")) {
+            LogLevel level;
+            if (!parse_log_level(defaults.getString("LogLevel"), level)) {
+                std::cerr << "LogLevel must be debug, info, warning or error" << std::endl;
+                return 1;
+            }
+            set_log_level(level);
+        }
+
+        uint32_t book_depth = 1;
+        if (defaults.has("MarketDepth")) {
+            int depth = defaults.getInt("MarketDepth");
+            if (depth < 1 || depth > static_cast<int>(MAX_BOOK_DEPTH)) {
+                std::cerr << "MarketDepth must be between 1 and " << MAX_BOOK_DEPTH << std::endl;
+                return 1;
+            }
+            book_depth = static_cast<uint32_t>(depth);
+        }
+
+        // Everything to subscribe to: Symbols and what the formulas read,
+        // spread over the sessions, plus each session's SessionSymbols
+        std::vector<std::string> universe;
+        if (defaults.has("Symbols")) universe = split_symbols(defaults.getString("Symbols"));
+        std::string formulas_file = defaults.has("FormulasFile") ? defaults.getString("FormulasFile") : "formulas.cfg";
+        if (!formulas_file.empty()) {
+            FormulaProgram formulas;
+            if (load_formulas_from_file(formulas_file, formulas)) {
+                universe.insert(universe.end(), formulas.symbols.begin(), formulas.symbols.end());
+            } else {
+                std::cerr << "Warning: Could not open " << formulas_file << ", subscribing to Symbols only\n";
+            }
+        }
+        std::set<FIX::SessionID> configured_sessions = settings.getSessions();
+        std::vector<FIX::SessionID> session_ids(configured_sessions.begin(), configured_sessions.end());
+        std::vector<std::vector<std::string>> pinned;
+        for (const auto& id : session_ids) {
+            const FIX::Dictionary& session = settings.get(id);
+            pinned.push_back(session.has("SessionSymbols") ? split_symbols(session.getString("SessionSymbols"))
+                                                           : std::vector<std::string>());
+        }
+        std::vector<std::vector<std::string>> assigned = assign_symbols(universe, pinned);
+
+        // Reserve each session's slots as one block, so sessions write
+        // disjoint ranges of the segment
+        PriceStore store(capacity, tick_decimals, book_depth);
+        std::vector<std::unique_ptr<FeedSession>> feeds;
+        for (size_t i = 0; i < session_ids.size(); ++i) {
+            int first = -1, last = -1;
+            for (const auto& symbol : assigned[i]) {
+                int slot = store.claim(symbol, static_cast<int>(i));
+                if (slot < 0) {
+                    std::cerr << "SharedMemoryCapacity is too small for the configured symbols" << std::endl;
+                    return 1;
+                }
+                if (first < 0) first = slot;
+                last = slot;
+            }
+            feeds.emplace_back(new FeedSession(store, static_cast<int>(i), session_ids[i], assigned[i]));
+            std::cout << session_ids[i] << ": " << assigned[i].size() << " symbols";
+            if (first >= 0) std::cout << " in slots " << first << "-" << last;
+            std::cout << "\n";
+        }
+
+        MarketDataListener app(store, feeds);
+        if (defaults.has("JournalDirectory") && !defaults.getString("JournalDirectory").empty()) {
+            size_t file_bytes = DEFAULT_JOURNAL_FILE_BYTES;
+            if (defaults.has("JournalFileMB")) {
+                int megabytes = defaults.getInt("JournalFileMB");
+                if (megabytes < 1) {
+                    std::cerr << "JournalFileMB must be at least 1" << std::endl;
+                    return 1;
+                }
+                file_bytes = static_cast<size_t>(megabytes) << 20;
+            }
+            if (!store.startJournals(defaults.getString("JournalDirectory"), file_bytes, feeds.size())) return 1;
+        }
         FIX::FileStoreFactory storeFactory(settings);
         FIX::FileLogFactory logFactory(settings);
-        FIX::SocketInitiator initiator(app, storeFactory, settings, logFactory);
+        FastPathLogFactory fastLogFactory(app, logFactory);
+        bool fast_path = defaults.has("FastPath") && defaults.getBool("FastPath");
+        FIX::ThreadedSocketInitiator initiator(app, storeFactory, settings,
+                                               fast_path ? static_cast<FIX::LogFactory&>(fastLogFactory) : logFactory);
 
         initiator.start();
-        std::cout << "FIX listener started...\n";
+        LOG_INFO("FIX listener started...");
         while (true) std::this_thread::sleep_for(std::chrono::seconds(1));
         initiator.stop();
     } catch (std::exception &e) {
-        std::cerr << "Exception: " << e.what() << std::endl;
+        LOG_ERROR("Exception: ", e.what());
         return 1;
     }
     return 0;
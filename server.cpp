@@ -3,6 +3,7 @@
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <chrono>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -10,397 +11,2078 @@
 #include <unistd.h>
 #include <cstring>
 #include <sstream>
-#include <iomanip>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <mutex>
 #include <algorithm>
 #include <fstream>
 #include <regex>
+#include <cmath>
+#include <charconv>
+#include <climits>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <memory>
+#include <atomic>
 
-struct PriceData {
-    double bid;
-    double ask;
-    bool operator==(const PriceData& other) const {
-        return bid == other.bid && ask == other.ask;
+#include "shared_memory.h"
+#include "formula_engine.h"
+#include "wire_format.h"
+#include "journal.h"
+#include "latency_histogram.h"
+#include "async_log.h"
+
+// What to do with updates for a client whose output buffer is full
+enum class SlowClientPolicy {
+    CONFLATE,   // keep only the latest pending update per symbol
+    DROP,       // discard updates until the client catches up
+    DISCONNECT, // close the connection
+};
+
+// Settings read from server.cfg; every key is optional
+struct ServerConfig {
+    int port = 2222;
+    int reactor_threads = 1;               // ReactorThreads
+    bool busy_spin = false;                // WaitMode=spin
+    long min_publish_interval_us = 0;      // MinPublishIntervalUs
+    size_t max_client_buffer = 1 << 20;    // MaxClientBufferBytes
+    SlowClientPolicy slow_client_policy = SlowClientPolicy::CONFLATE;
+    FormulaKernel formula_kernel = best_formula_kernel(); // FormulaKernel=auto picks this
+    bool formulas_reload = true;           // FormulasReload
+    std::string multicast_group;           // MulticastGroup, address:port; empty disables
+    std::string multicast_interface;       // MulticastInterface, local address to send from
+    int multicast_ttl = 1;                 // MulticastTTL
+    bool multicast_loopback = true;        // MulticastLoopback
+    size_t retransmit_packets = 8192;      // RetransmitPackets
+    long snapshot_refresh_ms = 1000;       // SnapshotRefreshMs
+    int stats_port = 0;                    // StatsPort, on 127.0.0.1; 0 disables
+    LogLevel log_level = LOG_LEVEL_INFO;   // LogLevel
+};
+
+// Global variables
+SharedMemory* shm = nullptr;          // whole segment, read-only
+SharedMemory* shm_control = nullptr;  // writable view of the header, for the doorbell
+size_t shm_size = 0;
+ServerConfig config;
+
+// Longest the broadcaster waits for the producer before re-checking
+constexpr long IDLE_WAIT_NS = 100 * 1000 * 1000;
+
+// Load "Key=Value" settings, ignoring blank lines and # comments
+bool load_server_config(const std::string& filename, ServerConfig& cfg) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        return false;
     }
-    bool operator!=(const PriceData& other) const {
-        return !(*this == other);
+
+    std::string line;
+    while (std::getline(file, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+
+        size_t equals_pos = line.find('=');
+        if (equals_pos == std::string::npos) continue;
+        std::string key = trim(line.substr(0, equals_pos));
+        std::string value = trim(line.substr(equals_pos + 1));
+
+        try {
+            if (key == "Port") {
+                cfg.port = std::stoi(value);
+            } else if (key == "ReactorThreads") {
+                cfg.reactor_threads = std::max(1, std::stoi(value));
+            } else if (key == "WaitMode") {
+                if (value != "block" && value != "spin") throw std::invalid_argument(value);
+                cfg.busy_spin = (value == "spin");
+            } else if (key == "MaxClientBufferBytes") {
+                cfg.max_client_buffer = std::stoul(value);
+            } else if (key == "SlowClientPolicy") {
+                if (value == "conflate") cfg.slow_client_policy = SlowClientPolicy::CONFLATE;
+                else if (value == "drop") cfg.slow_client_policy = SlowClientPolicy::DROP;
+                else if (value == "disconnect") cfg.slow_client_policy = SlowClientPolicy::DISCONNECT;
+                else throw std::invalid_argument(value);
+            } else if (key == "FormulaKernel") {
+                if (value == "auto") cfg.formula_kernel = best_formula_kernel();
+                else if (value == "avx2") cfg.formula_kernel = FormulaKernel::AVX2;
+                else if (value == "sse2") cfg.formula_kernel = FormulaKernel::SSE2;
+                else if (value == "scalar") cfg.formula_kernel = FormulaKernel::SCALAR;
+                else throw std::invalid_argument(value);
+                if (!formula_kernel_supported(cfg.formula_kernel)) {
+                    std::cerr << "Warning: FormulaKernel " << value << " is not supported by this CPU, using "
+                              << formula_kernel_name(best_formula_kernel()) << "\n";
+                    cfg.formula_kernel = best_formula_kernel();
+                }
+            } else if (key == "FormulasReload") {
+                if (value != "yes" && value != "no") throw std::invalid_argument(value);
+                cfg.formulas_reload = (value == "yes");
+            } else if (key == "MinPublishIntervalUs") {
+                cfg.min_publish_interval_us = std::stol(value);
+            } else if (key == "MulticastGroup") {
+                cfg.multicast_group = value;
+            } else if (key == "MulticastInterface") {
+                cfg.multicast_interface = value;
+            } else if (key == "MulticastTTL") {
+                cfg.multicast_ttl = std::stoi(value);
+                if (cfg.multicast_ttl < 0 || cfg.multicast_ttl > 255) throw std::out_of_range(value);
+            } else if (key == "MulticastLoopback") {
+                if (value != "yes" && value != "no") throw std::invalid_argument(value);
+                cfg.multicast_loopback = (value == "yes");
+            } else if (key == "SnapshotRefreshMs") {
+                cfg.snapshot_refresh_ms = std::max(0L, std::stol(value));
+            } else if (key == "StatsPort") {
+                cfg.stats_port = std::stoi(value);
+                if (cfg.stats_port < 0 || cfg.stats_port > 65535) throw std::out_of_range(value);
+            } else if (key == "LogLevel") {
+                if (!parse_log_level(value, cfg.log_level)) throw std::invalid_argument(value);
+            } else if (key == "RetransmitPackets") {
+                cfg.retransmit_packets = std::max<size_t>(1, std::stoul(value));
+            } else {
+                std::cerr << "Warning: Unknown setting " << key << " in " << filename << "\n";
+            }
+        } catch (...) {
+            std::cerr << "Warning: Invalid value for " << key << " in " << filename << "\n";
+        }
     }
-};
+    return true;
+}
 
-constexpr int MAX_SYMBOLS = 100;
+// --- Stats ---
+//
+// Where the time goes between a FIX message reaching the producer and its
+// update reaching the terminals, as one histogram per stage. Stamps are
+// CLOCK_REALTIME, which the producer and the broadcaster share:
+//   producer  fromApp received the message -> price written to shm
+//   pickup    written to shm -> read by the broadcaster (wake-up and
+//             MinPublishIntervalUs)
+//   collect   one broadcaster cycle: read what changed, evaluate, encode
+//   evaluate  the formula recomputation within that cycle
+//   send      batch encoded -> written to every subscriber's socket, once
+//             per reactor
+//   total     the oldest input of a batch received -> send done
+// The STATS command, and StatsPort, report them with tick rates and the
+// state of each client's queue.
 
-struct SharedMemory {
-    char symbols[MAX_SYMBOLS][32];
-    PriceData prices[MAX_SYMBOLS];
-    int count;
+enum LatencyStage { STAGE_PRODUCER, STAGE_PICKUP, STAGE_COLLECT, STAGE_EVALUATE, STAGE_SEND, STAGE_TOTAL, STAGE_COUNT };
+const char* const STAGE_NAMES[STAGE_COUNT] = {"producer", "pickup", "collect", "evaluate", "send", "total"};
+LatencyHistogram stage_latency[STAGE_COUNT];
+
+// Since startup
+const std::chrono::steady_clock::time_point started_at = std::chrono::steady_clock::now();
+std::atomic<uint64_t> total_ticks{0};       // price writes the broadcaster read from shm
+std::atomic<uint64_t> total_quotes{0};      // updates broadcast, raw and synthetic
+std::atomic<uint64_t> total_batches{0};
+
+// Rates over the last whole second, kept up to date by the broadcaster
+struct RateWindow {
+    std::chrono::steady_clock::time_point start;
+    uint64_t ticks = 0;     // totals when the window started
+    uint64_t quotes = 0;
+    uint64_t batches = 0;
 };
+RateWindow rate_window = {started_at};
+std::atomic<uint64_t> ticks_per_second{0};
+std::atomic<uint64_t> quotes_per_second{0};
+std::atomic<uint64_t> batches_per_second{0};
 
-// Global variables
-SharedMemory* shm = nullptr;
-std::vector<int> clients;
-std::mutex clients_mutex;
-const int PORT = 2222;
-
-// --- New Structures for Formula Parsing ---
-enum class Operation { ADD, SUBTRACT, NONE };
-enum class PriceType { BID, ASK, CONSTANT, NONE };
-
-struct FormulaTerm {
-    Operation op;
-    std::string symbol_name;
-    PriceType price_type;
-    double constant_value;
+// Close the rate window once a second has passed. Broadcaster thread only.
+void update_rates() {
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - rate_window.start).count();
+    if (seconds < 1) return;
+
+    RateWindow next = {now, total_ticks.load(std::memory_order_relaxed), total_quotes.load(std::memory_order_relaxed),
+                       total_batches.load(std::memory_order_relaxed)};
+    ticks_per_second.store(std::llround((next.ticks - rate_window.ticks) / seconds), std::memory_order_relaxed);
+    quotes_per_second.store(std::llround((next.quotes - rate_window.quotes) / seconds), std::memory_order_relaxed);
+    batches_per_second.store(std::llround((next.batches - rate_window.batches) / seconds), std::memory_order_relaxed);
+    rate_window = next;
+}
+
+// --- Price collection ---
+
+// Last rounded quote sent for a synthetic, in units of 10^-precision
+const PriceTicks NEVER_QUOTED = {INT64_MIN, INT64_MIN};
+
+// Synthetic symbols compiled from formulas.cfg, with the feed id each one is
+// broadcast under. A synthetic keeps its feed id across reloads, so a
+// terminal's subscriptions and the binary dictionary stay valid; the id of
+// one a reload removed may go to a new synthetic (see compile_formulas).
+// Everything is sized by the thread that compiles the set, so adopting it
+// allocates nothing.
+struct FormulaSet {
+    FormulaProgram program;
+    std::vector<uint32_t> feed_ids;     // per synthetic: shm capacity plus its stable index
+    std::vector<int32_t> synthetic_at;  // per stable index: the synthetic with it, -1 if none
+    std::vector<PriceTicks> last_quotes; // per stable index, NEVER_QUOTED until sent
+    FormulaSet* next_retired = nullptr; // link in retired_formulas
 };
 
-struct Formula {
-    std::vector<FormulaTerm> terms;
+// The set the broadcaster evaluates. Only the broadcaster touches it, so
+// evaluating needs no lock; a reload is handed over through
+// pending_formulas (see "Formula reload" below).
+FormulaSet* formulas = nullptr;
+
+// Guards the broadcaster's change-detection state below
+std::mutex last_prices_mutex;
+
+// announced_exponents entry of a feed that has not been sent yet
+constexpr int8_t NOT_ANNOUNCED = INT8_MAX;
+
+// By feed id, guarded by last_prices_mutex
+std::vector<uint64_t> feed_seqs;        // quotes produced so far, the last one's WireQuote seq
+std::vector<int8_t> announced_exponents; // as last sent in a batch's dictionary, NOT_ANNOUNCED before
+
+// A newly compiled set waiting for the broadcaster, or null
+std::atomic<FormulaSet*> pending_formulas{nullptr};
+
+// Sets the broadcaster replaced, linked through next_retired, for the
+// reload thread to free
+std::atomic<FormulaSet*> retired_formulas{nullptr};
+
+// Switch to a set published since the previous cycle, if any. The old set
+// is retired rather than freed so the broadcaster never pays for the
+// deallocation; the one reader having moved on is the grace period.
+// Synthetics that kept their index and name keep their last quote; an
+// index now held by another name starts unquoted and is announced again,
+// so terminals learn its new name before its first quote.
+void adopt_pending_formulas() {
+    if (!pending_formulas.load(std::memory_order_relaxed)) return;
+    FormulaSet* adopted = pending_formulas.exchange(nullptr, std::memory_order_acquire);
+    if (!adopted) return;
+
+    FormulaSet* old = formulas;
+    for (size_t index = 0; index < adopted->synthetic_at.size(); ++index) {
+        int32_t id = adopted->synthetic_at[index];
+        if (id < 0) continue;
+        int32_t old_id = old && index < old->synthetic_at.size() ? old->synthetic_at[index] : -1;
+        if (old_id >= 0 && old->program.synthetics[old_id].name == adopted->program.synthetics[id].name) {
+            adopted->last_quotes[index] = old->last_quotes[index];
+            continue;
+        }
+        size_t feed_id = shm->capacity + index;
+        if (feed_id < announced_exponents.size()) announced_exponents[feed_id] = NOT_ANNOUNCED;
+    }
+
+    formulas = adopted;
+    if (!old) return;
+    old->next_retired = retired_formulas.load(std::memory_order_relaxed);
+    while (!retired_formulas.compare_exchange_weak(old->next_retired, old, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+    }
+}
+
+// Raw symbols stored as doubles are sent with this many decimals; symbols
+// stored as ticks use their own
+constexpr int RAW_PRICE_DIGITS = 5;
+constexpr double RAW_PRICE_SCALE = 1e5;
+
+// One broadcaster cycle, encoded once in each wire format and shared by
+// every connection. Each update is keyed by feed id: the shm slot for a raw
+// symbol, or shm capacity plus the synthetic's index for a synthetic. The
+// feed id doubles as the binary symbol id.
+struct Batch {
+    struct Entry {
+        uint32_t feed_id;
+        uint32_t offset;    // line position in text
+        uint32_t length;    // including the newline
+    };
+    std::string text;
+    std::string binary;     // one WireQuote per entry, in the same order
+    std::vector<Entry> entries;
+    std::string dictionary; // WireSymbol records for feeds appearing or changing exponent
+    uint64_t last_packet = 0; // multicast packet that ends this batch, 0 without multicast
+    uint64_t received_ns = 0; // when the producer received the oldest raw price in it
+    uint64_t collected_ns = 0; // when the broadcaster finished encoding it
+
+    // Empty the batch but keep its buffers for reuse
+    void clear() {
+        text.clear();
+        binary.clear();
+        entries.clear();
+        dictionary.clear();
+        last_packet = 0;
+        received_ns = 0;
+        collected_ns = 0;
+    }
 };
 
-struct SyntheticSymbol {
-    Formula bid_formula;
-    Formula ask_formula;
-    int precision = 5; // New member to store the number of decimal places
+// Raw-price change tracking by shm slot, guarded by last_prices_mutex
+uint64_t update_cursor = 0;             // position in the shm update ring
+std::vector<uint32_t> slot_versions;    // last seqlock version seen
+std::vector<PriceData> last_slot_prices; // last price sent, NaN before the first
+std::vector<PriceTicks> last_slot_ticks; // same for tick-priced slots
+
+// Append value with a fixed number of decimals, like std::fixed formatting
+void append_fixed(std::string& out, double value, int digits) {
+    char buffer[352]; // room for any double with up to 15 decimals
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, digits);
+    out.append(buffer, result.ptr);
+}
+
+// Append ticks of 10^-decimals as a decimal number, e.g. -1234 at 2 -> "-12.34"
+void append_ticks(std::string& out, int64_t ticks, int decimals) {
+    char buffer[48];
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    uint64_t magnitude = ticks < 0 ? 0 - static_cast<uint64_t>(ticks) : static_cast<uint64_t>(ticks);
+    for (int i = 0; i < decimals; ++i, magnitude /= 10) *--p = static_cast<char>('0' + magnitude % 10);
+    if (decimals > 0) *--p = '.';
+    do {
+        *--p = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (ticks < 0) *--p = '-';
+    out.append(p, end);
+}
+
+// Append a line for every raw and synthetic price that changed since the
+// previous call. Only slots named in the shm update ring are read, and only
+// synthetics fed by those slots are recomputed. Change detection lives in
+// arrays indexed by slot and synthetic id, and text is formatted straight
+// into the batch, so once the batch's buffers have grown this allocates
+// nothing.
+void collect_price_updates(Batch& batch) {
+    std::lock_guard<std::mutex> last_prices_lock(last_prices_mutex);
+    const uint64_t read_ns = wall_clock_ns();
+    uint64_t newest_input_ns = 0;
+    uint64_t oldest_received_ns = UINT64_MAX;
+    uint64_t ticks = 0;
+
+    auto add_entry = [&](uint32_t feed_id, size_t start, int digits, int64_t bid, int64_t ask, uint64_t timestamp_ns) {
+        batch.entries.push_back({feed_id, static_cast<uint32_t>(start),
+                                 static_cast<uint32_t>(batch.text.size() - start)});
+        if (feed_id >= feed_seqs.size()) {
+            feed_seqs.resize(feed_id + 1, 0);
+            announced_exponents.resize(feed_id + 1, NOT_ANNOUNCED);
+        }
+        WireQuote record{};
+        record.type = WIRE_QUOTE;
+        record.exponent = static_cast<int8_t>(-digits);
+        record.symbol_id = feed_id;
+        record.seq = ++feed_seqs[feed_id];
+        record.bid = bid;
+        record.ask = ask;
+        record.timestamp_ns = timestamp_ns;
+        batch.binary.append(reinterpret_cast<const char*>(&record), sizeof(record));
+
+        if (announced_exponents[feed_id] != record.exponent) {
+            announced_exponents[feed_id] = record.exponent;
+            const char* line = batch.text.data() + start;
+            WireSymbol symbol{};
+            symbol.type = WIRE_SYMBOL;
+            symbol.exponent = record.exponent;
+            symbol.symbol_id = feed_id;
+            size_t name_length = std::find(line, line + (batch.text.size() - start), ' ') - line;
+            std::memcpy(symbol.name, line, std::min(name_length, sizeof(symbol.name)));
+            batch.dictionary.append(reinterpret_cast<const char*>(&symbol), sizeof(symbol));
+        }
+    };
+
+    if (slot_versions.size() != shm->capacity) {
+        slot_versions.assign(shm->capacity, 0);
+        last_slot_prices.assign(shm->capacity, PriceData{NAN, NAN});
+        last_slot_ticks.assign(shm->capacity, NEVER_QUOTED);
+    }
+    adopt_pending_formulas();
+    FormulaProgram& program = formulas->program;
+    bind_formulas(program, shm);
+
+    // Check and broadcast raw prices from shared memory if they've changed
+    auto check_slot = [&](int slot) {
+        const PriceSlot& price_slot = shm->price(slot);
+        PriceData current_price;
+        PriceTicks current_ticks;
+        uint64_t timestamp_ns, received_ns;
+        uint32_t version = read_price(price_slot, current_price, &timestamp_ns, &current_ticks, &received_ns);
+        if (version == slot_versions[slot]) return; // already seen this write
+        slot_versions[slot] = version;
+        ticks++;
+        stage_latency[STAGE_PRODUCER].record_between(received_ns, timestamp_ns);
+        stage_latency[STAGE_PICKUP].record_between(timestamp_ns, read_ns);
+
+        // Tick-priced symbols compare and format as integers
+        int decimals = price_slot.decimals;
+        if (decimals >= 0 && decimals <= MAX_TICK_DECIMALS) {
+            PriceTicks& last = last_slot_ticks[slot];
+            if (last == current_ticks) return;
+            size_t start = batch.text.size();
+            batch.text.append(shm->symbol(slot));
+            batch.text.push_back(' ');
+            append_ticks(batch.text, current_ticks.bid, decimals);
+            batch.text.push_back(' ');
+            append_ticks(batch.text, current_ticks.ask, decimals);
+            batch.text.push_back('\n');
+            add_entry(static_cast<uint32_t>(slot), start, decimals, current_ticks.bid, current_ticks.ask, timestamp_ns);
+            newest_input_ns = std::max(newest_input_ns, timestamp_ns);
+            oldest_received_ns = std::min(oldest_received_ns, received_ns);
+            last = current_ticks;
+            formula_input_changed(program, slot, current_price, current_ticks);
+            return;
+        }
+
+        PriceData& last = last_slot_prices[slot];
+        if (last != current_price) {
+            size_t start = batch.text.size();
+            batch.text.append(shm->symbol(slot));
+            batch.text.push_back(' ');
+            append_fixed(batch.text, current_price.bid, RAW_PRICE_DIGITS);
+            batch.text.push_back(' ');
+            append_fixed(batch.text, current_price.ask, RAW_PRICE_DIGITS);
+            batch.text.push_back('\n');
+            add_entry(static_cast<uint32_t>(slot), start, RAW_PRICE_DIGITS,
+                      std::llround(current_price.bid * RAW_PRICE_SCALE),
+                      std::llround(current_price.ask * RAW_PRICE_SCALE), timestamp_ns);
+            newest_input_ns = std::max(newest_input_ns, timestamp_ns);
+            oldest_received_ns = std::min(oldest_received_ns, received_ns);
+            last = current_price;
+            formula_input_changed(program, slot, current_price);
+        }
+    };
+    if (!drain_updates(shm, update_cursor, check_slot)) {
+        // Fell behind the update ring: fall back to checking every slot
+        int count = shm->count.load(std::memory_order_acquire);
+        for (int i = 0; i < count; ++i) check_slot(i);
+    }
+
+    // Check and broadcast synthetic prices fed by the symbols that moved
+    const uint64_t evaluate_ns = wall_clock_ns();
+    const std::vector<uint32_t>& recomputed = recompute_formulas(program);
+    for (uint32_t id : recomputed) {
+        const SyntheticSymbol& synthetic = program.synthetics[id];
+        const uint32_t feed_id = formulas->feed_ids[id];
+
+        // Compare at the synthetic's precision, as whole ticks. Not quotable
+        // until every input symbol has reached shm.
+        PriceTicks quote;
+        if (!quote_synthetic(program, id, quote)) continue;
+        PriceTicks& last = formulas->last_quotes[feed_id - shm->capacity];
+        if (quote != last) {
+            size_t start = batch.text.size();
+            batch.text.append(synthetic.name);
+            batch.text.push_back(' ');
+            append_ticks(batch.text, quote.bid, synthetic.precision);
+            batch.text.push_back(' ');
+            append_ticks(batch.text, quote.ask, synthetic.precision);
+            batch.text.push_back('\n');
+            add_entry(feed_id, start, synthetic.precision, quote.bid, quote.ask, newest_input_ns);
+            last = quote;
+        }
+    }
+
+    uint64_t done_ns = wall_clock_ns();
+    if (!recomputed.empty()) stage_latency[STAGE_EVALUATE].record_between(evaluate_ns, done_ns);
+    total_ticks.fetch_add(ticks, std::memory_order_relaxed);
+    if (!batch.entries.empty()) {
+        batch.received_ns = oldest_received_ns == UINT64_MAX ? 0 : oldest_received_ns;
+        batch.collected_ns = done_ns;
+        stage_latency[STAGE_COLLECT].record_between(read_ns, done_ns);
+        total_quotes.fetch_add(batch.entries.size(), std::memory_order_relaxed);
+        total_batches.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// --- Multicast ---
+//
+// With MulticastGroup set, the broadcaster also sends every batch exactly
+// once as UDP datagrams, however many receivers listen (format in
+// wire_format.h). The last RetransmitPackets datagrams are kept so that a
+// receiver that notices a gap in the packet sequence can fetch what it
+// missed over its TCP connection.
+
+struct SentPacket {
+    uint64_t seq = 0;       // 0 while the slot is unused
+    uint16_t length = 0;
+    char data[(MULTICAST_RECORDS_PER_PACKET + 1) * WIRE_RECORD_SIZE];
 };
 
-std::unordered_map<std::string, SyntheticSymbol> synthetic_symbols;
-std::mutex synthetic_mutex;
+int multicast_fd = -1;
+uint64_t last_packet_seq = 0;           // broadcaster thread only
+std::atomic<uint64_t> multicast_send_errors{0}; // written by the broadcaster, read by STATS
 
-// --- Helper Functions ---
+// Packet seq goes to slot seq % size; guarded by retransmit_mutex
+std::mutex retransmit_mutex;
+std::vector<SentPacket> retransmit_ring;
 
-// Trim whitespace from a string
-std::string trim(const std::string& str) {
-    const std::string whitespace = " \t\n\r\f\v";
-    size_t start = str.find_first_not_of(whitespace);
-    if (std::string::npos == start) {
-        return str;
+// Open the sending socket for MulticastGroup. False if the settings are unusable.
+bool open_multicast(const ServerConfig& cfg) {
+    struct sockaddr_in group{};
+    group.sin_family = AF_INET;
+    size_t colon = cfg.multicast_group.rfind(':');
+    int port = 0;
+    try {
+        if (colon != std::string::npos) port = std::stoi(cfg.multicast_group.substr(colon + 1));
+    } catch (...) {}
+    if (colon == std::string::npos || port <= 0 || port > 65535 ||
+        inet_pton(AF_INET, cfg.multicast_group.substr(0, colon).c_str(), &group.sin_addr) != 1 ||
+        !IN_MULTICAST(ntohl(group.sin_addr.s_addr))) {
+        std::cerr << "Invalid MulticastGroup " << cfg.multicast_group << ", expected e.g. 239.255.0.1:5000\n";
+        return false;
+    }
+    group.sin_port = htons(port);
+
+    multicast_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (multicast_fd < 0) {
+        perror("multicast socket failed");
+        return false;
     }
-    size_t end = str.find_last_not_of(whitespace);
-    return str.substr(start, end - start + 1);
+    unsigned char ttl = static_cast<unsigned char>(cfg.multicast_ttl);
+    unsigned char loop = cfg.multicast_loopback ? 1 : 0;
+    setsockopt(multicast_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(multicast_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    if (!cfg.multicast_interface.empty()) {
+        struct in_addr interface_address{};
+        if (inet_pton(AF_INET, cfg.multicast_interface.c_str(), &interface_address) != 1 ||
+            setsockopt(multicast_fd, IPPROTO_IP, IP_MULTICAST_IF, &interface_address, sizeof(interface_address)) < 0) {
+            std::cerr << "Invalid MulticastInterface " << cfg.multicast_interface << "\n";
+            return false;
+        }
+    }
+    if (connect(multicast_fd, (struct sockaddr*)&group, sizeof(group)) < 0) {
+        perror("multicast connect failed");
+        return false;
+    }
+
+    retransmit_ring.resize(cfg.retransmit_packets);
+    return true;
 }
 
-// Find a symbol's index in shared memory
-int find_symbol_index(const std::string& symbol) {
-    if (!shm) return -1;
-    for (int i = 0; i < shm->count; ++i) {
-        if (strcmp(shm->symbols[i], symbol.c_str()) == 0) {
-            return i;
+// Send a batch's new dictionary entries and quotes as numbered datagrams,
+// keeping each one for retransmission. Records the last packet in the batch.
+void multicast_batch(Batch& batch) {
+    const size_t dictionary_records = batch.dictionary.size() / WIRE_RECORD_SIZE;
+    const size_t total = dictionary_records + batch.entries.size();
+
+    std::lock_guard<std::mutex> lock(retransmit_mutex);
+    for (size_t next = 0; next < total;) {
+        uint64_t seq = ++last_packet_seq;
+        SentPacket& packet = retransmit_ring[seq % retransmit_ring.size()];
+        size_t count = std::min(total - next, MULTICAST_RECORDS_PER_PACKET);
+
+        WirePacket header{};
+        header.type = WIRE_PACKET;
+        header.count = static_cast<uint16_t>(count);
+        header.seq = seq;
+        header.timestamp_ns = wall_clock_ns();
+        std::memcpy(packet.data, &header, sizeof(header));
+        for (size_t i = 1; i <= count; ++i, ++next) {
+            const char* record = next < dictionary_records
+                ? batch.dictionary.data() + next * WIRE_RECORD_SIZE
+                : batch.binary.data() + (next - dictionary_records) * WIRE_RECORD_SIZE;
+            std::memcpy(packet.data + i * WIRE_RECORD_SIZE, record, WIRE_RECORD_SIZE);
+        }
+        packet.seq = seq;
+        packet.length = static_cast<uint16_t>((count + 1) * WIRE_RECORD_SIZE);
+
+        // A lost datagram is recovered by the receivers, so just report it
+        if (send(multicast_fd, packet.data, packet.length, 0) < 0 && multicast_send_errors++ == 0) {
+            LOG_WARNING("Warning: multicast send failed: ", std::strerror(errno));
         }
     }
-    return -1;
+    batch.last_packet = last_packet_seq;
 }
 
-// Evaluate a formula using data from shared memory
-double evaluate_formula(const Formula& formula) {
-    if (formula.terms.empty()) {
-        return 0.0;
+// --- Client connections ---
+//
+// Terminals are served by ReactorThreads epoll loops. Each reactor owns its
+// connections outright and has its own SO_REUSEPORT listening socket, so the
+// kernel spreads new connections between them and no connection state is
+// shared across threads. The broadcaster hands each reactor the encoded
+// batch through an inbox and an eventfd.
+//
+// After "Access granted" a terminal gets a snapshot of every symbol's latest
+// quote, between "> Snapshot of N symbols" and "> End of snapshot" lines,
+// then every update until it sends its first subscription command. Each
+// reactor keeps the snapshot encoded in a shared image, rebuilt at most every
+// SnapshotRefreshMs (sooner once a quarter of the symbols have moved); a
+// snapshot is that image with the latest quote of each symbol that changed
+// since in place of its old one, so a burst of reconnects costs a copy each. Commands, one per line:
+//   SUB <symbol>...    add symbols; '*' and '?' are wildcards
+//   UNSUB <symbol>...  remove symbols; UNSUB * stops all updates
+//   BINARY             switch to the binary records of wire_format.h
+//   TEXT               switch back to lines
+//   SNAPSHOT           the connect-time snapshot again, in the current format
+//   RETRANSMIT <first> [<last>]  resend multicast packets (binary mode only),
+//                      as many as fit in MaxClientBufferBytes
+//   STATS              stage latencies, tick rates and client queues, between
+//                      "> Stats ..." and "> End of stats"
+// Wildcards also pick up symbols that first appear later. Each reactor keeps
+// a bitset of subscribed connections per symbol, so fanning out an update
+// only visits the terminals that asked for it.
+//
+// A client's unsent output is capped at MaxClientBufferBytes. Past that,
+// SlowClientPolicy decides what happens to its further updates, so one slow
+// terminal never holds up the others.
+
+enum class ClientState { LOGIN, PASSWORD, READY };
+
+// One bit per connection index
+typedef std::vector<uint64_t> SubscriberSet;
+
+struct ClientConnection {
+    int fd = -1;
+    uint32_t index = 0;         // bit in the reactor's subscriber sets
+    ClientState state = ClientState::LOGIN;
+    std::string input;          // received bytes not yet consumed as a line
+    std::string output;         // accepted for sending, not yet written
+    size_t output_sent = 0;     // prefix of output already written
+    bool want_write = false;    // EPOLLOUT armed
+    bool binary = false;        // wire_format.h records instead of text lines
+
+    bool subscribed = false;            // has sent SUB/UNSUB; until then gets everything
+    std::vector<std::string> patterns;  // SUB arguments still waiting for new symbols
+
+    // Conflation while the client is behind: feed ids with an update not
+    // yet sent. Once output drains, each feed's latest update goes out, in
+    // first-seen order.
+    std::unordered_set<uint32_t> conflated;
+    std::vector<uint32_t> conflated_order;
+
+    // Binary mode: feed ids whose dictionary record did not fit while the
+    // client was behind. They go out, latest record each, as soon as output
+    // drains, ahead of the conflated updates.
+    std::vector<uint32_t> owed_dictionaries;
+
+    // Fan-out bookkeeping for the batch being delivered
+    uint64_t batch_seq = 0;             // last batch this client took lines from
+    bool caught_up = false;             // had nothing pending when that batch arrived
+    bool closing = false;               // disconnect once the round is over
+
+    uint64_t conflated_updates = 0; // updates replaced before they were sent
+    uint64_t dropped_updates = 0;
+};
+
+// Totals across all connections since startup
+std::atomic<uint64_t> total_conflated_updates{0};
+std::atomic<uint64_t> total_dropped_updates{0};
+std::atomic<uint64_t> total_slow_disconnects{0};
+
+// What STATS reports about a logged-in connection. Each reactor copies these
+// out at most every STATS_REFRESH_MS so that other threads can read them.
+struct ClientStats {
+    int fd;
+    uint32_t reactor;
+    size_t queued_bytes;        // accepted for sending, not yet written
+    size_t conflated_symbols;   // waiting for their latest update
+    uint64_t conflated_updates;
+    uint64_t dropped_updates;
+};
+
+constexpr int STATS_REFRESH_MS = 1000;
+
+// A symbol a reactor has seen in at least one batch
+struct Feed {
+    std::string name;
+    std::string text;               // latest update line
+    std::string quote;              // latest update as a WireQuote
+    std::string dictionary;         // WireSymbol record naming it
+    SubscriberSet subscribers;
+    uint64_t updated_batch = 0;     // reactor batch that last changed it
+};
+
+// Every feed's latest update, encoded once for all snapshots
+struct SnapshotImage {
+    std::string text;
+    std::vector<size_t> text_offsets; // where each feed's line starts in text, then its end
+    std::string binary;             // per feed, its dictionary record then its quote
+    uint64_t batch_seq = 0;         // reactor batch the image is current to
+    std::chrono::steady_clock::time_point built;
+};
+
+struct Reactor {
+    uint32_t id = 0;
+    int epoll_fd = -1;
+    int listen_fd = -1;
+    int wake_fd = -1;           // eventfd the broadcaster signals
+    std::unordered_map<int, ClientConnection> connections;
+
+    std::vector<ClientConnection*> clients;    // by connection index, null when free
+    std::vector<uint32_t> free_indices;
+    SubscriberSet all_subscribers;             // logged in, no SUB/UNSUB yet
+
+    std::vector<Feed> feeds;
+    std::vector<uint32_t> feed_slots;          // feed id -> index in feeds + 1, 0 if unseen
+    std::unordered_map<std::string, uint32_t> feed_by_name;
+    uint64_t batch_seq = 0;
+    uint64_t packet_seq = 0;                   // multicast packet the feeds are current to
+
+    SnapshotImage image;
+    std::vector<uint32_t> changed_since_image; // indices in feeds updated after image.batch_seq
+
+    std::mutex inbox_mutex;
+    std::vector<std::shared_ptr<const Batch>> inbox;
+
+    std::mutex stats_mutex;
+    std::vector<ClientStats> client_stats;     // guarded by stats_mutex
+    std::chrono::steady_clock::time_point stats_refreshed;
+
+    // Scratch for deliver_batches, kept so delivery does not allocate
+    std::vector<std::shared_ptr<const Batch>> delivering;
+    std::vector<ClientConnection*> touched;
+    std::vector<int> gone;
+};
+
+std::vector<std::unique_ptr<Reactor>> reactors;
+
+// Longest line accepted from a terminal before it is dropped
+constexpr size_t MAX_CLIENT_LINE = 1024;
+
+const char BANNER[] = "Fake HFT DDE Server 1.0\nLogin:\n";
+const char PASSWORD_PROMPT[] = "Password:\n";
+const char ACCESS_GRANTED[] = "> Access granted\n";
+
+// Listening socket on port; host (e.g. INADDR_LOOPBACK) limits who can connect
+int open_listener(int port, in_addr_t host = INADDR_ANY) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket failed");
+        return -1;
     }
 
-    double result = 0.0;
-    
-    // Process the first term
-    const auto& first_term = formula.terms[0];
-    if (first_term.price_type == PriceType::CONSTANT) {
-        result = first_term.constant_value;
-    } else {
-        int idx = find_symbol_index(first_term.symbol_name);
-        if (idx == -1) return 0.0; // Symbol not found
-        result = (first_term.price_type == PriceType::BID) ? shm->prices[idx].bid : shm->prices[idx].ask;
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+
+    struct sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(host);
+    address.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("bind failed");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        perror("listen failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Set or clear one connection's bit. Returns whether the bit was set before.
+bool set_subscriber(SubscriberSet& set, uint32_t index, bool on) {
+    size_t word = index / 64;
+    uint64_t bit = uint64_t(1) << (index % 64);
+    if (word >= set.size()) {
+        if (!on) return false;
+        set.resize(word + 1, 0);
     }
+    bool was = (set[word] & bit) != 0;
+    if (on) set[word] |= bit;
+    else set[word] &= ~bit;
+    return was;
+}
 
-    // Process subsequent terms
-    for (size_t i = 1; i < formula.terms.size(); ++i) {
-        const auto& term = formula.terms[i];
-        double value = 0.0;
-        if (term.price_type == PriceType::CONSTANT) {
-            value = term.constant_value;
+// Shell-style match: '*' is any run of characters, '?' any one character
+bool glob_match(const char* pattern, const char* name) {
+    const char* star = nullptr;
+    const char* retry = nullptr;
+    while (*name) {
+        if (*pattern == '?' || (*pattern != '*' && *pattern == *name)) {
+            ++pattern;
+            ++name;
+        } else if (*pattern == '*') {
+            star = pattern++;
+            retry = name;
+        } else if (star) {
+            pattern = star + 1;
+            name = ++retry;
         } else {
-            int idx = find_symbol_index(term.symbol_name);
-            if (idx == -1) continue; // Skip if symbol not found
-            value = (term.price_type == PriceType::BID) ? shm->prices[idx].bid : shm->prices[idx].ask;
+            return false;
         }
+    }
+    while (*pattern == '*') ++pattern;
+    return *pattern == '\0';
+}
 
-        switch (term.op) {
-            case Operation::ADD:
-                result += value;
-                break;
-            case Operation::SUBTRACT:
-                result -= value;
-                break;
-            default:
-                break;
+// A server message line in the client's format. In binary mode it is split
+// across WireText records.
+std::string encode_message(const ClientConnection& conn, const std::string& line) {
+    if (!conn.binary) return line;
+    std::string out;
+    for (size_t pos = 0; pos < line.size();) {
+        WireText record{};
+        record.type = WIRE_TEXT;
+        record.length = static_cast<uint8_t>(std::min(line.size() - pos, sizeof(record.text)));
+        std::memcpy(record.text, line.data() + pos, record.length);
+        out.append(reinterpret_cast<const char*>(&record), sizeof(record));
+        pos += record.length;
+    }
+    return out;
+}
+
+// The latest update for a feed in the client's format
+const std::string& feed_update(const ClientConnection& conn, const Feed& feed) {
+    return conn.binary ? feed.quote : feed.text;
+}
+
+void close_client(Reactor& reactor, int fd) {
+    LOG_INFO("[Server] Client disconnected: ", fd);
+    auto it = reactor.connections.find(fd);
+    if (it != reactor.connections.end()) {
+        ClientConnection& conn = it->second;
+        if (conn.conflated_updates || conn.dropped_updates) {
+            LOG_INFO("[Server] Client ", fd, " was slow: ", conn.conflated_updates, " updates conflated, ",
+                     conn.dropped_updates, " updates dropped");
         }
+        set_subscriber(reactor.all_subscribers, conn.index, false);
+        for (auto& feed : reactor.feeds) set_subscriber(feed.subscribers, conn.index, false);
+        reactor.clients[conn.index] = nullptr;
+        reactor.free_indices.push_back(conn.index);
     }
-    return result;
+    epoll_ctl(reactor.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    reactor.connections.erase(fd);
 }
 
-// Load formulas from a config file
-void load_formulas_from_file(const std::string& filename) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cerr << "Warning: Could not open " << filename << ". No synthetic prices will be generated.\n";
+void set_want_write(Reactor& reactor, ClientConnection& conn, bool want) {
+    if (conn.want_write == want) return;
+    conn.want_write = want;
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | (want ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    ev.data.fd = conn.fd;
+    epoll_ctl(reactor.epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+}
+
+// Move the dictionary records owed to a binary client into output
+void release_dictionaries(Reactor& reactor, ClientConnection& conn) {
+    for (uint32_t feed_id : conn.owed_dictionaries) {
+        conn.output.append(reactor.feeds[reactor.feed_slots[feed_id] - 1].dictionary);
+    }
+    conn.owed_dictionaries.clear();
+}
+
+// Move the latest update of each conflated feed into output once it has drained
+void release_conflated(Reactor& reactor, ClientConnection& conn) {
+    for (uint32_t feed_id : conn.conflated_order) {
+        conn.output.append(feed_update(conn, reactor.feeds[reactor.feed_slots[feed_id] - 1]));
+    }
+    conn.conflated.clear();
+    conn.conflated_order.clear();
+}
+
+// Write as much pending output as the socket takes. False if the client is gone.
+bool flush_client(Reactor& reactor, ClientConnection& conn) {
+    for (;;) {
+        if (conn.output_sent == conn.output.size()) {
+            if (conn.owed_dictionaries.empty() && conn.conflated_order.empty()) break;
+            conn.output.clear();
+            conn.output_sent = 0;
+            release_dictionaries(reactor, conn);
+            release_conflated(reactor, conn);
+        }
+        ssize_t sent = send(conn.fd, conn.output.data() + conn.output_sent,
+                            conn.output.size() - conn.output_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        conn.output_sent += static_cast<size_t>(sent);
+    }
+
+    if (conn.output_sent == conn.output.size()) {
+        conn.output.clear();
+        conn.output_sent = 0;
+    } else if (conn.output_sent > conn.output.size() / 2) {
+        conn.output.erase(0, conn.output_sent);
+        conn.output_sent = 0;
+    }
+    set_want_write(reactor, conn, !conn.output.empty());
+    return true;
+}
+
+bool send_to_client(Reactor& reactor, ClientConnection& conn, const char* data, size_t len) {
+    conn.output.append(data, len);
+    return flush_client(reactor, conn);
+}
+
+bool send_message(Reactor& reactor, ClientConnection& conn, const std::string& line) {
+    conn.output.append(encode_message(conn, line));
+    return flush_client(reactor, conn);
+}
+
+// Apply one SUB or UNSUB argument. Symbols that become subscribed get their
+// latest quote right away. Returns how many known symbols matched.
+size_t apply_subscription(Reactor& reactor, ClientConnection& conn, const std::string& pattern, bool on) {
+    size_t matched = 0;
+    if (on) release_dictionaries(reactor, conn);
+    auto apply = [&](Feed& feed) {
+        matched++;
+        if (!set_subscriber(feed.subscribers, conn.index, on) && on) conn.output.append(feed_update(conn, feed));
+    };
+
+    bool wildcard = pattern.find_first_of("*?") != std::string::npos;
+    if (wildcard) {
+        for (auto& feed : reactor.feeds) {
+            if (glob_match(pattern.c_str(), feed.name.c_str())) apply(feed);
+        }
+    } else {
+        auto it = reactor.feed_by_name.find(pattern);
+        if (it != reactor.feed_by_name.end()) apply(reactor.feeds[it->second]);
+    }
+
+    auto& patterns = conn.patterns;
+    if (on) {
+        // Keep wildcards and not-yet-seen names for symbols that appear later
+        if ((wildcard || matched == 0) && std::find(patterns.begin(), patterns.end(), pattern) == patterns.end()) {
+            patterns.push_back(pattern);
+        }
+    } else {
+        patterns.erase(std::remove_if(patterns.begin(), patterns.end(), [&](const std::string& p) {
+            return glob_match(pattern.c_str(), p.c_str());
+        }), patterns.end());
+    }
+    return matched;
+}
+
+// Switch a client between text lines and binary records. Entering binary
+// mode sends the dictionary of every symbol seen so far.
+bool set_binary_mode(Reactor& reactor, ClientConnection& conn, bool binary) {
+    if (conn.binary == binary) return send_message(reactor, conn, binary ? "> Binary mode\n" : "> Text mode\n");
+
+    // Announce the switch in the format the client is leaving
+    conn.output.append(encode_message(conn, binary ? "> Binary mode\n" : "> Text mode\n"));
+    conn.binary = binary;
+    conn.owed_dictionaries.clear();
+    if (binary) {
+        for (const auto& feed : reactor.feeds) conn.output.append(feed.dictionary);
+    }
+    return flush_client(reactor, conn);
+}
+
+// Rebuild the reactor's snapshot image once it is too old or too much has
+// changed since it was built
+void refresh_snapshot_image(Reactor& reactor) {
+    SnapshotImage& image = reactor.image;
+    auto now = std::chrono::steady_clock::now();
+    if (reactor.changed_since_image.empty()) return;
+    if (now - image.built < std::chrono::milliseconds(config.snapshot_refresh_ms) &&
+        reactor.changed_since_image.size() * 4 < reactor.feeds.size()) {
         return;
     }
 
-    std::string line;
-    while (std::getline(file, line)) {
-        line = trim(line);
-        if (line.empty() || line[0] == '#') continue;
+    image.text.clear();
+    image.text_offsets.clear();
+    image.binary.clear();
+    for (const auto& feed : reactor.feeds) {
+        image.text_offsets.push_back(image.text.size());
+        image.text.append(feed.text);
+        image.binary.append(feed.dictionary);
+        image.binary.append(feed.quote);
+    }
+    image.text_offsets.push_back(image.text.size());
+    image.batch_seq = reactor.batch_seq;
+    image.built = now;
+    reactor.changed_since_image.clear();
+}
 
-        // Split at '='
-        size_t equals_pos = line.find('=');
-        if (equals_pos == std::string::npos) continue;
+// Queue every symbol's latest quote, whatever the client subscribed to. The
+// first line names the multicast packet the snapshot is current to, so a
+// receiver that lost its place applies only the packets after it. Symbols
+// that changed since the image was built are taken from their feeds in
+// place of their image entries, so each symbol appears once, in feed order.
+void append_snapshot(Reactor& reactor, ClientConnection& conn) {
+    refresh_snapshot_image(reactor);
+    release_dictionaries(reactor, conn);
+    const SnapshotImage& image = reactor.image;
 
-        std::string synth_name_part = trim(line.substr(0, equals_pos));
-        std::string formula_and_digits = trim(line.substr(equals_pos + 1));
-
-        // Extract digits if present
-        int precision = 5; // default
-        size_t digits_pos = formula_and_digits.find(", digits=");
-        std::string formula_str;
-        if (digits_pos != std::string::npos) {
-            formula_str = trim(formula_and_digits.substr(0, digits_pos));
-            std::string digits_str = trim(formula_and_digits.substr(digits_pos + 9));
-            try {
-                precision = std::stoi(digits_str);
-            } catch (...) {
-                std::cerr << "Warning: Invalid digits for " << synth_name_part << "\n";
+    std::string header = "> Snapshot of " + std::to_string(reactor.feeds.size()) + " symbols";
+    if (multicast_fd >= 0) header += " at packet " + std::to_string(reactor.packet_seq);
+    conn.output.append(encode_message(conn, header + "\n"));
+
+    const std::string& entries = conn.binary ? image.binary : image.text;
+    const size_t imaged = image.text_offsets.empty() ? 0 : image.text_offsets.size() - 1;
+    auto offset = [&](size_t index) { return conn.binary ? index * 2 * WIRE_RECORD_SIZE : image.text_offsets[index]; };
+    auto copy_image = [&](size_t from, size_t to) { conn.output.append(entries, offset(from), offset(to) - offset(from)); };
+
+    std::vector<uint32_t>& changed = reactor.changed_since_image;
+    std::sort(changed.begin(), changed.end());
+    size_t next = 0;    // first image entry not yet copied or replaced
+    for (uint32_t index : changed) {
+        size_t until = std::min<size_t>(index, imaged);
+        if (next < until) copy_image(next, until);
+        next = std::max(next, std::min<size_t>(index + 1, imaged));
+        const Feed& feed = reactor.feeds[index];
+        if (conn.binary) conn.output.append(feed.dictionary);
+        conn.output.append(feed_update(conn, feed));
+    }
+    if (next < imaged) copy_image(next, imaged);
+    conn.output.append(encode_message(conn, "> End of snapshot\n"));
+}
+
+// Resend multicast packets first..last as sent, followed by a reply line.
+// Stops at the first packet that has left the retransmit buffer, or that
+// would take the client's output past MaxClientBufferBytes: a receiver that
+// far behind resyncs with SNAPSHOT instead.
+bool retransmit_packets(Reactor& reactor, ClientConnection& conn, uint64_t first, uint64_t last) {
+    if (multicast_fd < 0) return send_message(reactor, conn, "> Multicast is not enabled\n");
+    if (!conn.binary) return send_message(reactor, conn, "> RETRANSMIT needs BINARY mode\n");
+
+    size_t pending = conn.output.size() - conn.output_sent;
+    size_t room = pending < config.max_client_buffer ? config.max_client_buffer - pending : 0;
+    uint64_t seq = first;
+    bool full = false;
+    {
+        std::lock_guard<std::mutex> lock(retransmit_mutex);
+        for (; seq <= last; ++seq) {
+            const SentPacket& packet = retransmit_ring[seq % retransmit_ring.size()];
+            if (packet.seq != seq) break;
+            if (packet.length > room) {
+                full = true;
+                break;
             }
+            conn.output.append(packet.data, packet.length);
+            room -= packet.length;
+        }
+    }
+    if (full) {
+        return send_message(reactor, conn, "> Packets from " + std::to_string(seq) +
+                                               " do not fit in the client buffer, send SNAPSHOT\n");
+    }
+    if (seq <= last) {
+        return send_message(reactor, conn, "> Packet " + std::to_string(seq) + " is not available, send SNAPSHOT\n");
+    }
+    return send_message(reactor, conn, "> Retransmitted packets " + std::to_string(first) + " to " + std::to_string(last) + "\n");
+}
+
+// Copy this reactor's connections into client_stats for STATS
+void refresh_client_stats(Reactor& reactor) {
+    std::lock_guard<std::mutex> lock(reactor.stats_mutex);
+    reactor.client_stats.clear();
+    for (const auto& entry : reactor.connections) {
+        const ClientConnection& conn = entry.second;
+        if (conn.state != ClientState::READY) continue;
+        reactor.client_stats.push_back({conn.fd, reactor.id, conn.output.size() - conn.output_sent,
+                                        conn.conflated_order.size(), conn.conflated_updates, conn.dropped_updates});
+    }
+    reactor.stats_refreshed = std::chrono::steady_clock::now();
+}
+
+// Append nanoseconds as microseconds with one decimal
+void append_us(std::string& out, uint64_t ns) {
+    append_fixed(out, ns / 1000.0, 1);
+}
+
+// The STATS report, one "> " line each
+std::string stats_report() {
+    auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started_at);
+    std::string out = "> Stats after " + std::to_string(uptime.count()) + " s\n";
+    out += "> Per second: " + std::to_string(ticks_per_second.load()) + " ticks, " +
+           std::to_string(quotes_per_second.load()) + " quotes, " + std::to_string(batches_per_second.load()) +
+           " batches\n";
+    out += "> Totals: " + std::to_string(total_ticks.load()) + " ticks, " + std::to_string(total_quotes.load()) +
+           " quotes, " + std::to_string(total_batches.load()) + " batches, " +
+           std::to_string(total_conflated_updates.load()) + " conflated, " +
+           std::to_string(total_dropped_updates.load()) + " dropped, " +
+           std::to_string(total_slow_disconnects.load()) + " slow disconnects, " +
+           std::to_string(multicast_send_errors.load()) + " multicast send errors\n";
+
+    out += "> Latency in us: stage count mean p50 p90 p99 p99.9 max\n";
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        LatencySummary summary = stage_latency[stage].summarize();
+        out += "> ";
+        out += STAGE_NAMES[stage];
+        out += " " + std::to_string(summary.count);
+        for (uint64_t ns : {summary.mean, summary.p50, summary.p90, summary.p99, summary.p999, summary.max}) {
+            out.push_back(' ');
+            append_us(out, ns);
+        }
+        out.push_back('\n');
+    }
+
+    std::vector<ClientStats> clients;
+    for (const auto& reactor : reactors) {
+        std::lock_guard<std::mutex> lock(reactor->stats_mutex);
+        clients.insert(clients.end(), reactor->client_stats.begin(), reactor->client_stats.end());
+    }
+    out += "> Clients: " + std::to_string(clients.size()) + "\n";
+    for (const ClientStats& client : clients) {
+        out += "> Client " + std::to_string(client.fd) + " on reactor " + std::to_string(client.reactor) + ": " +
+               std::to_string(client.queued_bytes) + " bytes queued, " + std::to_string(client.conflated_symbols) +
+               " symbols pending, " + std::to_string(client.conflated_updates) + " updates conflated, " +
+               std::to_string(client.dropped_updates) + " dropped\n";
+    }
+    out += "> End of stats\n";
+    return out;
+}
+
+// Commands from a logged-in terminal
+bool handle_client_command(Reactor& reactor, ClientConnection& conn, const std::string& line) {
+    std::istringstream words(line);
+    std::string command;
+    if (!(words >> command)) return true;
+    std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+
+    if (command == "BINARY" || command == "TEXT") return set_binary_mode(reactor, conn, command == "BINARY");
+    if (command == "SNAPSHOT") {
+        append_snapshot(reactor, conn);
+        return flush_client(reactor, conn);
+    }
+    if (command == "STATS") {
+        refresh_client_stats(reactor);
+        std::string report = stats_report();
+        for (size_t pos = 0, end; (end = report.find('\n', pos)) != std::string::npos; pos = end + 1) {
+            conn.output.append(encode_message(conn, report.substr(pos, end + 1 - pos)));
+        }
+        return flush_client(reactor, conn);
+    }
+    if (command == "RETRANSMIT") {
+        uint64_t first = 0, last = 0;
+        if (!(words >> first) || first == 0) return send_message(reactor, conn, "> Usage: RETRANSMIT <first> [<last>]\n");
+        if (!(words >> last)) last = first;
+        if (last < first) return send_message(reactor, conn, "> Usage: RETRANSMIT <first> [<last>]\n");
+        return retransmit_packets(reactor, conn, first, last);
+    }
+    if (command != "SUB" && command != "UNSUB") return send_message(reactor, conn, "> Unknown command: " + command + "\n");
+    bool on = command == "SUB";
+
+    std::vector<std::string> symbols;
+    for (std::string symbol; words >> symbol;) symbols.push_back(symbol);
+    if (symbols.empty()) return send_message(reactor, conn, "> Usage: " + command + " <symbol>...\n");
+
+    // The first command ends the implicit subscription to everything; an
+    // UNSUB first means "everything except these"
+    if (!conn.subscribed) {
+        conn.subscribed = true;
+        set_subscriber(reactor.all_subscribers, conn.index, false);
+        if (!on) {
+            for (auto& feed : reactor.feeds) set_subscriber(feed.subscribers, conn.index, true);
+            conn.patterns.push_back("*");
+        }
+    }
+
+    // The reply goes ahead of any quotes a new subscription sends
+    size_t reply_at = conn.output.size();
+    size_t matched = 0;
+    for (const auto& symbol : symbols) matched += apply_subscription(reactor, conn, symbol, on);
+
+    std::string reply = on ? "> Subscribed to " : "> Unsubscribed from ";
+    reply += std::to_string(matched) + (matched == 1 ? " symbol\n" : " symbols\n");
+    conn.output.insert(reply_at, encode_message(conn, reply));
+    return flush_client(reactor, conn);
+}
+
+// Advance the Login/Password handshake by one line; after that, lines are
+// subscription commands
+bool handle_client_line(Reactor& reactor, ClientConnection& conn, const std::string& line) {
+    switch (conn.state) {
+        case ClientState::LOGIN:    // credentials are not checked
+            conn.state = ClientState::PASSWORD;
+            return send_to_client(reactor, conn, PASSWORD_PROMPT, sizeof(PASSWORD_PROMPT) - 1);
+        case ClientState::PASSWORD:
+            conn.state = ClientState::READY;
+            set_subscriber(reactor.all_subscribers, conn.index, true);
+            conn.output.append(ACCESS_GRANTED, sizeof(ACCESS_GRANTED) - 1);
+            append_snapshot(reactor, conn);
+            return flush_client(reactor, conn);
+        case ClientState::READY:
+            return handle_client_command(reactor, conn, line);
+    }
+    return true;
+}
+
+// Drain the socket and process complete lines. False if the client is gone.
+bool read_client(Reactor& reactor, ClientConnection& conn) {
+    char buffer[4096];
+    for (;;) {
+        ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (n == 0) return false;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn.input.append(buffer, static_cast<size_t>(n));
+
+        size_t start = 0, newline;
+        while ((newline = conn.input.find('\n', start)) != std::string::npos) {
+            if (!handle_client_line(reactor, conn, trim(conn.input.substr(start, newline - start)))) return false;
+            start = newline + 1;
+        }
+        conn.input.erase(0, start);
+        if (conn.input.size() > MAX_CLIENT_LINE) return false;
+    }
+}
+
+void accept_clients(Reactor& reactor) {
+    for (;;) {
+        int fd = accept4(reactor.listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) LOG_ERROR("accept: ", std::strerror(errno));
+            return;
+        }
+        LOG_INFO("New client connected: ", fd);
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        ClientConnection& conn = reactor.connections[fd];
+        conn.fd = fd;
+        if (reactor.free_indices.empty()) {
+            conn.index = static_cast<uint32_t>(reactor.clients.size());
+            reactor.clients.push_back(&conn);
         } else {
-            formula_str = formula_and_digits;
-        }
-
-        // Extract bid/ask from name
-        std::string synth_base_name;
-        std::string price_type_str;
-        size_t last_underscore = synth_name_part.find_last_of('_');
-        if (last_underscore != std::string::npos) {
-            synth_base_name = synth_name_part.substr(0, last_underscore);
-            price_type_str = synth_name_part.substr(last_underscore + 1);
-        } else continue;
-
-        // Parse formula terms
-        Formula current_formula;
-        std::stringstream formula_ss(formula_str);
-        std::string term_str;
-        while (formula_ss >> term_str) {
-            FormulaTerm term;
-            term.op = Operation::NONE;
-
-            if (term_str == "+") {
-                term.op = Operation::ADD;
-                formula_ss >> term_str;
-            } else if (term_str == "-") {
-                term.op = Operation::SUBTRACT;
-                formula_ss >> term_str;
+            conn.index = reactor.free_indices.back();
+            reactor.free_indices.pop_back();
+            reactor.clients[conn.index] = &conn;
+        }
+
+        struct epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+
+        if (!send_to_client(reactor, conn, BANNER, sizeof(BANNER) - 1)) close_client(reactor, fd);
+    }
+}
+
+// Note that conn takes output from the batch being delivered, so that it is
+// flushed once all of them are. first_batch is the round's first batch.
+void touch_client(Reactor& reactor, ClientConnection& conn, uint64_t first_batch) {
+    if (conn.batch_seq == reactor.batch_seq) return;
+    if (conn.batch_seq < first_batch) reactor.touched.push_back(&conn);
+    conn.batch_seq = reactor.batch_seq;
+    conn.caught_up = conn.output_sent == conn.output.size() && conn.owed_dictionaries.empty() &&
+                     conn.conflated_order.empty();
+}
+
+// Add a feed's dictionary record to a binary client's output. Past
+// MaxClientBufferBytes it is owed instead, and updates wait behind it under
+// SlowClientPolicy; a record is never dropped, as later quotes need it.
+// False if the client has to be disconnected.
+bool queue_dictionary(ClientConnection& conn, uint32_t feed_id, const std::string& record) {
+    size_t pending = conn.output.size() - conn.output_sent;
+    if (conn.owed_dictionaries.empty() && conn.conflated_order.empty() &&
+        (conn.caught_up || pending + record.size() <= config.max_client_buffer)) {
+        conn.output.append(record);
+        return true;
+    }
+    if (config.slow_client_policy == SlowClientPolicy::DISCONNECT) {
+        total_slow_disconnects++;
+        LOG_INFO("[Server] Client ", conn.fd, " is too slow, disconnecting");
+        return false;
+    }
+    auto& owed = conn.owed_dictionaries;
+    if (std::find(owed.begin(), owed.end(), feed_id) == owed.end()) owed.push_back(feed_id);
+    return true;
+}
+
+// The reactor's Feed for the i-th entry of a batch. A symbol seen for the
+// first time is registered, announced to binary clients and picked up by
+// matching SUB patterns.
+Feed& learn_feed(Reactor& reactor, const Batch& batch, size_t i, uint64_t first_batch) {
+    const Batch::Entry& entry = batch.entries[i];
+    if (entry.feed_id < reactor.feed_slots.size() && reactor.feed_slots[entry.feed_id]) {
+        return reactor.feeds[reactor.feed_slots[entry.feed_id] - 1];
+    }
+    if (entry.feed_id >= reactor.feed_slots.size()) reactor.feed_slots.resize(entry.feed_id + 1, 0);
+
+    const char* line = batch.text.data() + entry.offset;
+    uint32_t index = static_cast<uint32_t>(reactor.feeds.size());
+    reactor.feeds.emplace_back();
+    Feed& feed = reactor.feeds.back();
+    feed.name.assign(line, std::find(line, line + entry.length, ' ') - line);
+    reactor.feed_slots[entry.feed_id] = index + 1;
+    reactor.feed_by_name[feed.name] = index;
+
+    WireQuote quote;
+    std::memcpy(&quote, batch.binary.data() + i * sizeof(WireQuote), sizeof(quote));
+    WireSymbol symbol{};
+    symbol.type = WIRE_SYMBOL;
+    symbol.exponent = quote.exponent;
+    symbol.symbol_id = entry.feed_id;
+    std::memcpy(symbol.name, feed.name.data(), std::min(feed.name.size(), sizeof(symbol.name)));
+    feed.dictionary.assign(reinterpret_cast<const char*>(&symbol), sizeof(symbol));
+
+    for (ClientConnection* conn : reactor.clients) {
+        if (!conn) continue;
+        if (conn->binary) {
+            touch_client(reactor, *conn, first_batch);
+            if (!conn->closing && !queue_dictionary(*conn, entry.feed_id, feed.dictionary)) conn->closing = true;
+        }
+        for (const auto& pattern : conn->patterns) {
+            if (glob_match(pattern.c_str(), feed.name.c_str())) {
+                set_subscriber(feed.subscribers, conn->index, true);
+                break;
+            }
+        }
+    }
+    return feed;
+}
+
+// A reload gave the feed id of a removed synthetic to a new name.
+// Subscriptions follow names: a terminal subscribed to the old name keeps it
+// as a pattern for when it comes back, and the feed's subscribers become the
+// terminals whose patterns match the new name.
+void rename_feed(Reactor& reactor, uint32_t index, const std::string& name) {
+    Feed& feed = reactor.feeds[index];
+    auto named = reactor.feed_by_name.find(feed.name);
+    if (named != reactor.feed_by_name.end() && named->second == index) reactor.feed_by_name.erase(named);
+    for (ClientConnection* conn : reactor.clients) {
+        if (!conn) continue;
+        auto& patterns = conn->patterns;
+        auto matches = [&](const std::string& symbol) {
+            return std::any_of(patterns.begin(), patterns.end(), [&](const std::string& pattern) {
+                return glob_match(pattern.c_str(), symbol.c_str());
+            });
+        };
+        bool was = set_subscriber(feed.subscribers, conn->index, false);
+        if (was && !matches(feed.name)) patterns.push_back(feed.name);
+        if (matches(name)) set_subscriber(feed.subscribers, conn->index, true);
+    }
+    feed.name = name;
+    reactor.feed_by_name[name] = index;
+}
+
+// A batch announces a feed the reactor already knows again when its
+// exponent changed (a reload changed a synthetic's digits=) or its id went
+// to another synthetic: replace the feed's dictionary record, and name, and
+// send it to binary clients ahead of the quotes that use it.
+void reannounce_feeds(Reactor& reactor, const Batch& batch, uint64_t first_batch) {
+    for (size_t offset = 0; offset < batch.dictionary.size(); offset += sizeof(WireSymbol)) {
+        WireSymbol symbol;
+        std::memcpy(&symbol, batch.dictionary.data() + offset, sizeof(symbol));
+        if (symbol.symbol_id >= reactor.feed_slots.size() || !reactor.feed_slots[symbol.symbol_id]) continue;
+        uint32_t index = reactor.feed_slots[symbol.symbol_id] - 1;
+        Feed& feed = reactor.feeds[index];
+
+        // The record's name may be cut short; the update line has all of it
+        for (const Batch::Entry& entry : batch.entries) {
+            if (entry.feed_id != symbol.symbol_id) continue;
+            const char* line = batch.text.data() + entry.offset;
+            std::string name(line, std::find(line, line + entry.length, ' ') - line);
+            if (name != feed.name) rename_feed(reactor, index, name);
+            break;
+        }
+        feed.dictionary.assign(reinterpret_cast<const char*>(&symbol), sizeof(symbol));
+        for (ClientConnection* conn : reactor.clients) {
+            if (!conn || !conn->binary) continue;
+            touch_client(reactor, *conn, first_batch);
+            if (!conn->closing && !queue_dictionary(*conn, symbol.symbol_id, feed.dictionary)) conn->closing = true;
+        }
+    }
+}
+
+// Add one update to a client's output, applying SlowClientPolicy once it no
+// longer fits. A client that was caught up when the batch arrived takes all
+// of it, however large. False if the client has to be disconnected.
+bool queue_update(ClientConnection& conn, uint32_t feed_id, const std::string& update) {
+    size_t pending = conn.output.size() - conn.output_sent;
+    if (conn.owed_dictionaries.empty() && conn.conflated_order.empty() &&
+        (conn.caught_up || pending + update.size() <= config.max_client_buffer)) {
+        conn.output.append(update);
+        return true;
+    }
+
+    switch (config.slow_client_policy) {
+        case SlowClientPolicy::DISCONNECT:
+            total_slow_disconnects++;
+            LOG_INFO("[Server] Client ", conn.fd, " is too slow, disconnecting");
+            return false;
+        case SlowClientPolicy::DROP:
+            conn.dropped_updates++;
+            total_dropped_updates++;
+            return true;
+        case SlowClientPolicy::CONFLATE:
+            if (conn.conflated.insert(feed_id).second) {
+                conn.conflated_order.push_back(feed_id);
             } else {
-                term.op = Operation::ADD; // first term
+                conn.conflated_updates++;
+                total_conflated_updates++;
             }
+            return true;
+    }
+    return true;
+}
+
+// Fan every batch the broadcaster handed us out to the subscribed clients
+void deliver_batches(Reactor& reactor) {
+    uint64_t signals;
+    while (read(reactor.wake_fd, &signals, sizeof(signals)) > 0) {}
+
+    auto& batches = reactor.delivering;
+    {
+        std::lock_guard<std::mutex> lock(reactor.inbox_mutex);
+        batches.swap(reactor.inbox);
+    }
 
-            size_t last_dot = term_str.rfind('.');
-            if (last_dot != std::string::npos) {
-                std::string type = term_str.substr(last_dot + 1);
-                if (type == "bid" || type == "ask") {
-                    term.symbol_name = term_str.substr(0, last_dot);
-                    term.price_type = (type == "bid") ? PriceType::BID : PriceType::ASK;
-                } else {
-                    try {
-                        term.constant_value = std::stod(term_str);
-                        term.price_type = PriceType::CONSTANT;
-                    } catch (...) { continue; }
+    const uint64_t first_batch = reactor.batch_seq + 1;
+    auto& touched = reactor.touched;
+    for (const auto& batch : batches) {
+        const uint64_t seq = ++reactor.batch_seq;
+        reactor.packet_seq = batch->last_packet;
+        if (!batch->dictionary.empty()) reannounce_feeds(reactor, *batch, first_batch);
+        for (size_t i = 0; i < batch->entries.size(); ++i) {
+            const Batch::Entry& entry = batch->entries[i];
+            Feed& feed = learn_feed(reactor, *batch, i, first_batch);
+            feed.text.assign(batch->text, entry.offset, entry.length);
+            feed.quote.assign(batch->binary, i * sizeof(WireQuote), sizeof(WireQuote));
+            if (feed.updated_batch <= reactor.image.batch_seq) {
+                reactor.changed_since_image.push_back(reactor.feed_slots[entry.feed_id] - 1);
+            }
+            feed.updated_batch = seq;
+
+            const SubscriberSet& some = feed.subscribers;
+            const SubscriberSet& all = reactor.all_subscribers;
+            size_t words = std::max(some.size(), all.size());
+            for (size_t w = 0; w < words; ++w) {
+                uint64_t bits = (w < some.size() ? some[w] : 0) | (w < all.size() ? all[w] : 0);
+                while (bits) {
+                    ClientConnection& conn = *reactor.clients[w * 64 + __builtin_ctzll(bits)];
+                    bits &= bits - 1;
+                    touch_client(reactor, conn, first_batch);
+                    if (!conn.closing && !queue_update(conn, entry.feed_id, feed_update(conn, feed))) conn.closing = true;
                 }
-            } else {
-                try {
-                    term.constant_value = std::stod(term_str);
-                    term.price_type = PriceType::CONSTANT;
-                } catch (...) { continue; }
             }
-            current_formula.terms.push_back(term);
         }
+    }
 
-        // Save formula and precision
-        std::lock_guard<std::mutex> lock(synthetic_mutex);
-        if (price_type_str == "bid") {
-            synthetic_symbols[synth_base_name].bid_formula = current_formula;
-            synthetic_symbols[synth_base_name].precision = precision;
-        } else if (price_type_str == "ask") {
-            synthetic_symbols[synth_base_name].ask_formula = current_formula;
-            synthetic_symbols[synth_base_name].precision = precision;
+    auto& gone = reactor.gone;
+    for (ClientConnection* conn : touched) {
+        if (conn->closing || !flush_client(reactor, *conn)) gone.push_back(conn->fd);
+    }
+    if (!touched.empty()) {
+        uint64_t sent_ns = wall_clock_ns();
+        for (const auto& batch : batches) {
+            stage_latency[STAGE_SEND].record_between(batch->collected_ns, sent_ns);
+            if (batch->received_ns) stage_latency[STAGE_TOTAL].record_between(batch->received_ns, sent_ns);
         }
     }
-    std::cout << "Loaded " << synthetic_symbols.size() << " synthetic symbol formulas.\n";
+    touched.clear();
+    batches.clear(); // lets the broadcaster recycle them
+    for (int fd : gone) close_client(reactor, fd);
+    gone.clear();
 }
 
-// Global variable and mutex for last known prices
-std::unordered_map<std::string, PriceData> last_prices;
-std::mutex last_prices_mutex;
+void run_reactor(Reactor& reactor) {
+    struct epoll_event events[256];
+    while (true) {
+        int n = epoll_wait(reactor.epoll_fd, events, 256, STATS_REFRESH_MS);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("epoll_wait: ", std::strerror(errno));
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == reactor.listen_fd) {
+                accept_clients(reactor);
+                continue;
+            }
+            if (fd == reactor.wake_fd) {
+                deliver_batches(reactor);
+                continue;
+            }
+
+            auto it = reactor.connections.find(fd);
+            if (it == reactor.connections.end()) continue;
+            ClientConnection& conn = it->second;
+            bool alive = !(events[i].events & EPOLLERR);
+            if (alive && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) alive = read_client(reactor, conn);
+            if (alive && (events[i].events & EPOLLOUT)) alive = flush_client(reactor, conn);
+            if (alive && (events[i].events & EPOLLHUP)) alive = false;
+            if (!alive) close_client(reactor, fd);
+        }
+        if (std::chrono::steady_clock::now() - reactor.stats_refreshed >= std::chrono::milliseconds(STATS_REFRESH_MS)) {
+            refresh_client_stats(reactor);
+        }
+    }
+}
+
+bool start_reactor(Reactor& reactor, int port) {
+    reactor.listen_fd = open_listener(port);
+    reactor.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    reactor.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor.listen_fd < 0 || reactor.epoll_fd < 0 || reactor.wake_fd < 0) return false;
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = reactor.listen_fd;
+    epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, reactor.listen_fd, &ev);
+    ev.data.fd = reactor.wake_fd;
+    epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, reactor.wake_fd, &ev);
+    return true;
+}
+
+// Answer every connection to 127.0.0.1:StatsPort with the STATS report, then
+// hang up, so monitoring does not need to log in
+void serve_stats(int listen_fd) {
+    while (true) {
+        struct pollfd ready = {listen_fd, POLLIN, 0};
+        if (poll(&ready, 1, -1) < 0 && errno != EINTR) {
+            LOG_ERROR("poll: ", std::strerror(errno));
+            return;
+        }
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+
+        // A reader that stops reading does not hold up the next one for long
+        struct timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        std::string report = stats_report();
+        for (size_t sent = 0; sent < report.size();) {
+            ssize_t n = send(fd, report.data() + sent, report.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += static_cast<size_t>(n);
+        }
+        close(fd);
+    }
+}
+
+// Hand one encoded batch to every reactor
+void publish_batch(std::shared_ptr<const Batch> batch) {
+    for (auto& reactor : reactors) {
+        {
+            std::lock_guard<std::mutex> lock(reactor->inbox_mutex);
+            reactor->inbox.push_back(batch);
+        }
+        uint64_t one = 1;
+        if (write(reactor->wake_fd, &one, sizeof(one)) < 0) {
+            // Counter saturated; the reactor is awake anyway
+        }
+    }
+}
+
+// Batches the broadcaster has handed out. One that no reactor still holds is
+// emptied and reused, so steady-state broadcasting reuses grown buffers
+// instead of allocating a batch per cycle.
+std::vector<std::shared_ptr<Batch>> batch_pool;
+
+std::shared_ptr<Batch> acquire_batch() {
+    for (auto& batch : batch_pool) {
+        if (batch.use_count() == 1) {
+            // Pairs with the release of the reactors' last reference
+            std::atomic_thread_fence(std::memory_order_acquire);
+            batch->clear();
+            return batch;
+        }
+    }
+    batch_pool.push_back(std::make_shared<Batch>());
+    return batch_pool.back();
+}
+
+// One broadcaster cycle: collect what changed and hand it out. Returns the
+// batch, which is empty if nothing changed.
+std::shared_ptr<Batch> broadcast_cycle() {
+    std::shared_ptr<Batch> batch = acquire_batch();
+    collect_price_updates(*batch);
+    update_rates();
+
+    // Only broadcast if there's new data
+    if (!batch->entries.empty()) {
+        if (multicast_fd >= 0) multicast_batch(*batch);
+        publish_batch(batch);
+    }
+    return batch;
+}
 
 void broadcast_prices() {
+    const auto min_interval = std::chrono::microseconds(config.min_publish_interval_us);
+    std::chrono::steady_clock::time_point last_publish;
+
     while (true) {
         if (!shm) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
             continue;
         }
 
-        std::stringstream ss;
-        std::lock_guard<std::mutex> last_prices_lock(last_prices_mutex);
-        
-        // Check and broadcast raw prices from shared memory if they've changed
-        for (int i = 0; i < shm->count; ++i) {
-            std::string symbol_name = shm->symbols[i];
-            PriceData current_price = shm->prices[i];
-            
-            if (last_prices.find(symbol_name) == last_prices.end() || last_prices[symbol_name] != current_price) {
-                ss << std::fixed << std::setprecision(5)
-                   << symbol_name << " "
-                   << current_price.bid << " "
-                   << current_price.ask << "\n";
-                last_prices[symbol_name] = current_price;
-            }
+        // Wait for the producer to publish something we have not seen.
+        // Only this thread advances update_cursor, so reading it unlocked is fine.
+        if (config.busy_spin) spin_for_updates(shm, update_cursor, IDLE_WAIT_NS);
+        else wait_for_updates(shm_control, update_cursor, IDLE_WAIT_NS);
+
+        // Coalesce: anything arriving before the interval ends joins this batch
+        if (min_interval.count() > 0) {
+            std::this_thread::sleep_until(last_publish + min_interval);
         }
-        
-        // Check and broadcast calculated synthetic prices if they've changed
-        std::lock_guard<std::mutex> synthetic_lock(synthetic_mutex);
-        for (const auto& pair : synthetic_symbols) {
-            std::string symbol_name = pair.first;
-            PriceData current_price;
-            current_price.bid = evaluate_formula(pair.second.bid_formula);
-            current_price.ask = evaluate_formula(pair.second.ask_formula);
-
-            // Using stringstream to round the values for comparison
-            std::stringstream bid_ss, ask_ss;
-            bid_ss << std::fixed << std::setprecision(pair.second.precision) << current_price.bid;
-            ask_ss << std::fixed << std::setprecision(pair.second.precision) << current_price.ask;
-            double rounded_bid = std::stod(bid_ss.str());
-            double rounded_ask = std::stod(ask_ss.str());
-
-            PriceData rounded_current_price = {rounded_bid, rounded_ask};
-
-            if (last_prices.find(symbol_name) == last_prices.end() || last_prices[symbol_name] != rounded_current_price) {
-                ss << std::fixed << std::setprecision(pair.second.precision)
-                   << symbol_name << " " << rounded_current_price.bid << " " << rounded_current_price.ask << "\n";
-                last_prices[symbol_name] = rounded_current_price;
-            }
+
+        if (!broadcast_cycle()->entries.empty()) {
+            last_publish = std::chrono::steady_clock::now();
         }
-        
-        std::string data = ss.str();
-        
-        // Only broadcast if there's new data
-        if (!data.empty()) {
-            std::lock_guard<std::mutex> clients_lock(clients_mutex);
-            for (auto it = clients.begin(); it != clients.end();) {
-                ssize_t sent = send(*it, data.c_str(), data.size(), MSG_NOSIGNAL);
-                if (sent <= 0) {
-                    if (errno != EWOULDBLOCK && errno != EAGAIN) {
-                        std::cout << "[Server] Client disconnected: " << *it << std::endl;
-                        close(*it);
-                        it = clients.erase(it);
-                        continue;
-                    }
+    }
+}
+
+// --- Formula reload ---
+//
+// With FormulasReload=yes a thread watches formulas.cfg and recompiles it each
+// time it is saved, including by editors that write a new file and rename it
+// over the old one. The new set is compiled on that thread and published
+// through pending_formulas; the broadcaster switches to it at the start of
+// its next cycle with one atomic exchange, so a reload never makes it wait.
+// Synthetics whose quote did not change are not sent again, one whose
+// digits= changed keeps its feed id and is announced again with the new
+// exponent, and a removed synthetic simply stops updating; its feed id is
+// given to the next new synthetic, which is announced under it with its own
+// name. Symbols the producer does not subscribe to yet stay missing until it
+// is restarted.
+
+const char* const FORMULAS_FILE = "formulas.cfg";
+
+// Quiet time after the last change to formulas.cfg before it is read, so
+// that a file written in several steps is compiled once, complete
+constexpr int RELOAD_SETTLE_MS = 100;
+
+// Stable index per synthetic name in the last set compiled. Used by main
+// before the reload thread starts, then by that thread only.
+std::unordered_map<std::string, uint32_t> synthetic_indexes;
+
+// Compile filename into a new set for the configured kernel. Null if the
+// file cannot be opened. Names already known keep their index; new names
+// take the lowest index no synthetic of the set holds, so a rename reuses
+// the removed name's index instead of growing every feed id array.
+FormulaSet* compile_formulas(const std::string& filename) {
+    std::unique_ptr<FormulaSet> set(new FormulaSet());
+    if (!load_formulas_from_file(filename, set->program)) {
+        return nullptr;
+    }
+    set->program.kernel = config.formula_kernel;
+    const auto& synthetics = set->program.synthetics;
+
+    std::unordered_map<std::string, uint32_t> indexes;
+    std::vector<int32_t>& synthetic_at = set->synthetic_at;
+    auto take = [&](uint32_t id, uint32_t index) {
+        indexes.emplace(synthetics[id].name, index);
+        if (index >= synthetic_at.size()) synthetic_at.resize(index + 1, -1);
+        synthetic_at[index] = static_cast<int32_t>(id);
+    };
+    for (uint32_t id = 0; id < synthetics.size(); ++id) {
+        auto known = synthetic_indexes.find(synthetics[id].name);
+        if (known != synthetic_indexes.end() && !indexes.count(synthetics[id].name)) take(id, known->second);
+    }
+    uint32_t free_index = 0;
+    for (uint32_t id = 0; id < synthetics.size(); ++id) {
+        if (indexes.count(synthetics[id].name)) continue;
+        while (free_index < synthetic_at.size() && synthetic_at[free_index] >= 0) ++free_index;
+        take(id, free_index);
+    }
+
+    for (const auto& synthetic : synthetics) set->feed_ids.push_back(shm->capacity + indexes[synthetic.name]);
+    set->last_quotes.assign(synthetic_at.size(), NEVER_QUOTED);
+    synthetic_indexes.swap(indexes);
+    return set.release();
+}
+
+std::string describe_formulas(const FormulaProgram& program) {
+    std::ostringstream out;
+    out << program.synthetics.size() << " synthetic symbol formulas (" << program.nodes.size()
+        << " shared nodes in " << program.groups.size() << " groups over " << program.symbols.size()
+        << " symbols, " << formula_kernel_name(program.kernel) << " kernel)";
+    return out.str();
+}
+
+// Hand set to the broadcaster. A set published earlier that it has not
+// picked up yet was never seen by it, so it is freed here.
+void publish_formulas(FormulaSet* set) {
+    delete pending_formulas.exchange(set, std::memory_order_acq_rel);
+}
+
+// Free the sets the broadcaster has switched away from
+void free_retired_formulas() {
+    FormulaSet* set = retired_formulas.exchange(nullptr, std::memory_order_acquire);
+    while (set) {
+        FormulaSet* next = set->next_retired;
+        delete set;
+        set = next;
+    }
+}
+
+// Reload FORMULAS_FILE whenever it changes, until an error. Runs on its own
+// thread.
+void watch_formulas() {
+    // Watch the directory: a file renamed over formulas.cfg is a new inode
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        LOG_ERROR("Cannot watch ", FORMULAS_FILE, " for changes: ", std::strerror(errno));
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    alignas(struct inotify_event) char events[4096];
+    bool changed = false;
+    while (true) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, changed ? RELOAD_SETTLE_MS : 1000);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("poll: ", std::strerror(errno));
+            break;
+        }
+        free_retired_formulas();
+
+        if (ready > 0) {
+            ssize_t length = read(fd, events, sizeof(events));
+            for (ssize_t offset = 0; offset < length;) {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(events + offset);
+                if ((event->mask & IN_Q_OVERFLOW) || (event->len && std::strcmp(event->name, FORMULAS_FILE) == 0)) {
+                    changed = true;
                 }
-                ++it;
+                offset += sizeof(struct inotify_event) + event->len;
             }
+            continue;
+        }
+        if (!changed) continue;
+        changed = false;
+
+        FormulaSet* set = compile_formulas(FORMULAS_FILE);
+        if (!set) {
+            LOG_WARNING("Warning: Could not open ", FORMULAS_FILE, ", keeping the current formulas");
+            continue;
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        LOG_INFO("Reloaded ", describe_formulas(set->program));
+        publish_formulas(set);
     }
+    close(fd);
 }
 
-void handle_client(int conn_fd) {
-    try {
-        send(conn_fd, "Fake HFT DDE Server 1.0\nLogin:\n", 33, 0);
-        char buffer[1024] = {0};
-        read(conn_fd, buffer, 1024);
-        send(conn_fd, "Password:\n", 10, 0);
-        read(conn_fd, buffer, 1024);
-        send(conn_fd, "> Access granted\n", 17, 0);
+// --- Replay ---
+//
+// server --replay <journal>... [--pace full|recorded] [--output <file>]
+//
+// Feeds ticks recorded by the producer's journal (journal.h) through the same
+// change detection and formula evaluation as live prices, one broadcaster
+// cycle per tick, against a private segment standing in for /market_prices.
+// formulas.cfg is read as usual, so a formula change can be tried on a
+// recorded day. The journals given are merged by record time, so the
+// per-session journals of a producer with several FIX sessions play back
+// interleaved as they were recorded.
+//
+//   full      as fast as possible, then exit without serving anyone (default)
+//   recorded  keep the recorded time between ticks, serving terminals and
+//             multicast as if live; the server stays up when the replay ends
+//
+// --output writes every broadcast line, prefixed with the recorded time (ns
+// since the epoch) of the tick that caused it.
 
-        {
-            std::lock_guard<std::mutex> lock(clients_mutex);
-            clients.push_back(conn_fd);
-        }
-
-        while (true) {
-            // Check for client disconnection by attempting a non-blocking read
-            char dummy_buffer[1];
-            ssize_t n = recv(conn_fd, dummy_buffer, 1, MSG_PEEK | MSG_DONTWAIT);
-            if (n == 0) {
-                // Client closed the connection
-                throw std::runtime_error("Client disconnected.");
-            } else if (n < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
-                // Other error, assume disconnection
-                throw std::runtime_error("Socket error.");
+struct ReplayJournal {
+    std::string path;
+    const JournalHeader* header;
+    size_t bytes;
+};
+
+struct Replay {
+    std::vector<std::string> files;
+    bool recorded_pace = false;
+    std::string output;
+    std::vector<ReplayJournal> journals;
+    SharedMemory* segment = nullptr;    // writable; shm points at it too
+};
+
+Replay replay;
+
+// Read --replay arguments. False if they do not make sense.
+bool parse_replay_arguments(int argc, char* argv[], Replay& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--replay") {
+            while (i + 1 < argc && argv[i + 1][0] != '-') options.files.push_back(argv[++i]);
+            if (options.files.empty()) return false;
+        } else if (arg == "--pace" && i + 1 < argc) {
+            std::string pace = argv[++i];
+            if (pace != "full" && pace != "recorded") return false;
+            options.recorded_pace = (pace == "recorded");
+        } else if (arg == "--output" && i + 1 < argc) {
+            options.output = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return argc == 1 || !options.files.empty();
+}
+
+// Map the journals and create the segment they are played into
+bool open_replay(Replay& options) {
+    uint32_t capacity = 1;
+    for (const auto& path : options.files) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(JournalHeader))) {
+            std::cerr << "Cannot read journal " << path << "\n";
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        size_t bytes = static_cast<size_t>(st.st_size);
+        void* base = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            std::cerr << "Failed to map journal " << path << "\n";
+            return false;
+        }
+        const JournalHeader* header = static_cast<const JournalHeader*>(base);
+        if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION ||
+            header->record_size != JOURNAL_RECORD_SIZE || header->shm_capacity > MAX_SHM_CAPACITY) {
+            std::cerr << path << " is not a journal this server can read\n";
+            munmap(base, bytes);
+            return false;
+        }
+        options.journals.push_back({path, header, bytes});
+        capacity = std::max(capacity, header->shm_capacity);
+    }
+
+    size_t size = SharedMemory::size_for(capacity);
+    void* segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED) {
+        std::cerr << "Failed to allocate the replay segment\n";
+        return false;
+    }
+    options.segment = static_cast<SharedMemory*>(segment);
+    init_shared_memory(options.segment, capacity);
+    shm = shm_control = options.segment;
+    shm_size = size;
+    std::cout << "Replaying " << options.journals.size() << " journal file(s) into " << capacity << " symbol slots\n";
+    return true;
+}
+
+// A journal's symbol in the replay segment
+struct ReplaySymbol {
+    bool named = false;
+    char name[SYMBOL_NAME_LEN];
+    int slot = -1;      // in the segment; -1 until its first price
+};
+
+// Write one recorded price into the segment. False if the symbol cannot be
+// stored, or was recorded with other decimals earlier in the replay.
+bool replay_price(SharedMemory* segment, ReplaySymbol& symbol, const JournalPrice& record) {
+    const PriceTicks ticks = {record.bid_ticks, record.ask_ticks};
+    if (symbol.slot < 0) {
+        symbol.slot = segment->find(symbol.name);
+        if (symbol.slot < 0) {
+            symbol.slot = record.decimals == NO_TICKS ? segment->add(symbol.name, record.bid, record.ask)
+                                                      : segment->add_ticks(symbol.name, record.decimals, ticks);
+            return symbol.slot >= 0;
+        }
+    }
+    if (segment->price(symbol.slot).decimals != record.decimals) return false;
+    if (record.decimals == NO_TICKS) segment->update(symbol.slot, record.bid, record.ask);
+    else segment->update_ticks(symbol.slot, ticks);
+    return true;
+}
+
+// A journal being played: where it is and the names its slots were given
+struct ReplayCursor {
+    const char* records;
+    uint64_t count;
+    uint64_t next = 0;
+    std::vector<ReplaySymbol> symbols;  // by journal slot
+    JournalPrice price;                 // the record about to be played
+};
+
+// Move to the cursor's next price record, taking in the symbol records
+// before it. False at the end of the journal.
+bool advance_replay(ReplayCursor& cursor) {
+    while (cursor.next < cursor.count) {
+        const char* record = cursor.records + cursor.next++ * JOURNAL_RECORD_SIZE;
+        uint16_t type;
+        std::memcpy(&type, record + offsetof(JournalPrice, type), sizeof(type));
+
+        if (type == JOURNAL_SYMBOL) {
+            JournalSymbol named;
+            std::memcpy(&named, record, sizeof(named));
+            if (named.slot >= cursor.symbols.size()) cursor.symbols.resize(named.slot + 1);
+            ReplaySymbol& symbol = cursor.symbols[named.slot];
+            symbol.named = true;
+            std::memcpy(symbol.name, named.name, SYMBOL_NAME_LEN);
+            symbol.name[SYMBOL_NAME_LEN - 1] = '\0';
+            symbol.slot = -1;
+        } else if (type == JOURNAL_PRICE) {
+            std::memcpy(&cursor.price, record, sizeof(cursor.price));
+            return true;
+        }
+    }
+    return false;
+}
+
+void replay_journals() {
+    std::ofstream output;
+    if (!replay.output.empty()) {
+        output.open(replay.output);
+        if (!output) std::cerr << "Warning: Cannot write " << replay.output << "\n";
+    }
+
+    uint64_t ticks = 0, skipped = 0, lines = 0;
+    uint64_t first_ns = 0;
+    const auto started = std::chrono::steady_clock::now();
+
+    std::vector<ReplayCursor> cursors;
+    for (const auto& journal : replay.journals) {
+        ReplayCursor cursor;
+        cursor.records = reinterpret_cast<const char*>(journal.header) + sizeof(JournalHeader);
+        cursor.count = std::min<uint64_t>(journal.header->count.load(std::memory_order_acquire),
+                                          (journal.bytes - sizeof(JournalHeader)) / JOURNAL_RECORD_SIZE);
+        if (advance_replay(cursor)) cursors.push_back(std::move(cursor));
+    }
+
+    // The earliest next price of all journals goes first; on a tie, the
+    // journal given first
+    while (!cursors.empty()) {
+        size_t earliest = 0;
+        for (size_t i = 1; i < cursors.size(); ++i) {
+            if (cursors[i].price.timestamp_ns < cursors[earliest].price.timestamp_ns) earliest = i;
+        }
+        ReplayCursor& cursor = cursors[earliest];
+        const JournalPrice price = cursor.price;
+        bool played = price.slot < cursor.symbols.size() && cursor.symbols[price.slot].named &&
+                      replay_price(replay.segment, cursor.symbols[price.slot], price);
+        if (!advance_replay(cursor)) cursors.erase(cursors.begin() + static_cast<ptrdiff_t>(earliest));
+        if (!played) {
+            skipped++;
+            continue;
+        }
+        ticks++;
+
+        if (replay.recorded_pace) {
+            if (!first_ns) first_ns = price.timestamp_ns;
+            if (price.timestamp_ns > first_ns) {
+                std::this_thread::sleep_until(started + std::chrono::nanoseconds(price.timestamp_ns - first_ns));
+            }
+        }
+
+        std::shared_ptr<Batch> batch = broadcast_cycle();
+        lines += batch->entries.size();
+        if (output.is_open()) {
+            for (const auto& entry : batch->entries) {
+                output << price.timestamp_ns << ' ';
+                output.write(batch->text.data() + entry.offset, entry.length);
             }
-            std::this_thread::sleep_for(std::chrono::seconds(1));
         }
-    } catch (...) {
-        close(conn_fd);
-        std::lock_guard<std::mutex> lock(clients_mutex);
-        clients.erase(std::remove(clients.begin(), clients.end(), conn_fd), clients.end());
     }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    std::cout << "Replayed " << ticks << " ticks in " << elapsed.count() << " ms, broadcasting " << lines << " updates";
+    if (skipped) std::cout << " (" << skipped << " ticks skipped: unnamed slot, full segment or changed decimals)";
+    std::cout << std::endl;
 }
 
-int main() {
-    // Open shared memory
-    int fd = shm_open("/market_prices", O_RDONLY, 0666);
+// Map the producer's /market_prices segment
+bool open_shared_memory() {
+    // Open shared memory. Read-write only so we can register on the doorbell.
+    int fd = shm_open("/market_prices", O_RDWR, 0666);
     if (fd < 0) {
         std::cerr << "Failed to open shared memory. Make sure the producer is running.\n";
-        return 1;
+        return false;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(SharedMemory))) {
+        std::cerr << "Shared memory is not initialised yet. Make sure the producer is running.\n";
+        close(fd);
+        return false;
+    }
+
+    // Map just the header first to learn the layout the producer chose
+    shm_control = (SharedMemory*)mmap(nullptr, sizeof(SharedMemory), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm_control == MAP_FAILED) {
+        std::cerr << "Failed to map shared memory\n";
+        close(fd);
+        return false;
+    }
+    if (!shared_memory_compatible(shm_control)) {
+        std::cerr << "Shared memory layout mismatch (found version " << shm_control->version
+                  << ", expected " << SHM_LAYOUT_VERSION << "). Rebuild price and server from the same sources.\n";
+        munmap(shm_control, sizeof(SharedMemory));
+        close(fd);
+        return false;
+    }
+    shm_size = shm_control->size();
+
+    if (st.st_size < static_cast<off_t>(shm_size)) {
+        std::cerr << "Shared memory is smaller than its header claims. Was the producer built from the same sources?\n";
+        close(fd);
+        return false;
     }
 
-    shm = (SharedMemory*)mmap(nullptr, sizeof(SharedMemory), PROT_READ, MAP_SHARED, fd, 0);
+    // Everything else is mapped read-only
+    shm = (SharedMemory*)mmap(nullptr, shm_size, PROT_READ, MAP_SHARED, fd, 0);
     if (shm == MAP_FAILED) {
         std::cerr << "Failed to map shared memory\n";
         close(fd);
-        return 1;
+        return false;
     }
     close(fd);
+    std::cout << "Mapped shared memory for " << shm->capacity << " symbols\n";
+    return true;
+}
 
-    // Load formulas from file
-    load_formulas_from_file("formulas.cfg");
+int main(int argc, char* argv[]) {
+    if (!parse_replay_arguments(argc, argv, replay)) {
+        std::cerr << "Usage: server [--replay <journal>... [--pace full|recorded] [--output <file>]]\n";
+        return 1;
+    }
+    if (!load_server_config("server.cfg", config)) {
+        std::cout << "No server.cfg found, using defaults.\n";
+    }
+    set_log_level(config.log_level);
+    if (replay.files.empty() ? !open_shared_memory() : !open_replay(replay)) {
+        return 1;
+    }
 
-    // Start TCP server
-    int server_fd;
-    struct sockaddr_in address{};
-    int addrlen = sizeof(address);
+    // Load formulas from file; the broadcaster picks them up on its first cycle
+    FormulaSet* initial_formulas = compile_formulas(FORMULAS_FILE);
+    if (!initial_formulas) {
+        std::cerr << "Warning: Could not open formulas.cfg. No synthetic prices will be generated.\n";
+        initial_formulas = new FormulaSet();
+    }
+    std::cout << "Loaded " << describe_formulas(initial_formulas->program) << ".\n";
+    publish_formulas(initial_formulas);
 
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        perror("socket failed");
-        return 1;
+    // A full-speed replay only needs the formula engine
+    if (!replay.files.empty() && !replay.recorded_pace) {
+        replay_journals();
+        return 0;
     }
 
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Start TCP server: one epoll reactor per ReactorThreads, all on the same port
+    for (int i = 0; i < config.reactor_threads; ++i) {
+        reactors.emplace_back(new Reactor());
+        reactors.back()->id = static_cast<uint32_t>(i);
+        if (!start_reactor(*reactors.back(), config.port)) {
+            return 1;
+        }
+    }
 
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    if (config.stats_port > 0) {
+        int stats_fd = open_listener(config.stats_port, INADDR_LOOPBACK);
+        if (stats_fd < 0) {
+            return 1;
+        }
+        std::thread(serve_stats, stats_fd).detach();
+        std::cout << "Stats on 127.0.0.1:" << config.stats_port << std::endl;
+    }
 
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-        perror("bind failed");
-        return 1;
+    if (config.formulas_reload) {
+        std::thread(watch_formulas).detach();
+        std::cout << "Reloading " << FORMULAS_FILE << " whenever it changes" << std::endl;
     }
 
-    if (listen(server_fd, 5) < 0) {
-        perror("listen failed");
-        return 1;
+    if (!config.multicast_group.empty()) {
+        if (!open_multicast(config)) {
+            return 1;
+        }
+        std::cout << "Multicasting to " << config.multicast_group << ", keeping the last "
+                  << config.retransmit_packets << " packets for retransmission" << std::endl;
     }
 
-    std::thread broadcaster(broadcast_prices);
-    broadcaster.detach();
+    if (replay.files.empty()) {
+        std::thread broadcaster(broadcast_prices);
+        broadcaster.detach();
+    } else {
+        std::thread(replay_journals).detach();
+    }
 
-    std::cout << "TCP server running on port " << PORT << std::endl;
+    std::cout << "TCP server running on port " << config.port
+              << (config.busy_spin ? " (busy-spin wakeup, " : " (doorbell wakeup, ")
+              << config.reactor_threads << " reactor thread(s))" << std::endl;
 
-    while (true) {
-        int new_socket = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen);
-        if (new_socket < 0) {
-            perror("accept");
-            continue;
-        }
-        std::cout << "New client connected: " << new_socket << std::endl;
-        std::thread(handle_client, new_socket).detach();
+    for (size_t i = 1; i < reactors.size(); ++i) {
+        std::thread(run_reactor, std::ref(*reactors[i])).detach();
     }
+    run_reactor(*reactors[0]);
 
-    munmap(shm, sizeof(SharedMemory));
+    munmap(shm, shm_size);
+    munmap(shm_control, sizeof(SharedMemory));
     return 0;
 }
@@ -0,0 +1,568 @@
+#pragma once
+
+// Layout of the /market_prices segment. price writes it, from one thread per
+// FIX session; server (and anything else) maps it read-only. Both sides must
+// be built from the same copy of this header.
+//
+// The segment is sized at startup by the producer:
+//
+//   SharedMemory header | hash index | symbol names | price slots | update ring | books
+//
+// Readers learn the capacity from the header, so only the producer needs to
+// be configured. The update ring lists the slots the producer wrote, in
+// order, so a reader can find what changed without scanning every slot.
+//
+// A price slot holds the top of book. With book_depth > 1 every slot also
+// has a book of up to book_depth levels per side; the producer writes it
+// before the slot's price, so the price update tells readers to re-read it.
+//
+// Prices are doubles, or with PriceFormat=ticks also exact integer ticks of
+// 10^-decimals, where decimals is fixed per symbol by its first price.
+//
+// The producer may reserve slots for the symbols it subscribes to before
+// any price arrives, so each session writes a contiguous range of its own.
+// A reserved slot is counted but has no price (seq 0) and find() does not
+// return it until its first price. Any number of threads may write prices,
+// as long as each slot has one writer; adding and reserving slots is still
+// one thread at a time.
+//
+// After each write the producer rings a futex doorbell in the header. A
+// reader that wants to block instead of polling registers in sleepers, which
+// requires a writable mapping of the header page (see wait_for_updates).
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct PriceData {
+    double bid;
+    double ask;
+    bool operator==(const PriceData& other) const {
+        return bid == other.bid && ask == other.ask;
+    }
+    bool operator!=(const PriceData& other) const {
+        return !(*this == other);
+    }
+};
+
+// Exact price: integer counts of 10^-decimals units
+struct PriceTicks {
+    int64_t bid;
+    int64_t ask;
+    bool operator==(const PriceTicks& other) const {
+        return bid == other.bid && ask == other.ask;
+    }
+    bool operator!=(const PriceTicks& other) const {
+        return !(*this == other);
+    }
+};
+
+constexpr int SYMBOL_NAME_LEN = 32; // including the terminating NUL
+
+// Decimals of a slot that stores doubles only
+constexpr int32_t NO_TICKS = -1;
+// Most decimals a raw symbol may use, so ticks for prices up to ~9e9 fit int64
+constexpr int32_t MAX_TICK_DECIMALS = 9;
+
+// 10^n for 0 <= n <= 18
+inline int64_t pow10_ticks(int n) {
+    static const int64_t powers[19] = {
+        1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL,
+        1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL, 10000000000000LL,
+        100000000000000LL, 1000000000000000LL, 10000000000000000LL, 100000000000000000LL,
+        1000000000000000000LL,
+    };
+    return powers[n];
+}
+
+// Number of symbols when SharedMemoryCapacity is not set in initiator.cfg
+constexpr uint32_t DEFAULT_SHM_CAPACITY = 4096;
+constexpr uint32_t MAX_SHM_CAPACITY = 1u << 20;
+
+// Bump SHM_LAYOUT_VERSION whenever the segment changes shape, so a reader
+// built against an older layout refuses the segment instead of misreading it.
+constexpr uint32_t SHM_MAGIC = 0x4D4B5450; // "MKTP"
+constexpr uint32_t SHM_LAYOUT_VERSION = 9;
+
+// Entries in the update ring; a reader more than this far behind rescans.
+constexpr uint32_t UPDATE_RING_SIZE = 1u << 16;
+
+// One slot per cache line so the writer updating one symbol does not bounce
+// the line a reader is copying for its neighbour. seq is odd while bid/ask
+// are being written. timestamp_ns is the producer's wall-clock time of the
+// write and received_ns the time it received the message the price came
+// from, both in nanoseconds since the epoch; a reader subtracting them sees
+// how long the producer took. A slot with decimals != NO_TICKS also holds
+// the exact prices as ticks; bid and ask are then the nearest doubles to them.
+struct alignas(64) PriceSlot {
+    std::atomic<uint32_t> seq;
+    int32_t decimals;               // set before the slot is published, then fixed
+    std::atomic<double> bid;
+    std::atomic<double> ask;
+    std::atomic<uint64_t> timestamp_ns;
+    std::atomic<int64_t> bid_ticks;
+    std::atomic<int64_t> ask_ticks;
+    std::atomic<uint64_t> received_ns;
+};
+
+// Most levels per side a book may keep (MarketDepth in initiator.cfg)
+constexpr uint32_t MAX_BOOK_DEPTH = 64;
+
+// One level of a book, as readers get it
+struct BookLevel {
+    double price;
+    double size;
+};
+
+// Start of a slot's book, followed by book_depth bid levels and then
+// book_depth ask levels, best first. seq is a seqlock as in PriceSlot.
+struct BookHeader {
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> bid_levels;   // levels in use on each side
+    std::atomic<uint32_t> ask_levels;
+    uint32_t reserved;
+};
+
+struct BookLevelSlot {
+    std::atomic<double> price;
+    std::atomic<double> size;
+};
+
+// Spin-wait hint for the CPU
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// FNV-1a over the stored (possibly truncated) name.
+inline uint32_t symbol_hash(const char* symbol) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < SYMBOL_NAME_LEN - 1 && symbol[i]; ++i) {
+        h ^= static_cast<unsigned char>(symbol[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+struct alignas(64) SharedMemory {
+    std::atomic<uint32_t> magic; // stored last, once the rest is initialised
+    uint32_t version;
+    uint32_t capacity;           // number of price slots
+    uint32_t index_mask;         // hash index has index_mask + 1 entries
+    std::atomic<int> count;      // slots [0, count) have a name; those with seq 0 no price yet
+    std::atomic<uint64_t> update_head; // total number of slot writes ever published
+    std::atomic<uint32_t> doorbell;    // futex word, bumped after every publish
+    std::atomic<uint32_t> sleepers;    // readers blocked (or about to block) on doorbell
+    uint32_t book_depth;               // levels per side in each book; 1 keeps no books
+    std::atomic<uint32_t> listed;      // slots find() returns; bumped as each gets its first price
+    std::atomic<uint64_t> update_claim; // update ring entries claimed by writers, >= update_head
+
+    // Open-addressing index kept at most half full. An entry is
+    // (hash << 32) | (slot + 1); zero marks an empty bucket.
+    static uint32_t index_size_for(uint32_t capacity) {
+        uint32_t n = 1;
+        while (n < capacity * 2) n <<= 1;
+        return n;
+    }
+    static size_t symbols_offset(uint32_t capacity) {
+        return sizeof(SharedMemory) + index_size_for(capacity) * sizeof(uint64_t);
+    }
+    static size_t prices_offset(uint32_t capacity) {
+        size_t end = symbols_offset(capacity) + static_cast<size_t>(capacity) * SYMBOL_NAME_LEN;
+        return (end + alignof(PriceSlot) - 1) & ~(alignof(PriceSlot) - 1);
+    }
+    static size_t updates_offset(uint32_t capacity) {
+        return prices_offset(capacity) + static_cast<size_t>(capacity) * sizeof(PriceSlot);
+    }
+    static size_t books_offset(uint32_t capacity) {
+        size_t end = updates_offset(capacity) + UPDATE_RING_SIZE * sizeof(uint32_t);
+        return (end + 63) & ~static_cast<size_t>(63);
+    }
+    static size_t book_stride(uint32_t book_depth) {
+        if (book_depth <= 1) return 0;
+        size_t bytes = sizeof(BookHeader) + 2 * static_cast<size_t>(book_depth) * sizeof(BookLevelSlot);
+        return (bytes + 63) & ~static_cast<size_t>(63);
+    }
+    static size_t size_for(uint32_t capacity, uint32_t book_depth = 1) {
+        return books_offset(capacity) + static_cast<size_t>(capacity) * book_stride(book_depth);
+    }
+    size_t size() const { return size_for(capacity, book_depth); }
+
+    std::atomic<uint64_t>* index() {
+        return reinterpret_cast<std::atomic<uint64_t>*>(reinterpret_cast<char*>(this) + sizeof(SharedMemory));
+    }
+    const std::atomic<uint64_t>* index() const {
+        return const_cast<SharedMemory*>(this)->index();
+    }
+    char* symbol(int i) {
+        return reinterpret_cast<char*>(this) + symbols_offset(capacity) + static_cast<size_t>(i) * SYMBOL_NAME_LEN;
+    }
+    const char* symbol(int i) const {
+        return const_cast<SharedMemory*>(this)->symbol(i);
+    }
+    PriceSlot& price(int i) {
+        return reinterpret_cast<PriceSlot*>(reinterpret_cast<char*>(this) + prices_offset(capacity))[i];
+    }
+    const PriceSlot& price(int i) const {
+        return const_cast<SharedMemory*>(this)->price(i);
+    }
+    std::atomic<uint32_t>* updates() {
+        return reinterpret_cast<std::atomic<uint32_t>*>(reinterpret_cast<char*>(this) + updates_offset(capacity));
+    }
+    const std::atomic<uint32_t>* updates() const {
+        return const_cast<SharedMemory*>(this)->updates();
+    }
+    bool has_books() const { return book_depth > 1; }
+    BookHeader& book(int i) {
+        return *reinterpret_cast<BookHeader*>(reinterpret_cast<char*>(this) + books_offset(capacity) +
+                                              static_cast<size_t>(i) * book_stride(book_depth));
+    }
+    const BookHeader& book(int i) const {
+        return const_cast<SharedMemory*>(this)->book(i);
+    }
+    // Bids at [0, book_depth), asks at [book_depth, 2 * book_depth)
+    BookLevelSlot* book_levels(int i) {
+        return reinterpret_cast<BookLevelSlot*>(&book(i) + 1);
+    }
+    const BookLevelSlot* book_levels(int i) const {
+        return const_cast<SharedMemory*>(this)->book_levels(i);
+    }
+
+    // Slot holding symbol, or -1. Lock-free and allocation-free; safe to call
+    // from any reader while the producer is adding symbols.
+    int find(const char* name) const {
+        uint32_t h = symbol_hash(name);
+        const std::atomic<uint64_t>* buckets = index();
+        for (uint32_t b = h & index_mask;; b = (b + 1) & index_mask) {
+            uint64_t entry = buckets[b].load(std::memory_order_acquire);
+            if (entry == 0) return -1;
+            if (static_cast<uint32_t>(entry >> 32) != h) continue;
+            int slot = static_cast<int>(static_cast<uint32_t>(entry) - 1);
+            if (std::strncmp(symbol(slot), name, SYMBOL_NAME_LEN - 1) == 0) return slot;
+        }
+    }
+
+    // Producer only: claim the next slot for a symbol that find() did not
+    // return, with its first price. Returns -1 when the segment is full.
+    // received_ns is when the price arrived; 0 means now.
+    int add(const char* name, double bid, double ask, uint64_t received_ns = 0);
+    // Same for a symbol stored as ticks of 10^-decimals
+    int add_ticks(const char* name, int32_t decimals, const PriceTicks& ticks, uint64_t received_ns = 0);
+
+    // Producer only: claim the next slot for a symbol without a price yet.
+    // Returns -1 when the segment is full. The slot stays invisible to
+    // find() until first_price or first_price_ticks.
+    int reserve(const char* name);
+    bool has_price(int slot) const { return price(slot).seq.load(std::memory_order_acquire) != 0; }
+    // The slot's writer: give a reserved slot its first price and list it
+    void first_price(int slot, double bid, double ask, uint64_t received_ns = 0);
+    void first_price_ticks(int slot, int32_t decimals, const PriceTicks& ticks, uint64_t received_ns = 0);
+
+    // The slot's writer: write a new price to a slot that has one and
+    // announce it.
+    void update(int slot, double bid, double ask, uint64_t received_ns = 0);
+    void update_ticks(int slot, const PriceTicks& ticks, uint64_t received_ns = 0);
+
+    // The slot's writer, with has_books(): replace a slot's book, best level
+    // first, keeping at most book_depth levels per side. Readers are told
+    // by the slot's next update, so call this before update().
+    void write_book(int slot, const BookLevel* bids, uint32_t bid_count, const BookLevel* asks, uint32_t ask_count);
+
+private:
+    int claim_slot(const char* name, int32_t decimals);
+    void publish_slot(int slot);
+
+    void list_slot(int slot);
+
+    // Writers claim ring entries in any order but publish them in claim
+    // order, each waiting for the one before. That is a few instructions,
+    // unless the writer before was preempted in between; then yield to it.
+    void publish_update(int slot) {
+        uint64_t head = update_claim.fetch_add(1, std::memory_order_relaxed);
+        updates()[head & (UPDATE_RING_SIZE - 1)].store(static_cast<uint32_t>(slot), std::memory_order_relaxed);
+        for (unsigned spins = 0; update_head.load(std::memory_order_acquire) != head; ++spins) {
+            if (spins < 100) cpu_relax();
+            else sched_yield();
+        }
+        update_head.store(head + 1, std::memory_order_release);
+
+        // Dekker-style pairing with wait_for_updates: either the reader sees
+        // the new doorbell value, or we see it registered and wake it.
+        doorbell.fetch_add(1, std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_seq_cst) != 0) {
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&doorbell), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        }
+    }
+};
+
+static_assert(sizeof(SharedMemory) == 64, "header must stay one cache line");
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared memory atomics must be lock-free");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory atomics must be lock-free");
+
+// Producer side: reset a freshly mapped segment of
+// SharedMemory::size_for(capacity, book_depth) bytes and stamp the header.
+inline void init_shared_memory(SharedMemory* shm, uint32_t capacity, uint32_t book_depth = 1) {
+    shm->magic.store(0, std::memory_order_relaxed);
+    std::memset(static_cast<void*>(shm), 0, SharedMemory::size_for(capacity, book_depth));
+    shm->version = SHM_LAYOUT_VERSION;
+    shm->capacity = capacity;
+    shm->book_depth = book_depth;
+    shm->index_mask = SharedMemory::index_size_for(capacity) - 1;
+    shm->magic.store(SHM_MAGIC, std::memory_order_release);
+}
+
+// Reader side: true if the segment was written by a producer with our layout.
+// Only the header needs to be mapped to call this.
+inline bool shared_memory_compatible(const SharedMemory* shm) {
+    return shm->magic.load(std::memory_order_acquire) == SHM_MAGIC &&
+           shm->version == SHM_LAYOUT_VERSION &&
+           shm->capacity > 0 && shm->capacity <= MAX_SHM_CAPACITY &&
+           shm->book_depth >= 1 && shm->book_depth <= MAX_BOOK_DEPTH &&
+           shm->index_mask + 1 == SharedMemory::index_size_for(shm->capacity);
+}
+
+inline uint64_t wall_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Seqlock write. Only one thread may write a given slot. received_ns of 0
+// stamps the receive time as now.
+inline void write_price(PriceSlot& slot, double bid, double ask, const PriceTicks& ticks = PriceTicks{0, 0},
+                        uint64_t received_ns = 0) {
+    uint64_t now = wall_clock_ns();
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.bid.store(bid, std::memory_order_relaxed);
+    slot.ask.store(ask, std::memory_order_relaxed);
+    slot.timestamp_ns.store(now, std::memory_order_relaxed);
+    slot.bid_ticks.store(ticks.bid, std::memory_order_relaxed);
+    slot.ask_ticks.store(ticks.ask, std::memory_order_relaxed);
+    slot.received_ns.store(received_ns ? received_ns : now, std::memory_order_relaxed);
+    slot.seq.store(seq + 2, std::memory_order_release);
+}
+
+// Seqlock write of an exact price to a slot with decimals != NO_TICKS
+inline void write_price_ticks(PriceSlot& slot, const PriceTicks& ticks, uint64_t received_ns = 0) {
+    double scale = static_cast<double>(pow10_ticks(slot.decimals));
+    write_price(slot, ticks.bid / scale, ticks.ask / scale, ticks, received_ns);
+}
+
+// Seqlock read: copies a bid/ask pair that was written together (and, if
+// asked, its timestamps and ticks) and returns the (even) slot version it
+// was taken at.
+inline uint32_t read_price(const PriceSlot& slot, PriceData& out, uint64_t* timestamp_ns = nullptr,
+                           PriceTicks* ticks = nullptr, uint64_t* received_ns = nullptr) {
+    for (;;) {
+        uint32_t before = slot.seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            cpu_relax();
+            continue;
+        }
+        out.bid = slot.bid.load(std::memory_order_relaxed);
+        out.ask = slot.ask.load(std::memory_order_relaxed);
+        uint64_t stamp = slot.timestamp_ns.load(std::memory_order_relaxed);
+        PriceTicks exact = {slot.bid_ticks.load(std::memory_order_relaxed),
+                            slot.ask_ticks.load(std::memory_order_relaxed)};
+        uint64_t received = slot.received_ns.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == before) {
+            if (timestamp_ns) *timestamp_ns = stamp;
+            if (ticks) *ticks = exact;
+            if (received_ns) *received_ns = received;
+            return before;
+        }
+    }
+}
+
+inline int SharedMemory::claim_slot(const char* name, int32_t decimals) {
+    int slot = count.load(std::memory_order_relaxed);
+    if (slot >= static_cast<int>(capacity)) return -1;
+
+    char* dst = symbol(slot);
+    std::strncpy(dst, name, SYMBOL_NAME_LEN - 1);
+    dst[SYMBOL_NAME_LEN - 1] = '\0';
+    price(slot).decimals = decimals;
+    return slot;
+}
+
+inline int SharedMemory::add(const char* name, double bid, double ask, uint64_t received_ns) {
+    int slot = claim_slot(name, NO_TICKS);
+    if (slot < 0) return -1;
+    write_price(price(slot), bid, ask, PriceTicks{0, 0}, received_ns);
+    publish_slot(slot);
+    return slot;
+}
+
+inline int SharedMemory::add_ticks(const char* name, int32_t decimals, const PriceTicks& ticks, uint64_t received_ns) {
+    int slot = claim_slot(name, decimals);
+    if (slot < 0) return -1;
+    write_price_ticks(price(slot), ticks, received_ns);
+    publish_slot(slot);
+    return slot;
+}
+
+inline int SharedMemory::reserve(const char* name) {
+    int slot = claim_slot(name, NO_TICKS);
+    if (slot >= 0) count.store(slot + 1, std::memory_order_release);
+    return slot;
+}
+
+inline void SharedMemory::first_price(int slot, double bid, double ask, uint64_t received_ns) {
+    write_price(price(slot), bid, ask, PriceTicks{0, 0}, received_ns);
+    list_slot(slot);
+    publish_update(slot);
+}
+
+inline void SharedMemory::first_price_ticks(int slot, int32_t decimals, const PriceTicks& ticks, uint64_t received_ns) {
+    price(slot).decimals = decimals;    // published by the seqlock write below
+    write_price_ticks(price(slot), ticks, received_ns);
+    list_slot(slot);
+    publish_update(slot);
+}
+
+inline void SharedMemory::publish_slot(int slot) {
+    // Publish to lookups first, then to readers walking [0, count)
+    list_slot(slot);
+    count.store(slot + 1, std::memory_order_release);
+    publish_update(slot);
+}
+
+// Insert into the index. Slots are listed concurrently by their writers, so
+// a bucket is taken with a compare-and-swap.
+inline void SharedMemory::list_slot(int slot) {
+    uint32_t h = symbol_hash(symbol(slot));
+    uint64_t entry = (static_cast<uint64_t>(h) << 32) | static_cast<uint32_t>(slot + 1);
+    std::atomic<uint64_t>* buckets = index();
+    for (uint32_t b = h & index_mask;; b = (b + 1) & index_mask) {
+        uint64_t empty = 0;
+        if (buckets[b].compare_exchange_strong(empty, entry, std::memory_order_release, std::memory_order_relaxed)) break;
+    }
+    listed.fetch_add(1, std::memory_order_release);
+}
+
+inline void SharedMemory::update(int slot, double bid, double ask, uint64_t received_ns) {
+    write_price(price(slot), bid, ask, PriceTicks{0, 0}, received_ns);
+    publish_update(slot);
+}
+
+inline void SharedMemory::update_ticks(int slot, const PriceTicks& ticks, uint64_t received_ns) {
+    write_price_ticks(price(slot), ticks, received_ns);
+    publish_update(slot);
+}
+
+inline void SharedMemory::write_book(int slot, const BookLevel* bids, uint32_t bid_count, const BookLevel* asks,
+                                     uint32_t ask_count) {
+    if (bid_count > book_depth) bid_count = book_depth;
+    if (ask_count > book_depth) ask_count = book_depth;
+    BookHeader& header = book(slot);
+    BookLevelSlot* levels = book_levels(slot);
+
+    uint32_t seq = header.seq.load(std::memory_order_relaxed);
+    header.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (uint32_t i = 0; i < bid_count; ++i) {
+        levels[i].price.store(bids[i].price, std::memory_order_relaxed);
+        levels[i].size.store(bids[i].size, std::memory_order_relaxed);
+    }
+    for (uint32_t i = 0; i < ask_count; ++i) {
+        levels[book_depth + i].price.store(asks[i].price, std::memory_order_relaxed);
+        levels[book_depth + i].size.store(asks[i].size, std::memory_order_relaxed);
+    }
+    header.bid_levels.store(bid_count, std::memory_order_relaxed);
+    header.ask_levels.store(ask_count, std::memory_order_relaxed);
+    header.seq.store(seq + 2, std::memory_order_release);
+}
+
+// Reader side, with has_books(): seqlock copy of a slot's book into arrays
+// of book_depth levels each. Returns the (even) book version it was taken at.
+inline uint32_t read_book(const SharedMemory* shm, int slot, BookLevel* bids, uint32_t& bid_count, BookLevel* asks,
+                          uint32_t& ask_count) {
+    const BookHeader& header = shm->book(slot);
+    const BookLevelSlot* levels = shm->book_levels(slot);
+    const uint32_t depth = shm->book_depth;
+    for (;;) {
+        uint32_t before = header.seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            cpu_relax();
+            continue;
+        }
+        bid_count = std::min(header.bid_levels.load(std::memory_order_relaxed), depth);
+        ask_count = std::min(header.ask_levels.load(std::memory_order_relaxed), depth);
+        for (uint32_t i = 0; i < bid_count; ++i) {
+            bids[i] = {levels[i].price.load(std::memory_order_relaxed), levels[i].size.load(std::memory_order_relaxed)};
+        }
+        for (uint32_t i = 0; i < ask_count; ++i) {
+            asks[i] = {levels[depth + i].price.load(std::memory_order_relaxed),
+                       levels[depth + i].size.load(std::memory_order_relaxed)};
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header.seq.load(std::memory_order_relaxed) == before) return before;
+    }
+}
+
+// Reader side: call fn(slot) for every slot written since cursor and advance
+// cursor. A slot may be reported more than once; compare slot versions to
+// skip repeats. Returns false if the reader fell more than a ring behind, in
+// which case some writes were missed and the caller must check every slot.
+template <typename Fn>
+bool drain_updates(const SharedMemory* shm, uint64_t& cursor, Fn fn) {
+    uint64_t start = cursor;
+    uint64_t head = shm->update_head.load(std::memory_order_acquire);
+    cursor = head;
+    if (head - start > UPDATE_RING_SIZE) return false;
+
+    const std::atomic<uint32_t>* ring = shm->updates();
+    for (uint64_t i = start; i < head; ++i) {
+        uint32_t slot = ring[i & (UPDATE_RING_SIZE - 1)].load(std::memory_order_relaxed);
+        if (slot < shm->capacity) fn(static_cast<int>(slot));
+    }
+
+    // Entries we just read may have been overwritten underneath us, also by
+    // writers that have claimed entries past head but not published them
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return shm->update_claim.load(std::memory_order_relaxed) - start <= UPDATE_RING_SIZE;
+}
+
+// Reader side: block until the producer publishes past cursor or timeout_ns
+// elapses. control must be a writable mapping of the segment header; the
+// rest of the segment can stay read-only. May return early on a spurious
+// wakeup, so callers loop.
+inline void wait_for_updates(SharedMemory* control, uint64_t cursor, long timeout_ns) {
+    uint32_t bell = control->doorbell.load(std::memory_order_seq_cst);
+    if (control->update_head.load(std::memory_order_acquire) != cursor) return;
+
+    control->sleepers.fetch_add(1, std::memory_order_seq_cst);
+    if (control->doorbell.load(std::memory_order_seq_cst) == bell) {
+        struct timespec timeout = {timeout_ns / 1000000000L, timeout_ns % 1000000000L};
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&control->doorbell), FUTEX_WAIT, bell, &timeout, nullptr, 0);
+    }
+    control->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+// Reader side: busy-poll until the producer publishes past cursor or
+// timeout_ns elapses. Burns a core in exchange for the lowest wakeup latency.
+inline void spin_for_updates(const SharedMemory* shm, uint64_t cursor, long timeout_ns) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned spins = 1; shm->update_head.load(std::memory_order_acquire) == cursor; ++spins) {
+        cpu_relax();
+        if ((spins & 1023) == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) >= timeout_ns) return;
+        }
+    }
+}
@@ -8,23 +8,38 @@
 #include "quickfix/fix44/ExecutionReport.h"
 #include "quickfix/fix44/OrderCancelRequest.h"
 #include "quickfix/fix44/OrderCancelReplaceRequest.h"
+#include "quickfix/fix44/OrderCancelReject.h"
 
 #include <iostream>
 #include <chrono>
 #include <thread>
 #include <fstream>
-#include <cstdlib>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "async_log.h"
+#include "matching_engine.h"
 
 class TradeReceiverApp : public FIX::Application, public FIX::MessageCracker {
 public:
+    explicit TradeReceiverApp(int priceDecimals, int quantityDecimals) : engine(priceDecimals, quantityDecimals) {}
+
     void onCreate(const FIX::SessionID& sessionID) override {
-        std::cout << "Session created: " << sessionID << std::endl;
+        LOG_INFO("Session created: ", sessionID);
     }
     void onLogon(const FIX::SessionID& sessionID) override {
-        std::cout << "Logon: " << sessionID << std::endl;
+        LOG_INFO("Logon: ", sessionID);
     }
     void onLogout(const FIX::SessionID& sessionID) override {
-        std::cout << "Logout: " << sessionID << std::endl;
+        LOG_INFO("Logout: ", sessionID);
     }
 
     void toAdmin(FIX::Message&, const FIX::SessionID&) override {}
@@ -37,7 +52,7 @@ public:
     void fromApp(const FIX::Message& message, const FIX::SessionID& sessionID)
         throw(FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::UnsupportedMessageType) override 
     {
-        std::cout << "Received raw message: " << message.toString() << std::endl;
+        LOG_DEBUG("Received raw message: ", message.toString());
 
         // Extract MsgType (tag 35)
         FIX::MsgType msgType;
@@ -51,14 +66,261 @@ public:
             } else if (msgType == "H") {
                 handleCancelReplace(message, sessionID);
             } else {
-                std::cout << "Unsupported MsgType: " << msgType.getString() << std::endl;
+                LOG_INFO("Unsupported MsgType: ", msgType.getString());
             }
         } catch (std::exception& e) {
-            std::cerr << "Error handling MsgType " << msgType.getString() << ": " << e.what() << std::endl;
+            LOG_ERROR("Error handling MsgType ", msgType.getString(), ": ", e.what());
+        }
+    }
+
+    // Fill resting orders as the market in /market_prices moves through
+    // them. Runs on its own thread; waits for the producer to appear, and
+    // re-attaches when a restarted producer replaces the segment.
+    void watchMarket() {
+        SharedMemory* control = nullptr;
+        const SharedMemory* market = nullptr;
+        MarketSegment mapped;
+        uint64_t cursor = 0;
+        while (true) {
+            if (!market) {
+                market = openMarketPrices(control, mapped);
+                if (!market) {
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(engineMutex);
+                attach_market(engine, market);
+                cursor = market->update_head.load(std::memory_order_acquire);
+                LOG_INFO("Marking orders against /market_prices (", market->capacity, " symbols)");
+            }
+
+            wait_for_updates(control, cursor, MARKET_WAIT_NS);
+            uint64_t head = control->update_head.load(std::memory_order_acquire);
+            if (head <= cursor && marketReplaced(control, mapped, cursor)) {
+                LOG_INFO("/market_prices was replaced or removed; re-attaching");
+                {
+                    std::lock_guard<std::mutex> lock(engineMutex);
+                    attach_market(engine, nullptr);
+                }
+                closeMarketPrices(control, market, mapped);
+                continue;
+            }
+            Reports reports;
+            {
+                std::lock_guard<std::mutex> lock(engineMutex);
+                auto onFill = [&](const Order& order, int64_t price, int64_t lots) {
+                    reportFill(order, price, lots, reports);
+                };
+                bind_books(engine);
+                if (!drain_updates(market, cursor, [&](int slot) { mark_slot(engine, slot, onFill); })) {
+                    // Fell behind the update ring: mark every book
+                    for (uint32_t book = 0; book < engine.books.size(); ++book) mark_book(engine, book, onFill);
+                }
+            }
+            sendReports(reports);
         }
     }
 
 private:
+    // Longest the market watch sleeps before re-checking shm
+    static constexpr long MARKET_WAIT_NS = 100 * 1000 * 1000;
+
+    // Who to report an order to, by engine order id
+    struct ClientOrder {
+        FIX::SessionID session;
+        std::string clOrdID;    // the latest, after any replaces
+    };
+
+    // Messages to send once engineMutex is released
+    typedef std::vector<std::pair<FIX::Message, FIX::SessionID>> Reports;
+
+    MatchingEngine engine;
+    std::mutex engineMutex;     // guards engine and everything below
+    std::unordered_map<uint64_t, ClientOrder> clients;
+    std::map<FIX::SessionID, std::unordered_map<std::string, Order*>> liveOrders; // by ClOrdID
+    uint64_t lastExecID = 0;
+
+    // The /market_prices segment watchMarket has mapped
+    struct MarketSegment {
+        dev_t device = 0;
+        ino_t inode = 0;
+        size_t size = 0;
+        uint32_t capacity = 0;
+        uint32_t bookDepth = 0;
+    };
+
+    // Map the producer's /market_prices segment read-only, and its header
+    // writable for the doorbell. Null while there is none.
+    static const SharedMemory* openMarketPrices(SharedMemory*& control, MarketSegment& mapped) {
+        int fd = shm_open("/market_prices", O_RDWR, 0666);
+        if (fd < 0) return nullptr;
+        struct stat st{};
+        void* header = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(SharedMemory))) {
+            header = mmap(nullptr, sizeof(SharedMemory), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (header == MAP_FAILED) {
+            close(fd);
+            return nullptr;
+        }
+        control = static_cast<SharedMemory*>(header);
+        size_t size = shared_memory_compatible(control) ? control->size() : 0;
+        void* segment = MAP_FAILED;
+        if (size && st.st_size >= static_cast<off_t>(size)) {
+            segment = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (segment == MAP_FAILED) {
+            munmap(header, sizeof(SharedMemory));
+            control = nullptr;
+            return nullptr;
+        }
+        mapped.device = st.st_dev;
+        mapped.inode = st.st_ino;
+        mapped.size = size;
+        mapped.capacity = control->capacity;
+        mapped.bookDepth = control->book_depth;
+        return static_cast<const SharedMemory*>(segment);
+    }
+
+    static void closeMarketPrices(SharedMemory*& control, const SharedMemory*& market, const MarketSegment& mapped) {
+        munmap(const_cast<SharedMemory*>(market), mapped.size);
+        munmap(control, sizeof(SharedMemory));
+        market = nullptr;
+        control = nullptr;
+    }
+
+    // True if the mapped segment is no longer the producer's: the name was
+    // removed or now names another file (a producer restarted), or the
+    // header was stamped again in place, which restarts update_head.
+    static bool marketReplaced(const SharedMemory* control, const MarketSegment& mapped, uint64_t cursor) {
+        if (control->update_head.load(std::memory_order_acquire) < cursor) return true;
+        if (!shared_memory_compatible(control) || control->capacity != mapped.capacity ||
+            control->book_depth != mapped.bookDepth) {
+            return true;
+        }
+        int fd = shm_open("/market_prices", O_RDONLY, 0);
+        if (fd < 0) return true;
+        struct stat st{};
+        bool replaced = fstat(fd, &st) != 0 || st.st_dev != mapped.device || st.st_ino != mapped.inode;
+        close(fd);
+        return replaced;
+    }
+
+    static char orderStatus(const Order& order) {
+        if (order.leaves == 0 && order.cum > 0) return FIX::OrdStatus_FILLED;
+        return order.cum > 0 ? FIX::OrdStatus_PARTIALLY_FILLED : FIX::OrdStatus_NEW;
+    }
+
+    // Whole lots of 10^-QuantityDecimals in qty, or 0 if it is not a
+    // positive multiple of one
+    int64_t toLots(double qty) const {
+        double lots = qty * engine.lot_scale;
+        int64_t whole = std::llround(lots);
+        return whole > 0 && std::fabs(lots - whole) < 1e-6 ? whole : 0;
+    }
+
+    // Ticks of 10^-decimals in price, or -1 if it is not a positive multiple of one
+    static int64_t toTicks(int decimals, double price) {
+        double ticks = price * std::pow(10.0, decimals);
+        int64_t whole = std::llround(ticks);
+        return whole > 0 && std::fabs(ticks - whole) < 1e-6 ? whole : -1;
+    }
+
+    FIX44::ExecutionReport executionReport(const Order& order, const ClientOrder& client, char execType,
+                                           char ordStatus) {
+        const OrderBook& book = engine.books[order.book];
+        FIX44::ExecutionReport report(
+            FIX::OrderID(std::to_string(order.id)),
+            FIX::ExecID(std::to_string(++lastExecID)),
+            FIX::ExecType(execType),
+            FIX::OrdStatus(ordStatus),
+            FIX::Side(order.side == OrderSide::BUY ? FIX::Side_BUY : FIX::Side_SELL),
+            FIX::LeavesQty(order.leaves / engine.lot_scale),
+            FIX::CumQty(order.cum / engine.lot_scale),
+            FIX::AvgPx(average_price(book, order))
+        );
+        report.set(FIX::ClOrdID(client.clOrdID));
+        report.set(FIX::Symbol(book.symbol));
+        report.set(FIX::OrderQty(order.quantity / engine.lot_scale));
+        report.set(FIX::OrdType(order.market ? FIX::OrdType_MARKET : FIX::OrdType_LIMIT));
+        if (!order.market) report.set(FIX::Price(order.price / book.scale));
+        if (order.immediate && !order.market) report.set(FIX::TimeInForce(FIX::TimeInForce_IMMEDIATE_OR_CANCEL));
+        return report;
+    }
+
+    // Stop tracking an order that is done; it may already be forgotten
+    void forget(const Order& order) {
+        auto found = clients.find(order.id);
+        if (found == clients.end()) return;
+        liveOrders[found->second.session].erase(found->second.clOrdID);
+        clients.erase(found);
+    }
+
+    // on_fill for the engine: one trade report per fill of each order
+    void reportFill(const Order& order, int64_t price, int64_t lots, Reports& reports) {
+        auto found = clients.find(order.id);
+        if (found == clients.end()) return;
+        FIX44::ExecutionReport report = executionReport(order, found->second, FIX::ExecType_TRADE, orderStatus(order));
+        report.set(FIX::LastPx(price / engine.books[order.book].scale));
+        report.set(FIX::LastQty(lots / engine.lot_scale));
+        reports.emplace_back(report, found->second.session);
+        if (order.leaves == 0) forget(order);
+    }
+
+    // After an order went through execute_order: release it unless it rests,
+    // canceling what an immediate order left open
+    void settle(Order* order, Reports& reports) {
+        if (order->level) return;
+        auto found = clients.find(order->id);
+        if (found != clients.end() && order->leaves > 0) {
+            cancel_order(engine, *order);
+            reports.emplace_back(executionReport(*order, found->second, FIX::ExecType_CANCELED,
+                                                 FIX::OrdStatus_CANCELED), found->second.session);
+        }
+        forget(*order);
+        release_order(engine, order);
+    }
+
+    static void sendReports(Reports& reports) {
+        for (auto& report : reports) FIX::Session::sendToTarget(report.first, report.second);
+    }
+
+    static void reject(const FIX::SessionID& sessionID, const FIX::ClOrdID& clOrdID, const FIX::Symbol& symbol,
+                       const FIX::Side& side, int reason, const std::string& text) {
+        FIX44::ExecutionReport report(
+            FIX::OrderID("NONE"),
+            FIX::ExecID("REJECT_" + clOrdID.getString()),
+            FIX::ExecType(FIX::ExecType_REJECTED),
+            FIX::OrdStatus(FIX::OrdStatus_REJECTED),
+            side,
+            FIX::LeavesQty(0),
+            FIX::CumQty(0),
+            FIX::AvgPx(0)
+        );
+        report.set(clOrdID);
+        report.set(symbol);
+        report.set(FIX::OrdRejReason(reason));
+        report.set(FIX::Text(text));
+        FIX::Session::sendToTarget(report, sessionID);
+        LOG_INFO("Rejected order ", clOrdID.getString(), ": ", text);
+    }
+
+    static void rejectCancel(const FIX::SessionID& sessionID, const FIX::ClOrdID& clOrdID,
+                             const FIX::OrigClOrdID& origClOrdID, char responseTo, const std::string& text) {
+        FIX44::OrderCancelReject report(
+            FIX::OrderID("NONE"),
+            clOrdID,
+            origClOrdID,
+            FIX::OrdStatus(FIX::OrdStatus_REJECTED),
+            FIX::CxlRejResponseTo(responseTo)
+        );
+        report.set(FIX::CxlRejReason(FIX::CxlRejReason_UNKNOWN_ORDER));
+        report.set(FIX::Text(text));
+        FIX::Session::sendToTarget(report, sessionID);
+        LOG_INFO("Rejected cancel ", clOrdID.getString(), " of ", origClOrdID.getString(), ": ", text);
+    }
+
     void handleNewOrder(const FIX::Message& message, const FIX::SessionID& sessionID) {
         FIX44::NewOrderSingle order(message);
 
@@ -67,39 +329,83 @@ private:
         FIX::Side side;
         FIX::OrderQty qty;
         FIX::OrdType ordType;
+        FIX::Price price;
+        FIX::TimeInForce timeInForce(FIX::TimeInForce_DAY);
 
         if (order.isSetField(FIX::FIELD::ClOrdID)) order.get(clOrdID);
         if (order.isSetField(FIX::FIELD::Symbol)) order.get(symbol);
         if (order.isSetField(FIX::FIELD::Side)) order.get(side);
         if (order.isSetField(FIX::FIELD::OrderQty)) order.get(qty);
         if (order.isSetField(FIX::FIELD::OrdType)) order.get(ordType);
+        if (order.isSetField(FIX::FIELD::Price)) order.get(price);
+        if (order.isSetField(FIX::FIELD::TimeInForce)) order.get(timeInForce);
+
+        LOG_DEBUG("Parsed NewOrderSingle -> ",
+                  "ClOrdID: ", clOrdID.getString(), ", ",
+                  "Symbol: ", symbol.getString(), ", ",
+                  "Side: ", (side.getValue() == FIX::Side_BUY ? "BUY" : "SELL"), ", ",
+                  "Qty: ", qty.getValue(), ", ",
+                  "Price: ", price.getValue());
+
+        const bool market = ordType.getValue() == FIX::OrdType_MARKET;
+        if (!market && ordType.getValue() != FIX::OrdType_LIMIT) {
+            return reject(sessionID, clOrdID, symbol, side, FIX::OrdRejReason_UNSUPPORTED_ORDER_CHARACTERISTIC,
+                          "Only market and limit orders are supported");
+        }
+        if (side.getValue() != FIX::Side_BUY && side.getValue() != FIX::Side_SELL) {
+            return reject(sessionID, clOrdID, symbol, side, FIX::OrdRejReason_UNSUPPORTED_ORDER_CHARACTERISTIC,
+                          "Side must be buy or sell");
+        }
+        char tif = timeInForce.getValue();
+        if (tif != FIX::TimeInForce_DAY && tif != FIX::TimeInForce_GOOD_TILL_CANCEL &&
+            tif != FIX::TimeInForce_IMMEDIATE_OR_CANCEL) {
+            return reject(sessionID, clOrdID, symbol, side, FIX::OrdRejReason_UNSUPPORTED_ORDER_CHARACTERISTIC,
+                          "TimeInForce must be day, good till cancel or immediate or cancel");
+        }
+        int64_t lots = toLots(qty.getValue());
+        if (lots == 0) {
+            return reject(sessionID, clOrdID, symbol, side, FIX::OrdRejReason_INCORRECT_QUANTITY,
+                          "OrderQty must be a positive multiple of the lot size");
+        }
+        if (symbol.getString().empty()) {
+            return reject(sessionID, clOrdID, symbol, side, FIX::OrdRejReason_UNKNOWN_SYMBOL, "Symbol is required");
+        }
 
-        std::cout << "Parsed NewOrderSingle -> "
-                  << "ClOrdID: " << clOrdID.getString() << ", "
-                  << "Symbol: " << symbol.getString() << ", "
-                  << "Side: "   << (side.getValue() == FIX::Side_BUY ? "BUY" : "SELL") << ", "
-                  << "Qty: "    << qty.getString()
-                  << std::endl;
-
-        // Send ExecutionReport ACK
-        FIX44::ExecutionReport exec(
-            FIX::OrderID("ORDER_" + std::to_string(std::rand())),
-            FIX::ExecID("EXEC_" + std::to_string(std::rand())),
-            FIX::ExecType(FIX::ExecType_FILL),
-            FIX::OrdStatus(FIX::OrdStatus_FILLED),
-            side,
-            FIX::LeavesQty(0),
-            FIX::CumQty(qty),
-            FIX::AvgPx(0)
-        );
-
-        exec.set(clOrdID);
-        exec.set(symbol);
-        exec.set(qty);
-        exec.set(ordType);
+        Reports reports;
+        {
+            std::lock_guard<std::mutex> lock(engineMutex);
+            auto& sessionOrders = liveOrders[sessionID];
+            if (sessionOrders.count(clOrdID.getString())) {
+                return reject(sessionID, clOrdID, symbol, side, FIX::OrdRejReason_DUPLICATE_ORDER,
+                              "ClOrdID is already in use by a live order");
+            }
 
-        FIX::Session::sendToTarget(exec, sessionID);
-        std::cout << "Sent ACK ExecutionReport (NewOrderSingle)\n";
+            // The book is created only for an order that is accepted
+            Order request;
+            request.side = side.getValue() == FIX::Side_BUY ? OrderSide::BUY : OrderSide::SELL;
+            request.market = market;
+            request.immediate = tif == FIX::TimeInForce_IMMEDIATE_OR_CANCEL;
+            request.price = market ? 0 : toTicks(book_decimals(engine, symbol.getString()), price.getValue());
+            request.quantity = lots;
+            if (request.price < 0) {
+                return reject(sessionID, clOrdID, symbol, side, FIX::OrdRejReason_OTHER,
+                              "Price must be a positive multiple of the tick size");
+            }
+            request.book = book_for(engine, symbol.getString());
+
+            Order* accepted = new_order(engine, request);
+            ClientOrder& client = clients[accepted->id];
+            client.session = sessionID;
+            client.clOrdID = clOrdID.getString();
+            sessionOrders[client.clOrdID] = accepted;
+            reports.emplace_back(executionReport(*accepted, client, FIX::ExecType_NEW, FIX::OrdStatus_NEW), sessionID);
+
+            execute_order(engine, *accepted, [&](const Order& filled, int64_t fillPrice, int64_t fillLots) {
+                reportFill(filled, fillPrice, fillLots, reports);
+            });
+            settle(accepted, reports);
+        }
+        sendReports(reports);
     }
 
     void handleCancel(const FIX::Message& message, const FIX::SessionID& sessionID) {
@@ -113,27 +419,33 @@ private:
         if (cancel.isSetField(FIX::FIELD::OrigClOrdID)) cancel.get(origClOrdID);
         if (cancel.isSetField(FIX::FIELD::Symbol)) cancel.get(symbol);
 
-        std::cout << "Parsed Cancel -> ClOrdID: " << clOrdID.getString()
-                  << ", OrigClOrdID: " << origClOrdID.getString()
-                  << ", Symbol: " << symbol.getString() << std::endl;
-
-        // Send a cancel ExecutionReport
-        FIX44::ExecutionReport exec(
-            FIX::OrderID("CANCEL_" + std::to_string(std::rand())),
-            FIX::ExecID("EXEC_" + std::to_string(std::rand())),
-            FIX::ExecType(FIX::ExecType_CANCELED),
-            FIX::OrdStatus(FIX::OrdStatus_CANCELED),
-            FIX::Side(FIX::Side_BUY),
-            FIX::LeavesQty(0),
-            FIX::CumQty(0),
-            FIX::AvgPx(0)
-        );
-
-        exec.set(clOrdID);
-        exec.set(symbol);
+        LOG_DEBUG("Parsed Cancel -> ClOrdID: ", clOrdID.getString(),
+                  ", OrigClOrdID: ", origClOrdID.getString(),
+                  ", Symbol: ", symbol.getString());
+
+        Reports reports;
+        {
+            std::lock_guard<std::mutex> lock(engineMutex);
+            auto& sessionOrders = liveOrders[sessionID];
+            auto found = sessionOrders.find(origClOrdID.getString());
+            if (found == sessionOrders.end()) {
+                return rejectCancel(sessionID, clOrdID, origClOrdID, FIX::CxlRejResponseTo_ORDER_CANCEL_REQUEST,
+                                    "Unknown order");
+            }
 
-        FIX::Session::sendToTarget(exec, sessionID);
-        std::cout << "Sent Cancel ACK ExecutionReport\n";
+            Order* order = found->second;
+            ClientOrder& client = clients[order->id];
+            client.clOrdID = clOrdID.getString();
+            cancel_order(engine, *order);
+            FIX44::ExecutionReport report =
+                executionReport(*order, client, FIX::ExecType_CANCELED, FIX::OrdStatus_CANCELED);
+            report.set(origClOrdID);
+            reports.emplace_back(report, sessionID);
+            sessionOrders.erase(found);
+            clients.erase(order->id);
+            release_order(engine, order);
+        }
+        sendReports(reports);
     }
 
     void handleCancelReplace(const FIX::Message& message, const FIX::SessionID& sessionID) {
@@ -143,38 +455,75 @@ private:
         FIX::OrigClOrdID origClOrdID;
         FIX::Symbol symbol;
         FIX::OrderQty qty;
+        FIX::Price price;
 
         if (replace.isSetField(FIX::FIELD::ClOrdID)) replace.get(clOrdID);
         if (replace.isSetField(FIX::FIELD::OrigClOrdID)) replace.get(origClOrdID);
         if (replace.isSetField(FIX::FIELD::Symbol)) replace.get(symbol);
         if (replace.isSetField(FIX::FIELD::OrderQty)) replace.get(qty);
+        const bool priceSet = replace.isSetField(FIX::FIELD::Price);
+        if (priceSet) replace.get(price);
+
+        LOG_DEBUG("Parsed CancelReplace -> ClOrdID: ", clOrdID.getString(),
+                  ", OrigClOrdID: ", origClOrdID.getString(),
+                  ", Symbol: ", symbol.getString(),
+                  ", New Qty: ", qty.getValue(),
+                  ", New Price: ", price.getValue());
+
+        const char responseTo = FIX::CxlRejResponseTo_ORDER_CANCEL_REPLACE_REQUEST;
+        Reports reports;
+        {
+            std::lock_guard<std::mutex> lock(engineMutex);
+            auto& sessionOrders = liveOrders[sessionID];
+            auto found = sessionOrders.find(origClOrdID.getString());
+            if (found == sessionOrders.end()) {
+                return rejectCancel(sessionID, clOrdID, origClOrdID, responseTo, "Unknown order");
+            }
+            if (clOrdID.getString() != origClOrdID.getString() && sessionOrders.count(clOrdID.getString())) {
+                return rejectCancel(sessionID, clOrdID, origClOrdID, responseTo,
+                                    "ClOrdID is already in use by a live order");
+            }
 
-        std::cout << "Parsed CancelReplace -> ClOrdID: " << clOrdID.getString()
-                  << ", OrigClOrdID: " << origClOrdID.getString()
-                  << ", Symbol: " << symbol.getString()
-                  << ", New Qty: " << qty.getString() << std::endl;
-
-        // Send replaced ExecutionReport
-        FIX44::ExecutionReport exec(
-            FIX::OrderID("REPLACED_" + std::to_string(std::rand())),
-            FIX::ExecID("EXEC_" + std::to_string(std::rand())),
-            FIX::ExecType(FIX::ExecType_REPLACE),
-            FIX::OrdStatus(FIX::OrdStatus_REPLACED),
-            FIX::Side(FIX::Side_BUY),
-            FIX::LeavesQty(0),
-            FIX::CumQty(qty),
-            FIX::AvgPx(0)
-        );
-
-        exec.set(clOrdID);
-        exec.set(symbol);
-        exec.set(qty);
+            Order* order = found->second;
+            int64_t lots = toLots(qty.getValue());
+            int64_t ticks = priceSet ? toTicks(engine.books[order->book].decimals, price.getValue()) : order->price;
+            if (lots == 0 || ticks < 0) {
+                return rejectCancel(sessionID, clOrdID, origClOrdID, responseTo,
+                                    lots == 0 ? "OrderQty must be a positive multiple of the lot size"
+                                              : "Price must be a positive multiple of the tick size");
+            }
 
-        FIX::Session::sendToTarget(exec, sessionID);
-        std::cout << "Sent Replace ACK ExecutionReport\n";
+            sessionOrders.erase(found);
+            ClientOrder& client = clients[order->id];
+            client.clOrdID = clOrdID.getString();
+            sessionOrders[client.clOrdID] = order;
+
+            bool requeue = replace_order(engine, *order, ticks, lots);
+            FIX44::ExecutionReport report =
+                executionReport(*order, client, FIX::ExecType_REPLACE, orderStatus(*order));
+            report.set(origClOrdID);
+            reports.emplace_back(report, sessionID);
+
+            if (requeue) {
+                execute_order(engine, *order, [&](const Order& filled, int64_t fillPrice, int64_t fillLots) {
+                    reportFill(filled, fillPrice, fillLots, reports);
+                });
+            }
+            settle(order, reports);
+        }
+        sendReports(reports);
     }
 };
 
+// Settings read from the [DEFAULT] section of feedsender.cfg, besides
+// QuickFIX's own; all optional:
+//   PriceDecimals=5     prices are whole ticks of 10^-N, unless the symbol
+//                       is priced in ticks in /market_prices, then its own
+//   QuantityDecimals=0  OrderQty is a whole number of lots of 10^-N
+//   LogLevel=info       least severe messages to log: debug, info, warning
+//                       or error; debug adds every order received
+// Orders trade with each other and, once price runs, with the market it
+// writes to /market_prices (see matching_engine.h).
 int main() {
     const char* cfgFile = "feedsender.cfg";
 
@@ -186,19 +535,38 @@ int main() {
 
     try {
         FIX::SessionSettings settings(cfgFile);
-        TradeReceiverApp application;
+        const FIX::Dictionary& defaults = settings.get();
+        if (defaults.has("LogLevel")) {
+            LogLevel level;
+            if (!parse_log_level(defaults.getString("LogLevel"), level)) {
+                std::cerr << "LogLevel must be debug, info, warning or error" << std::endl;
+                return 1;
+            }
+            set_log_level(level);
+        }
+
+        int priceDecimals = defaults.has("PriceDecimals") ? defaults.getInt("PriceDecimals") : 5;
+        int quantityDecimals = defaults.has("QuantityDecimals") ? defaults.getInt("QuantityDecimals") : 0;
+        if (priceDecimals < 0 || priceDecimals > MAX_TICK_DECIMALS || quantityDecimals < 0 ||
+            quantityDecimals > MAX_TICK_DECIMALS) {
+            std::cerr << "PriceDecimals and QuantityDecimals must be between 0 and " << MAX_TICK_DECIMALS << std::endl;
+            return 1;
+        }
+
+        TradeReceiverApp application(priceDecimals, quantityDecimals);
         FIX::FileStoreFactory storeFactory(settings);
 
         FIX::ThreadedSocketAcceptor acceptor(application, storeFactory, settings);
         acceptor.start();
-        std::cout << "FIX Acceptor started...\n";
+        LOG_INFO("FIX Acceptor started...");
+        std::thread(&TradeReceiverApp::watchMarket, &application).detach();
 
         while (true)
             std::this_thread::sleep_for(std::chrono::seconds(1));
 
         acceptor.stop();
     } catch (std::exception& e) {
-        std::cerr << "Exception: " << e.what() << std::endl;
+        LOG_ERROR("Exception: ", e.what());
         return 1;
     }
 
@@ -0,0 +1,96 @@
+#pragma once
+
+// Binary feed format, chosen by a terminal with the BINARY command (TEXT goes
+// back to lines).
+//
+// After the server's "> Binary mode" line, everything it sends is a stream
+// of fixed-size little-endian records. The first two bytes give the kind:
+//
+//   WIRE_SYMBOL  maps a symbol id to its name. Sent for every known symbol
+//                when binary mode starts, then once for each new symbol.
+//   WIRE_QUOTE   a bid/ask update for a symbol id.
+//   WIRE_TEXT    part of a server message such as "> Subscribed to 2 symbols".
+//                Consecutive records concatenate up to the '\n'.
+//   WIRE_PACKET  starts a multicast packet; the next count records belong
+//                to it. Only seen in multicast datagrams and in RETRANSMIT
+//                replies.
+//
+// Prices are integers scaled by 10^exponent: bid 123456 with exponent -5 is
+// 1.23456. A symbol's id does not change while the server runs. Its exponent
+// only changes when a formulas.cfg reload gives a synthetic new digits=; the
+// server then sends its WIRE_SYMBOL record again, with the new exponent,
+// before the first quote that uses it. The id of a synthetic a reload
+// removed may likewise be sent again with a new synthetic's name; from then
+// on the id means the new name.
+// Each id numbers its quotes 1, 2, 3, ... as the server produces them, and
+// keeps counting when it changes name; a client that sees a gap had updates
+// conflated or dropped, and one that sees a seq it already has can ignore
+// the quote.
+// Commands from the terminal (SUB, UNSUB, ...) remain text lines.
+//
+// Multicast (MulticastGroup in server.cfg): every datagram is one WIRE_PACKET
+// record followed by up to MULTICAST_RECORDS_PER_PACKET WIRE_SYMBOL and
+// WIRE_QUOTE records. Packet sequence numbers start at 1 and increase by one
+// per datagram. A receiver that sees a gap asks the TCP port, in binary mode,
+// for RETRANSMIT <first> <last>; if those packets have aged out it is told
+// to send SNAPSHOT, which returns every symbol and its latest quote as of a
+// packet sequence number, after which it resumes with the next packet.
+
+#include <cstddef>
+#include <cstdint>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "wire records are written in host order and must be little-endian");
+
+enum WireRecordType : uint16_t {
+    WIRE_SYMBOL = 1,
+    WIRE_QUOTE = 2,
+    WIRE_TEXT = 3,
+    WIRE_PACKET = 4,
+};
+
+constexpr size_t WIRE_RECORD_SIZE = 40;
+constexpr size_t WIRE_NAME_LEN = 32;    // NUL-padded, not always NUL-terminated
+
+// Keeps a datagram (header plus records) within a 1500-byte Ethernet MTU
+constexpr size_t MULTICAST_RECORDS_PER_PACKET = 35;
+
+struct WireQuote {
+    uint16_t type;          // WIRE_QUOTE
+    int8_t exponent;
+    uint8_t reserved;
+    uint32_t symbol_id;
+    uint64_t seq;           // the symbol's update number, see above
+    int64_t bid;
+    int64_t ask;
+    uint64_t timestamp_ns;  // producer time of the newest input, ns since the epoch
+};
+
+struct WireSymbol {
+    uint16_t type;          // WIRE_SYMBOL
+    int8_t exponent;
+    uint8_t reserved;
+    uint32_t symbol_id;
+    char name[WIRE_NAME_LEN];
+};
+
+struct WireText {
+    uint16_t type;          // WIRE_TEXT
+    uint8_t length;         // bytes of text used
+    uint8_t reserved;
+    char text[36];
+};
+
+struct WirePacket {
+    uint16_t type;          // WIRE_PACKET
+    uint16_t count;         // records that follow
+    uint32_t reserved;
+    uint64_t seq;           // packet sequence number
+    uint64_t timestamp_ns;  // when the server sent it, ns since the epoch
+    char reserved2[16];
+};
+
+static_assert(sizeof(WireQuote) == WIRE_RECORD_SIZE, "WireQuote must stay 40 bytes");
+static_assert(sizeof(WireSymbol) == WIRE_RECORD_SIZE, "WireSymbol must stay 40 bytes");
+static_assert(sizeof(WireText) == WIRE_RECORD_SIZE, "WireText must stay 40 bytes");
+static_assert(sizeof(WirePacket) == WIRE_RECORD_SIZE, "WirePacket must stay 40 bytes");